@@ -0,0 +1,42 @@
+/*
+Copyright (C) 2003-2008 Andrey Nazarov
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+//
+// CPU frame profiler. Zones nest and are recorded into per-thread ring
+// buffers while com_profile is set; profile_dump writes the last frames
+// as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+//
+// Zone names must be string literals, only the pointer is stored.
+//
+
+extern int      prof_enabled;
+
+void    Prof_Init(void);
+void    Prof_Frame(void);
+void    Prof_Begin(const char *name);
+void    Prof_End(void);
+
+#define PROF_BEGIN(name) \
+    do { if (prof_enabled) Prof_Begin(name); } while (0)
+#define PROF_END() \
+    do { if (prof_enabled) Prof_End(); } while (0)
+
+#endif // PROFILE_H
@@ -254,4 +254,9 @@ void    R_AddDecal(decal_t *d);
 void    R_SetRayProbe(vec3_t p, vec3_t n);
 #endif
 
+#if USE_REF == REF_VKPT
+// registers the CPU reference tracer when R_Init is never called
+void    R_InitReferenceTracer(void);
+#endif
+
 #endif // REFRESH_H
@@ -26,6 +26,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #ifdef _WIN32
 #include <io.h>
 #include <direct.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 #else
 #include <unistd.h>
 #endif
@@ -124,6 +127,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #define q_unused            __attribute__((unused))
 
+// acquire/release ordering is enough for single producer/consumer queues
+#define q_atomic_load(p)        __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define q_atomic_store(p, v)    __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define q_atomic_add(p, v)      __atomic_add_fetch(p, v, __ATOMIC_ACQ_REL)
+
+#define q_threadlocal       __thread
+
 #else /* __GNUC__ */
 
 #define q_printf(f, a)
@@ -146,4 +156,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #define q_unused
 
+#ifdef _MSC_VER
+// volatile accesses have acquire/release semantics on MSVC, 32-bit values only
+#define q_atomic_load(p)        (*(volatile long *)(p))
+#define q_atomic_store(p, v)    (*(volatile long *)(p) = (v))
+#define q_atomic_add(p, v)      (_InterlockedExchangeAdd((volatile long *)(p), v) + (v))
+#define q_threadlocal       __declspec(thread)
+#else
+#define q_threadlocal
+#endif
+
 #endif /* !__GNUC__ */
@@ -27,8 +27,27 @@ void    Sys_FreeLibrary(void *handle);
 void    *Sys_GetProcAddress(void *handle, const char *sym);
 
 unsigned    Sys_Milliseconds(void);
+uint64_t    Sys_Microseconds(void);
 void    Sys_Sleep(int msec);
 
+// threads, mutexes and auto-reset events
+typedef struct sys_thread_s     sys_thread_t;
+typedef struct sys_mutex_s      sys_mutex_t;
+typedef struct sys_event_s      sys_event_t;
+
+sys_thread_t    *Sys_CreateThread(void (*func)(void *), void *arg);
+void    Sys_JoinThread(sys_thread_t *thread);
+
+sys_mutex_t     *Sys_CreateMutex(void);
+void    Sys_DestroyMutex(sys_mutex_t *mutex);
+void    Sys_LockMutex(sys_mutex_t *mutex);
+void    Sys_UnlockMutex(sys_mutex_t *mutex);
+
+sys_event_t     *Sys_CreateEvent(void);
+void    Sys_DestroyEvent(sys_event_t *event);
+void    Sys_SetEvent(sys_event_t *event);
+void    Sys_WaitEvent(sys_event_t *event);
+
 void    Sys_Init(void);
 void    Sys_AddDefaultConfig(void);
 
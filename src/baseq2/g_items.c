@@ -802,7 +802,7 @@ edict_t *Drop_Item(edict_t *ent, gitem_t *item)
 
     dropped = G_Spawn();
 
-    dropped->classname = item->classname;
+    G_SetClassname(dropped, item->classname);
     dropped->item = item;
     dropped->spawnflags = DROPPED_ITEM;
     dropped->s.effects = item->world_model_flags;
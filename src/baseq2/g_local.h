@@ -611,6 +611,11 @@ void Touch_Item(edict_t *ent, edict_t *other, cplane_t *plane, csurface_t *surf)
 qboolean    KillBox(edict_t *ent);
 void    G_ProjectSource(const vec3_t point, const vec3_t distance, const vec3_t forward, const vec3_t right, vec3_t result);
 edict_t *G_Find(edict_t *from, int fieldofs, char *match);
+void    G_InvalidateFindIndex(void);
+void    G_UpdateFindIndex(edict_t *e);
+void    G_SetClassname(edict_t *e, char *classname);
+void    G_SetTargetname(edict_t *e, char *targetname);
+void    G_HookLinks(void);
 edict_t *findradius(edict_t *from, vec3_t org, float rad);
 edict_t *G_PickTarget(char *targetname);
 void    G_UseTargets(edict_t *ent, edict_t *activator);
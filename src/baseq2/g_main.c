@@ -199,6 +199,7 @@ and global variables
 q_exported game_export_t *GetGameAPI(game_import_t *import)
 {
     gi = *import;
+    G_HookLinks();
 
     globals.apiversion = GAME_API_VERSION;
     globals.Init = InitGame;
@@ -293,7 +294,7 @@ edict_t *CreateTargetChangeLevel(char *map)
     edict_t *ent;
 
     ent = G_Spawn();
-    ent->classname = "target_changelevel";
+    G_SetClassname(ent, "target_changelevel");
     Q_snprintf(level.nextmap, sizeof(level.nextmap), "%s", map);
     ent->map = level.nextmap;
     return ent;
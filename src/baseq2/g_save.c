@@ -966,6 +966,8 @@ void ReadLevel(const char *filename)
 
     fclose(f);
 
+    G_InvalidateFindIndex();
+
     // mark all clients as unconnected
     for (i = 0 ; i < maxclients->value ; i++) {
         ent = &g_edicts[i + 1];
@@ -504,6 +504,8 @@ void ED_ParseEdict(const char **data, edict_t *ent)
 
     if (!init)
         memset(ent, 0, sizeof(*ent));
+
+    G_UpdateFindIndex(ent);
 }
 
 
@@ -586,6 +588,7 @@ void SpawnEntities(const char *mapname, const char *entities, const char *spawnp
 
     memset(&level, 0, sizeof(level));
     memset(g_edicts, 0, game.maxentities * sizeof(g_edicts[0]));
+    G_InvalidateFindIndex();
 
     strncpy(level.mapname, mapname, sizeof(level.mapname) - 1);
     strncpy(game.spawnpoint, spawnpoint, sizeof(game.spawnpoint) - 1);
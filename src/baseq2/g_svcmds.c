@@ -17,6 +17,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "g_local.h"
+#include <time.h>
 
 
 void    Svcmd_Test_f(void)
@@ -27,6 +28,191 @@ void    Svcmd_Test_f(void)
 /*
 ==============================================================================
 
+FIND BENCHMARK
+
+Times G_Find and findradius against plain scans of all edicts, using the
+names and origins of entities on the current level as queries, and checks
+that both return the same entities. Run it on an entity heavy map:
+
+sv findbench [passes] [radius]
+
+==============================================================================
+*/
+
+static edict_t *scan_find(edict_t *from, int fieldofs, char *match)
+{
+    char    *s;
+
+    if (!from)
+        from = g_edicts;
+    else
+        from++;
+
+    for (; from < &g_edicts[globals.num_edicts] ; from++) {
+        if (!from->inuse)
+            continue;
+        s = *(char **)((byte *)from + fieldofs);
+        if (!s)
+            continue;
+        if (!Q_stricmp(s, match))
+            return from;
+    }
+
+    return NULL;
+}
+
+static edict_t *scan_radius(edict_t *from, vec3_t org, float rad)
+{
+    vec3_t  eorg;
+    int     j;
+
+    if (!from)
+        from = g_edicts;
+    else
+        from++;
+
+    for (; from < &g_edicts[globals.num_edicts]; from++) {
+        if (!from->inuse)
+            continue;
+        if (from->solid == SOLID_NOT)
+            continue;
+        for (j = 0 ; j < 3 ; j++)
+            eorg[j] = org[j] - (from->s.origin[j] + (from->mins[j] + from->maxs[j]) * 0.5);
+        if (VectorLength(eorg) > rad)
+            continue;
+        return from;
+    }
+
+    return NULL;
+}
+
+static int bench_find(edict_t *(*find)(edict_t *, int, char *), edict_t *query[], int count)
+{
+    edict_t *e;
+    int     i, found = 0;
+
+    for (i = 0; i < count; i++) {
+        for (e = NULL; (e = find(e, FOFS(classname), query[i]->classname)) != NULL; )
+            found++;
+        if (!query[i]->targetname)
+            continue;
+        for (e = NULL; (e = find(e, FOFS(targetname), query[i]->targetname)) != NULL; )
+            found++;
+    }
+
+    return found;
+}
+
+static int bench_radius(edict_t *(*find)(edict_t *, vec3_t, float), edict_t *query[], int count, float rad)
+{
+    edict_t *e;
+    int     i, found = 0;
+
+    for (i = 0; i < count; i++)
+        for (e = NULL; (e = find(e, query[i]->s.origin, rad)) != NULL; )
+            found++;
+
+    return found;
+}
+
+static int check_results(edict_t *query[], int count, float rad)
+{
+    edict_t *a, *b;
+    int     i, errors = 0;
+
+    for (i = 0; i < count; i++) {
+        a = b = NULL;
+        do {
+            a = G_Find(a, FOFS(classname), query[i]->classname);
+            b = scan_find(b, FOFS(classname), query[i]->classname);
+            errors += a != b;
+        } while (a && b);
+
+        if (query[i]->targetname) {
+            a = b = NULL;
+            do {
+                a = G_Find(a, FOFS(targetname), query[i]->targetname);
+                b = scan_find(b, FOFS(targetname), query[i]->targetname);
+                errors += a != b;
+            } while (a && b);
+        }
+
+        a = b = NULL;
+        do {
+            a = findradius(a, query[i]->s.origin, rad);
+            b = scan_radius(b, query[i]->s.origin, rad);
+            errors += a != b;
+        } while (a && b);
+    }
+
+    return errors;
+}
+
+static double bench_msec(clock_t start)
+{
+    return (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+static void Svcmd_FindBench_f(void)
+{
+    static edict_t  *query[MAX_EDICTS];
+    edict_t *e;
+    int     i, count, passes, found[2], errors;
+    float   rad;
+    double  msec[2];
+    clock_t start;
+
+    passes = gi.argc() > 2 ? atoi(gi.argv(2)) : 10;
+    rad = gi.argc() > 3 ? atof(gi.argv(3)) : 512;
+    if (passes < 1)
+        passes = 1;
+
+    count = 0;
+    for (i = 1, e = g_edicts + 1; i < globals.num_edicts; i++, e++)
+        if (e->inuse && e->classname)
+            query[count++] = e;
+
+    if (!count) {
+        gi.cprintf(NULL, PRINT_HIGH, "No entities to search for\n");
+        return;
+    }
+
+    // also builds the find index
+    errors = check_results(query, count, rad);
+
+    gi.cprintf(NULL, PRINT_HIGH, "%d entities, %d queries, %d passes, %d mismatches\n",
+               globals.num_edicts, count, passes, errors);
+
+    found[0] = found[1] = 0;
+    start = clock();
+    for (i = 0; i < passes; i++)
+        found[0] += bench_find(G_Find, query, count);
+    msec[0] = bench_msec(start);
+    start = clock();
+    for (i = 0; i < passes; i++)
+        found[1] += bench_find(scan_find, query, count);
+    msec[1] = bench_msec(start);
+
+    gi.cprintf(NULL, PRINT_HIGH, "G_Find:     %8.2f ms, scan %8.2f ms (%d/%d found)\n",
+               msec[0], msec[1], found[0], found[1]);
+
+    found[0] = found[1] = 0;
+    start = clock();
+    for (i = 0; i < passes; i++)
+        found[0] += bench_radius(findradius, query, count, rad);
+    msec[0] = bench_msec(start);
+    start = clock();
+    for (i = 0; i < passes; i++)
+        found[1] += bench_radius(scan_radius, query, count, rad);
+    msec[1] = bench_msec(start);
+
+    gi.cprintf(NULL, PRINT_HIGH, "findradius: %8.2f ms, scan %8.2f ms (%d/%d found)\n",
+               msec[0], msec[1], found[0], found[1]);
+}
+
+/*
+==============================================================================
+
 PACKET FILTERING
 
 
@@ -287,6 +473,8 @@ void    ServerCommand(void)
         SVCmd_ListIP_f();
     else if (Q_stricmp(cmd, "writeip") == 0)
         SVCmd_WriteIP_f();
+    else if (Q_stricmp(cmd, "findbench") == 0)
+        Svcmd_FindBench_f();
     else
         gi.cprintf(NULL, PRINT_HIGH, "Unknown server command \"%s\"\n", cmd);
 }
@@ -28,6 +28,189 @@ void G_ProjectSource(const vec3_t point, const vec3_t distance, const vec3_t for
 }
 
 
+/*
+=============
+Find index
+
+Hash chains of edict numbers for classname and targetname lookups, kept in
+ascending edict order. Built lazily on the first search and updated in place
+when an edict is allocated, freed or renamed, so searches done by think
+functions don't rescan all edicts. Entries are verified on lookup, so hash
+collisions and edicts freed behind our back are harmless.
+
+Code changing classname or targetname of an existing edict must go through
+G_SetClassname() and G_SetTargetname(), or call G_UpdateFindIndex() after
+writing the fields. G_InvalidateFindIndex() is for bulk changes like
+spawning or loading a level.
+=============
+*/
+#define FIND_HASH_SIZE  256
+
+enum { FIND_CLASSNAME, FIND_TARGETNAME, FIND_NUM_FIELDS };
+
+static struct {
+    qboolean    valid;
+    short       heads[FIND_NUM_FIELDS][FIND_HASH_SIZE];
+    short       next[FIND_NUM_FIELDS][MAX_EDICTS];
+    short       prev[FIND_NUM_FIELDS][MAX_EDICTS];
+    short       hash[FIND_NUM_FIELDS][MAX_EDICTS];  // -1 if not linked
+} find_index;
+
+static int find_hash(const char *s)
+{
+    unsigned hash = 0;
+
+    while (*s)
+        hash = hash * 31 + Q_tolower(*s++);
+
+    return hash & (FIND_HASH_SIZE - 1);
+}
+
+static char *find_field(edict_t *e, int field)
+{
+    return field == FIND_CLASSNAME ? e->classname : e->targetname;
+}
+
+static void find_unlink(int field, int n)
+{
+    short   *next = find_index.next[field];
+    short   *prev = find_index.prev[field];
+    int     hash = find_index.hash[field][n];
+
+    if (hash == -1)
+        return;
+
+    if (prev[n] == -1)
+        find_index.heads[field][hash] = next[n];
+    else
+        next[prev[n]] = next[n];
+    if (next[n] != -1)
+        prev[next[n]] = prev[n];
+
+    find_index.hash[field][n] = -1;
+}
+
+static void find_link(int field, int n, int hash)
+{
+    short   *next = find_index.next[field];
+    short   *prev = find_index.prev[field];
+    int     p, x;
+
+    // keep the chain sorted
+    for (p = -1, x = find_index.heads[field][hash]; x != -1 && x < n; p = x, x = next[x])
+        ;
+
+    prev[n] = p;
+    next[n] = x;
+    if (p == -1)
+        find_index.heads[field][hash] = n;
+    else
+        next[p] = n;
+    if (x != -1)
+        prev[x] = n;
+
+    find_index.hash[field][n] = hash;
+}
+
+static void find_update(edict_t *e, int field)
+{
+    int     n = e - g_edicts;
+    int     hash = -1;
+    char    *s;
+
+    s = find_field(e, field);
+    if (e->inuse && s)
+        hash = find_hash(s);
+
+    if (hash == find_index.hash[field][n])
+        return;
+
+    find_unlink(field, n);
+    if (hash != -1)
+        find_link(field, n, hash);
+}
+
+static void build_find_index(void)
+{
+    int     i, j;
+
+    memset(find_index.heads, -1, sizeof(find_index.heads));
+    memset(find_index.hash, -1, sizeof(find_index.hash));
+
+    // going backwards puts every edict at the head of its chain
+    for (i = globals.num_edicts - 1; i >= 0; i--)
+        for (j = 0; j < FIND_NUM_FIELDS; j++)
+            find_update(&g_edicts[i], j);
+
+    find_index.valid = qtrue;
+}
+
+void G_InvalidateFindIndex(void)
+{
+    find_index.valid = qfalse;
+}
+
+void G_UpdateFindIndex(edict_t *e)
+{
+    if (!find_index.valid)
+        return;
+
+    find_update(e, FIND_CLASSNAME);
+    find_update(e, FIND_TARGETNAME);
+}
+
+void G_SetClassname(edict_t *e, char *classname)
+{
+    e->classname = classname;
+    if (find_index.valid)
+        find_update(e, FIND_CLASSNAME);
+}
+
+void G_SetTargetname(edict_t *e, char *targetname)
+{
+    e->targetname = targetname;
+    if (find_index.valid)
+        find_update(e, FIND_TARGETNAME);
+}
+
+static edict_t *find_indexed(edict_t *from, int field, char *match)
+{
+    edict_t *e;
+    char    *s;
+    int     n, start, hash;
+
+    if (!find_index.valid)
+        build_find_index();
+
+    hash = find_hash(match);
+    start = 0;
+    n = find_index.heads[field][hash];
+
+    // continue from the previous match if it is still in the chain
+    if (from) {
+        start = from - g_edicts + 1;
+        if (find_index.hash[field][start - 1] == hash)
+            n = find_index.next[field][start - 1];
+    }
+
+    for (; n != -1; n = find_index.next[field][n]) {
+        if (n < start)
+            continue;
+        if (n >= globals.num_edicts)
+            break;
+        e = &g_edicts[n];
+        if (!e->inuse)
+            continue;
+        s = find_field(e, field);
+        if (!s)
+            continue;
+        if (!Q_stricmp(s, match))
+            return e;
+    }
+
+    return NULL;
+}
+
 /*
 =============
 G_Find
@@ -44,6 +227,11 @@ edict_t *G_Find(edict_t *from, int fieldofs, char *match)
 {
     char    *s;
 
+    if (fieldofs == FOFS(classname))
+        return find_indexed(from, FIND_CLASSNAME, match);
+    if (fieldofs == FOFS(targetname))
+        return find_indexed(from, FIND_TARGETNAME, match);
+
     if (!from)
         from = g_edicts;
     else
@@ -63,6 +251,137 @@ edict_t *G_Find(edict_t *from, int fieldofs, char *match)
 }
 
 
+static qboolean in_radius(edict_t *ent, vec3_t org, float rad)
+{
+    vec3_t  eorg;
+    int     j;
+
+    if (!ent->inuse)
+        return qfalse;
+    if (ent->solid == SOLID_NOT)
+        return qfalse;
+    for (j = 0 ; j < 3 ; j++)
+        eorg[j] = org[j] - (ent->s.origin[j] + (ent->mins[j] + ent->maxs[j]) * 0.5);
+    return VectorLength(eorg) <= rad;
+}
+
+/*
+=============
+Unlinked edicts
+
+Edicts in use that are not linked into the world. findradius() takes its
+candidates from the world area links, these are added so that it still
+returns everything a scan of all edicts would. Kept up to date by wrappers
+around gi.linkentity and gi.unlinkentity, and by edict allocation. Entries
+are verified when gathered, so edicts freed or linked behind our back just
+drop out.
+=============
+*/
+static struct {
+    int     num;
+    short   list[MAX_EDICTS];
+    short   pos[MAX_EDICTS];    // position in list + 1, 0 if not listed
+} unlinked;
+
+static void (*real_linkentity)(edict_t *ent);
+static void (*real_unlinkentity)(edict_t *ent);
+
+static void unlinked_add(edict_t *e)
+{
+    int n = e - g_edicts;
+
+    if (unlinked.pos[n])
+        return;
+
+    unlinked.list[unlinked.num++] = n;
+    unlinked.pos[n] = unlinked.num;
+}
+
+static void unlinked_remove(edict_t *e)
+{
+    int n = e - g_edicts;
+    int i = unlinked.pos[n];
+    int last;
+
+    if (!i)
+        return;
+
+    last = unlinked.list[--unlinked.num];
+    unlinked.list[i - 1] = last;
+    unlinked.pos[last] = i;
+    unlinked.pos[n] = 0;
+}
+
+static void G_LinkEntity(edict_t *ent)
+{
+    real_linkentity(ent);
+
+    // server may refuse to link it
+    if (ent->area.prev)
+        unlinked_remove(ent);
+    else if (ent->inuse)
+        unlinked_add(ent);
+}
+
+static void G_UnlinkEntity(edict_t *ent)
+{
+    real_unlinkentity(ent);
+
+    if (ent->inuse)
+        unlinked_add(ent);
+}
+
+void G_HookLinks(void)
+{
+    real_linkentity = gi.linkentity;
+    real_unlinkentity = gi.unlinkentity;
+    gi.linkentity = G_LinkEntity;
+    gi.unlinkentity = G_UnlinkEntity;
+
+    memset(&unlinked, 0, sizeof(unlinked));
+}
+
+static struct {
+    vec3_t  org;
+    float   rad;
+    byte    bits[MAX_EDICTS / 8];
+    edict_t *list[MAX_EDICTS];
+} radius_search;
+
+static void gather_radius(vec3_t org, float rad)
+{
+    vec3_t  mins, maxs;
+    edict_t *e;
+    int     i, area, count;
+
+    for (i = 0; i < 3; i++) {
+        mins[i] = org[i] - rad;
+        maxs[i] = org[i] + rad;
+    }
+
+    memset(radius_search.bits, 0, sizeof(radius_search.bits));
+
+    for (area = AREA_SOLID; area <= AREA_TRIGGERS; area++) {
+        count = gi.BoxEdicts(mins, maxs, radius_search.list, MAX_EDICTS, area);
+        for (i = 0; i < count; i++)
+            Q_SetBit(radius_search.bits, radius_search.list[i] - g_edicts);
+    }
+
+    for (i = 0; i < unlinked.num; i++) {
+        e = &g_edicts[unlinked.list[i]];
+        if (!e->inuse || e->area.prev) {
+            unlinked_remove(e);
+            i--;
+            continue;
+        }
+        if (e->solid != SOLID_NOT)
+            Q_SetBit(radius_search.bits, unlinked.list[i]);
+    }
+
+    VectorCopy(org, radius_search.org);
+    radius_search.rad = rad;
+}
+
 /*
 =================
 findradius
@@ -70,27 +389,41 @@ findradius
 Returns entities that have origins within a spherical area
 
 findradius (origin, radius)
+
+Candidates are taken from the world area links and the list of unlinked
+edicts instead of scanning all edicts, and are marked in a bit set so that
+they come out in ascending edict order, same as the scan did.
+
+The candidates are gathered once when a search starts (from == NULL) and
+walked by the following calls, so a whole search costs one area query.
+Each candidate is checked again when it is returned, as callers may move,
+free or unlink entities between calls. Entities spawned after the search
+started are not returned. If a nested search replaced the candidates,
+they are gathered again.
 =================
 */
 edict_t *findradius(edict_t *from, vec3_t org, float rad)
 {
-    vec3_t  eorg;
-    int     j;
-
-    if (!from)
+    byte    *bits = radius_search.bits;
+    int     n;
+
+    if (!from) {
+        gather_radius(org, rad);
+        // world is never linked
+        if (in_radius(g_edicts, org, rad))
+            return g_edicts;
         from = g_edicts;
-    else
-        from++;
-    for (; from < &g_edicts[globals.num_edicts]; from++) {
-        if (!from->inuse)
-            continue;
-        if (from->solid == SOLID_NOT)
-            continue;
-        for (j = 0 ; j < 3 ; j++)
-            eorg[j] = org[j] - (from->s.origin[j] + (from->mins[j] + from->maxs[j]) * 0.5);
-        if (VectorLength(eorg) > rad)
+    } else if (!VectorCompare(org, radius_search.org) || rad != radius_search.rad) {
+        gather_radius(org, rad);
+    }
+
+    for (n = from - g_edicts + 1; n < globals.num_edicts; n++) {
+        if (!(n & 7) && !bits[n >> 3]) {
+            n += 7;
             continue;
-        return from;
+        }
+        if (Q_IsBitSet(bits, n) && in_radius(&g_edicts[n], org, rad))
+            return &g_edicts[n];
     }
 
     return NULL;
@@ -173,7 +506,7 @@ void G_UseTargets(edict_t *ent, edict_t *activator)
     if (ent->delay) {
         // create a temp object to fire at a later time
         t = G_Spawn();
-        t->classname = "DelayedUse";
+        G_SetClassname(t, "DelayedUse");
         t->nextthink = level.time + ent->delay;
         t->think = Think_Delay;
         t->activator = activator;
@@ -375,6 +708,10 @@ void G_InitEdict(edict_t *e)
     e->classname = "noclass";
     e->gravity = 1.0;
     e->s.number = e - g_edicts;
+
+    G_UpdateFindIndex(e);
+    if (!e->area.prev)
+        unlinked_add(e);
 }
 
 /*
@@ -431,6 +768,9 @@ void G_FreeEdict(edict_t *ed)
     ed->classname = "freed";
     ed->freetime = level.time;
     ed->inuse = qfalse;
+
+    G_UpdateFindIndex(ed);
+    unlinked_remove(ed);
 }
 
 
@@ -33,6 +33,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/msg.h"
 #include "common/net/chan.h"
 #include "common/net/net.h"
+#include "common/profile.h"
 #include "common/prompt.h"
 #include "common/protocol.h"
 #include "common/sizebuf.h"
@@ -60,6 +61,7 @@ typedef struct centity_s {
     entity_state_t    prev;            // will always be valid, but might just be a copy of current
 
     vec3_t          mins, maxs;
+    vec3_t          absmin, absmax;     // world bounds of solid entity for prediction
 
     int             serverframe;        // if not current, this ent isn't in the frame
 
@@ -157,6 +159,19 @@ typedef struct client_state_s {
     unsigned     cmdNumber;
     short        predicted_origins[CMD_BACKUP][3];    // for debug comparing against server
     client_history_t    history[CMD_BACKUP];
+
+    // pmove results for commands run by the last CL_PredictMovement,
+    // reused until server frame or acknowledged command changes
+    struct {
+        unsigned        cmdNumber;
+        usercmd_t       cmd;
+        pmove_state_t   s;
+        vec3_t          viewangles;
+    } predicted_states[CMD_BACKUP];
+    pmove_state_t   predicted_base;
+    int             predicted_base_frame;
+    unsigned        predicted_base_cmd;
+    unsigned        predicted_count;    // number of valid predicted_states
     int         initialSeq;
 
     float       predicted_step;                // for stair up smoothing
@@ -437,7 +452,10 @@ typedef struct client_static_s {
         int         file_offset;
         int         file_percent;
         sizebuf_t   buffer;
-        list_t      snapshots;
+        struct demosnap_s   **snapshots;    // sorted by framenum
+        int         numsnapshots;
+        int         numindexed;         // number of snapshots loaded from index file
+        char        index_name[MAX_OSPATH];
         qboolean    paused;
         qboolean    seeking;
         qboolean    eof;
@@ -741,8 +759,6 @@ void CL_CheckPredictionError(void);
 #define INSTANT_PARTICLE    -10000.0
 
 typedef struct cparticle_s {
-    struct cparticle_s    *next;
-
     float   time;
 
     vec3_t  org;
@@ -27,6 +27,7 @@ static byte     demo_buffer[MAX_PACKETLEN];
 static cvar_t   *cl_demosnaps;
 static cvar_t   *cl_demomsglen;
 static cvar_t   *cl_demowait;
+static cvar_t   *cl_demoindex;
 
 // =========================================================================
 
@@ -619,6 +620,8 @@ static int read_next_message(qhandle_t f)
     return 1;
 }
 
+static void save_demo_index(void);
+
 static void finish_demo(int ret)
 {
     char *s = Cvar_VariableString("nextserver");
@@ -657,6 +660,9 @@ static int parse_next_message(int wait)
     int ret;
 
     ret = read_next_message(cls.demo.playback);
+    if (ret == 0) {
+        save_demo_index();
+    }
     if (ret < 0 || (ret == 0 && wait == 0)) {
         finish_demo(ret);
         return -1;
@@ -730,6 +736,7 @@ static void CL_PlayDemo_f(void)
     CL_Disconnect(ERR_RECONNECT);
 
     cls.demo.playback = f;
+    Q_concat(cls.demo.index_name, sizeof(cls.demo.index_name), name, ".idx", NULL);
     cls.state = ca_connected;
     Q_strlcpy(cls.servername, COM_SkipPath(name), sizeof(cls.servername));
     cls.serverAddress.type = NA_LOOPBACK;
@@ -754,14 +761,199 @@ static void CL_Demo_c(genctx_t *ctx, int argnum)
     }
 }
 
-typedef struct {
-    list_t entry;
+typedef struct demosnap_s {
     int framenum;
     off_t filepos;
     size_t msglen;
     byte data[1];
 } demosnap_t;
 
+#define SNAPSHOT_CHUNK      64
+
+#define DEMO_INDEX_MAGIC    MakeRawLong('D','I','D','X')
+#define DEMO_INDEX_VERSION  1
+
+static void add_snapshot(demosnap_t *snap)
+{
+    if (!(cls.demo.numsnapshots & (SNAPSHOT_CHUNK - 1))) {
+        cls.demo.snapshots = Z_Realloc(cls.demo.snapshots,
+                                       sizeof(cls.demo.snapshots[0]) *
+                                       (cls.demo.numsnapshots + SNAPSHOT_CHUNK));
+    }
+    cls.demo.snapshots[cls.demo.numsnapshots++] = snap;
+}
+
+static void free_snapshots(void)
+{
+    size_t total = 0;
+    int i;
+
+    for (i = 0; i < cls.demo.numsnapshots; i++) {
+        total += cls.demo.snapshots[i]->msglen;
+        Z_Free(cls.demo.snapshots[i]);
+    }
+
+    Z_Free(cls.demo.snapshots);
+    cls.demo.snapshots = NULL;
+    cls.demo.numsnapshots = 0;
+    cls.demo.numindexed = 0;
+
+    if (total)
+        Com_DPrintf("Freed %"PRIz" bytes of snaps\n", total);
+}
+
+/*
+====================
+load_demo_index
+
+Loads snapshots from the index file saved by previous playback of the same
+demo. Index is rejected if demo file size or header length doesn't match.
+====================
+*/
+static void load_demo_index(void)
+{
+    uint32_t header[5], entry[3];
+    demosnap_t *snap;
+    qhandle_t f;
+    ssize_t ret;
+    int i, count, framenum;
+    size_t msglen;
+    off_t filepos;
+
+    if (!cls.demo.index_name[0])
+        return;
+
+    FS_FOpenFile(cls.demo.index_name, &f, FS_MODE_READ);
+    if (!f)
+        return;
+
+    ret = FS_Read(header, sizeof(header), f);
+    if (ret != sizeof(header))
+        goto fail;
+
+    if (LittleLong(header[0]) != DEMO_INDEX_MAGIC ||
+        LittleLong(header[1]) != DEMO_INDEX_VERSION ||
+        LittleLong(header[2]) != cls.demo.file_size ||
+        LittleLong(header[3]) != cls.demo.file_offset) {
+        Com_DPrintf("Ignoring stale demo index %s\n", cls.demo.index_name);
+        FS_FCloseFile(f);
+        return;
+    }
+
+    count = LittleLong(header[4]);
+    framenum = INT_MIN;
+    for (i = 0; i < count; i++) {
+        ret = FS_Read(entry, sizeof(entry), f);
+        if (ret != sizeof(entry))
+            goto fail;
+
+        filepos = LittleLong(entry[1]);
+        msglen = LittleLong(entry[2]);
+        if ((int)LittleLong(entry[0]) <= framenum || msglen > MAX_MSGLEN ||
+            filepos < cls.demo.file_offset ||
+            filepos > cls.demo.file_offset + cls.demo.file_size)
+            goto fail;
+
+        snap = Z_Malloc(sizeof(*snap) + msglen - 1);
+        snap->framenum = framenum = LittleLong(entry[0]);
+        snap->filepos = filepos;
+        snap->msglen = msglen;
+
+        ret = FS_Read(snap->data, msglen, f);
+        if (ret != msglen) {
+            Z_Free(snap);
+            goto fail;
+        }
+
+        add_snapshot(snap);
+    }
+
+    FS_FCloseFile(f);
+
+    Com_DPrintf("Loaded %d snaps from %s\n", count, cls.demo.index_name);
+
+    cls.demo.numindexed = count;
+    if (count)
+        cls.demo.last_snapshot = framenum;
+    return;
+
+fail:
+    Com_WPrintf("Couldn't load demo index %s: %s\n", cls.demo.index_name,
+                Q_ErrorString(ret < 0 ? ret : Q_ERR_INVALID_FORMAT));
+    FS_FCloseFile(f);
+    free_snapshots();
+}
+
+/*
+====================
+save_demo_index
+
+Called when the end of demo is reached. Snapshots are emitted in order and
+without gaps, so at this point they cover the entire demo.
+====================
+*/
+static void save_demo_index(void)
+{
+    uint32_t header[5], entry[3];
+    demosnap_t *snap;
+    qhandle_t f;
+    ssize_t ret;
+    int i;
+
+    if (cl_demoindex->integer <= 0)
+        return;
+
+    if (!cls.demo.index_name[0] || !cls.demo.file_size)
+        return;
+
+    if (cls.demo.numsnapshots <= cls.demo.numindexed)
+        return;
+
+    FS_FOpenFile(cls.demo.index_name, &f, FS_MODE_WRITE);
+    if (!f) {
+        Com_EPrintf("Couldn't open %s for writing\n", cls.demo.index_name);
+        return;
+    }
+
+    header[0] = LittleLong(DEMO_INDEX_MAGIC);
+    header[1] = LittleLong(DEMO_INDEX_VERSION);
+    header[2] = LittleLong(cls.demo.file_size);
+    header[3] = LittleLong(cls.demo.file_offset);
+    header[4] = LittleLong(cls.demo.numsnapshots);
+
+    ret = FS_Write(header, sizeof(header), f);
+    if (ret != sizeof(header))
+        goto fail;
+
+    for (i = 0; i < cls.demo.numsnapshots; i++) {
+        snap = cls.demo.snapshots[i];
+        entry[0] = LittleLong(snap->framenum);
+        entry[1] = LittleLong(snap->filepos);
+        entry[2] = LittleLong(snap->msglen);
+
+        ret = FS_Write(entry, sizeof(entry), f);
+        if (ret != sizeof(entry))
+            goto fail;
+
+        ret = FS_Write(snap->data, snap->msglen, f);
+        if (ret != snap->msglen)
+            goto fail;
+    }
+
+    FS_FCloseFile(f);
+
+    Com_Printf("Wrote demo index %s (%d snapshots).\n",
+               cls.demo.index_name, cls.demo.numsnapshots);
+
+    cls.demo.numindexed = cls.demo.numsnapshots;
+    return;
+
+fail:
+    FS_FCloseFile(f);
+    Com_EPrintf("Couldn't write %s: %s\n", cls.demo.index_name,
+                Q_ErrorString(ret < 0 ? ret : Q_ERR_FAILURE));
+}
+
 /*
 ====================
 CL_EmitDemoSnapshot
@@ -839,7 +1031,7 @@ void CL_EmitDemoSnapshot(void)
     snap->filepos = pos;
     snap->msglen = msg_write.cursize;
     memcpy(snap->data, msg_write.data, msg_write.cursize);
-    List_Append(&cls.demo.snapshots, &snap->entry);
+    add_snapshot(snap);
 
     Com_DPrintf("[%d] snaplen %"PRIz"\n", cls.demo.frames_read, msg_write.cursize);
 
@@ -850,20 +1042,23 @@ void CL_EmitDemoSnapshot(void)
 
 static demosnap_t *find_snapshot(int framenum)
 {
-    demosnap_t *snap, *prev;
+    int lo, hi, mid;
 
-    if (LIST_EMPTY(&cls.demo.snapshots))
+    if (!cls.demo.numsnapshots)
         return NULL;
 
-    prev = LIST_FIRST(demosnap_t, &cls.demo.snapshots, entry);
-
-    LIST_FOR_EACH(demosnap_t, snap, &cls.demo.snapshots, entry) {
-        if (snap->framenum > framenum)
-            break;
-        prev = snap;
+    // find the last snapshot not past framenum
+    lo = 0;
+    hi = cls.demo.numsnapshots - 1;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (cls.demo.snapshots[mid]->framenum > framenum)
+            hi = mid - 1;
+        else
+            lo = mid;
     }
 
-    return prev;
+    return cls.demo.snapshots[lo];
 }
 
 /*
@@ -898,6 +1093,10 @@ void CL_FirstDemoFrame(void)
 
     // force initial snapshot
     cls.demo.last_snapshot = INT_MIN;
+
+    // pick up snapshots from previous playback
+    if (cl_demoindex->integer > 0 && !cls.demo.numsnapshots)
+        load_demo_index();
 }
 
 static void CL_Seek_f(void)
@@ -969,6 +1168,10 @@ static void CL_Seek_f(void)
     if (frames < 0 || cls.demo.last_snapshot > cls.demo.frames_read) {
         snap = find_snapshot(dest);
 
+        // don't go back when skipping forward is shorter
+        if (snap && frames > 0 && snap->framenum <= cls.demo.frames_read)
+            snap = NULL;
+
         if (snap) {
             Com_DPrintf("found snap at %d\n", snap->framenum);
             ret = FS_Seek(cls.demo.playback, snap->filepos);
@@ -1007,6 +1210,9 @@ static void CL_Seek_f(void)
     // skip forward to destination frame
     while (cls.demo.frames_read < dest) {
         ret = read_next_message(cls.demo.playback);
+        if (ret == 0) {
+            save_demo_index();
+        }
         if (ret == 0 && cl_demowait->integer) {
             cls.demo.eof = qtrue;
             break;
@@ -1178,9 +1384,6 @@ fail:
 
 void CL_CleanupDemos(void)
 {
-    demosnap_t *snap, *next;
-    size_t total;
-
     if (cls.demo.recording) {
         CL_Stop_f();
     }
@@ -1201,18 +1404,9 @@ void CL_CleanupDemos(void)
         }
     }
 
-    total = 0;
-    LIST_FOR_EACH_SAFE(demosnap_t, snap, next, &cls.demo.snapshots, entry) {
-        total += snap->msglen;
-        Z_Free(snap);
-    }
-
-    if (total)
-        Com_DPrintf("Freed %"PRIz" bytes of snaps\n", total);
+    free_snapshots();
 
     memset(&cls.demo, 0, sizeof(cls.demo));
-
-    List_Init(&cls.demo.snapshots);
 }
 
 /*
@@ -1275,9 +1469,9 @@ void CL_InitDemos(void)
     cl_demosnaps = Cvar_Get("cl_demosnaps", "10", 0);
     cl_demomsglen = Cvar_Get("cl_demomsglen", va("%d", MAX_PACKETLEN_WRITABLE_DEFAULT), 0);
     cl_demowait = Cvar_Get("cl_demowait", "0", 0);
+    cl_demoindex = Cvar_Get("cl_demoindex", "0", 0);
 
     Cmd_Register(c_demo);
-    List_Init(&cls.demo.snapshots);
 }
 
 
@@ -19,6 +19,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "client.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 static void CL_LogoutEffect(vec3_t org, int type);
 
 static vec3_t avelocities[NUMVERTEXNORMALS];
@@ -811,35 +815,104 @@ PARTICLE MANAGEMENT
 ==============================================================
 */
 
-static cparticle_t  *active_particles, *free_particles;
+/*
+Effects fill particles in a staging array returned by CL_AllocParticle().
+CL_AddParticles() moves them into groups of 4 that keep each field in its
+own small array, so that the update pass can process a whole group at
+once while still reading memory in one linear stream. Live particles are
+kept packed at the start. The update pass only records expired
+particles, the holes are then filled with the last live ones.
+*/
+typedef struct {
+    float   time[4];
+    float   org[3][4];
+    float   vel[3][4];
+    float   accel[3][4];
+    float   alpha[4];
+    float   alphavel[4];
+    int     color[4];
+    color_t rgba[4];
+} pgroup_t;
+
+#define PGROUP(n)   (&particle_groups[(n) >> 2])
+#define PINDEX(n)   ((n) & 3)
+
+static pgroup_t     *particle_groups;
+static int          cl_numgroups;
+static cparticle_t  *spawned_particles;
+static int          *expired_particles;
+static int          cl_numspawned;
+static int          cl_numexpired;
+static int          cl_numparticles;
+static int          cl_allocparticles;
+
+static cvar_t       *cl_maxparticles;
 
-static cparticle_t  particles[MAX_PARTICLES];
-static const int    cl_numparticles = MAX_PARTICLES;
+extern int          r_numparticles;
+extern int          r_maxparticles;
+extern particle_t   *r_particles;
 
 static void CL_ClearParticles(void)
 {
-    int     i;
+    int     count;
 
-    free_particles = &particles[0];
-    active_particles = NULL;
+    count = Cvar_ClampInteger(cl_maxparticles, 1024, 65536);
+    if (count != cl_allocparticles) {
+        // scene particles are sized to match
+        Z_Free(particle_groups);
+        Z_Free(spawned_particles);
+        Z_Free(expired_particles);
+        Z_Free(r_particles);
+        cl_numgroups = (count + 3) >> 2;
+        particle_groups = Z_Malloc(sizeof(*particle_groups) * cl_numgroups);
+        spawned_particles = Z_Malloc(sizeof(*spawned_particles) * count);
+        expired_particles = Z_Malloc(sizeof(*expired_particles) * count);
+        r_particles = Z_Malloc(sizeof(*r_particles) * count);
+        r_maxparticles = cl_allocparticles = count;
+        r_numparticles = 0;
+    }
 
-    for (i = 0; i < cl_numparticles; i++)
-        particles[i].next = &particles[i + 1];
-    particles[cl_numparticles - 1].next = NULL;
+    cl_numspawned = 0;
+    cl_numexpired = 0;
+    cl_numparticles = 0;
+}
+
+static void cl_maxparticles_changed(cvar_t *self)
+{
+    CL_ClearParticles();
 }
 
 cparticle_t *CL_AllocParticle(void)
+{
+    if (cl_numparticles + cl_numspawned >= cl_allocparticles)
+        return NULL;
+
+    return &spawned_particles[cl_numspawned++];
+}
+
+static void CL_StoreParticles(void)
 {
     cparticle_t *p;
+    pgroup_t    *g;
+    int         i, j, k;
 
-    if (!free_particles)
-        return NULL;
-    p = free_particles;
-    free_particles = p->next;
-    p->next = active_particles;
-    active_particles = p;
+    for (i = 0, p = spawned_particles; i < cl_numspawned; i++, p++) {
+        g = PGROUP(cl_numparticles);
+        k = PINDEX(cl_numparticles);
+        g->time[k] = p->time;
+        for (j = 0; j < 3; j++) {
+            g->org[j][k] = p->org[j];
+            g->vel[j][k] = p->vel[j];
+            g->accel[j][k] = p->accel[j];
+        }
+        g->alpha[k] = p->alpha;
+        g->alphavel[k] = p->alphavel;
+        g->color[k] = p->color;
+        g->rgba[k] = p->rgba;
+        cl_numparticles++;
+    }
 
-    return p;
+    cl_numspawned = 0;
 }
 
 /*
@@ -1785,81 +1858,182 @@ void CL_TeleportParticles(vec3_t org)
             }
 }
 
-extern int          r_numparticles;
-extern particle_t   r_particles[MAX_PARTICLES];
+static void move_particle(int to, int from)
+{
+    pgroup_t    *a = PGROUP(to), *b = PGROUP(from);
+    int         i = PINDEX(to), k = PINDEX(from);
+    int         j;
 
-/*
-===============
-CL_AddParticles
-===============
-*/
-void CL_AddParticles(void)
+    a->time[i] = b->time[k];
+    for (j = 0; j < 3; j++) {
+        a->org[j][i] = b->org[j][k];
+        a->vel[j][i] = b->vel[j][k];
+        a->accel[j][i] = b->accel[j][k];
+    }
+    a->alpha[i] = b->alpha[k];
+    a->alphavel[i] = b->alphavel[k];
+    a->color[i] = b->color[k];
+    a->rgba[i] = b->rgba[k];
+}
+
+static inline void emit_particle(pgroup_t *g, int k, float x, float y, float z, float alpha)
+{
+    particle_t  *part;
+    int         color;
+
+    if (g->alphavel[k] == INSTANT_PARTICLE) {
+        g->alphavel[k] = 0.0;
+        g->alpha[k] = 0.0;
+    }
+
+    // keep simulating particles that don't fit into the scene
+    if (r_numparticles >= r_maxparticles)
+        return;
+    part = &r_particles[r_numparticles++];
+
+    if (alpha > 1.0)
+        alpha = 1;
+    color = g->color[k];
+
+    part->origin[0] = x;
+    part->origin[1] = y;
+    part->origin[2] = z;
+
+    if (color == -1) {
+        part->rgba.u8[0] = g->rgba[k].u8[0];
+        part->rgba.u8[1] = g->rgba[k].u8[1];
+        part->rgba.u8[2] = g->rgba[k].u8[2];
+        part->rgba.u8[3] = g->rgba[k].u8[3] * alpha;
+    }
+
+    part->color = color;
+    part->alpha = alpha;
+}
+
+// updates particles from i on
+static void update_particles(int i)
 {
-    cparticle_t     *p, *next;
-    float           alpha;
-    float           time = 0, time2;
-    int             color;
-    cparticle_t     *active, *tail;
-    particle_t      *part;
-
-    active = NULL;
-    tail = NULL;
-
-    for (p = active_particles; p; p = next) {
-        next = p->next;
-
-        if (p->alphavel != INSTANT_PARTICLE) {
-            time = (cl.time - p->time) * 0.001;
-            alpha = p->alpha + time * p->alphavel;
+    float       time, time2, alpha;
+    float       now = cl.time;
+    pgroup_t    *g;
+    int         k;
+
+    for (; i < cl_numparticles; i++) {
+        g = PGROUP(i);
+        k = PINDEX(i);
+
+        if (g->alphavel[k] != INSTANT_PARTICLE) {
+            time = (now - g->time[k]) * 0.001f;
+            alpha = g->alpha[k] + time * g->alphavel[k];
             if (alpha <= 0) {
-                // faded out
-                p->next = free_particles;
-                free_particles = p;
+                expired_particles[cl_numexpired++] = i;
                 continue;
             }
         } else {
-            alpha = p->alpha;
+            time = 0;
+            alpha = g->alpha[k];
         }
 
-        if (r_numparticles >= MAX_PARTICLES)
-            break;
-        part = &r_particles[r_numparticles++];
-
-        p->next = NULL;
-        if (!tail)
-            active = tail = p;
-        else {
-            tail->next = p;
-            tail = p;
-        }
-
-        if (alpha > 1.0)
-            alpha = 1;
-        color = p->color;
-
         time2 = time * time;
 
-        part->origin[0] = p->org[0] + p->vel[0] * time + p->accel[0] * time2;
-        part->origin[1] = p->org[1] + p->vel[1] * time + p->accel[1] * time2;
-        part->origin[2] = p->org[2] + p->vel[2] * time + p->accel[2] * time2;
+        emit_particle(g, k,
+                      g->org[0][k] + g->vel[0][k] * time + g->accel[0][k] * time2,
+                      g->org[1][k] + g->vel[1][k] * time + g->accel[1][k] * time2,
+                      g->org[2][k] + g->vel[2][k] * time + g->accel[2][k] * time2,
+                      alpha);
+    }
+}
 
-        if (color == -1) {
-            part->rgba.u8[0] = p->rgba.u8[0];
-            part->rgba.u8[1] = p->rgba.u8[1];
-            part->rgba.u8[2] = p->rgba.u8[2];
-            part->rgba.u8[3] = p->rgba.u8[3] * alpha;
+#ifdef __SSE2__
+// same as above for whole groups, returns where it stopped
+static int update_particles_sse2(void)
+{
+    __m128      now = _mm_set1_ps(cl.time);
+    __m128      scale = _mm_set1_ps(0.001f);
+    __m128      instant = _mm_set1_ps(INSTANT_PARTICLE);
+    __m128      time, time2, alpha, alphavel, mask;
+    float       out[4][4];
+    pgroup_t    *g;
+    int         i, j, k, bits;
+
+    for (i = 0, g = particle_groups; i + 4 <= cl_numparticles; i += 4, g++) {
+        alphavel = _mm_loadu_ps(g->alphavel);
+        mask = _mm_cmpeq_ps(alphavel, instant);
+
+        // instant particles don't move and don't fade
+        time = _mm_mul_ps(_mm_sub_ps(now, _mm_loadu_ps(g->time)), scale);
+        time = _mm_andnot_ps(mask, time);
+        alpha = _mm_add_ps(_mm_loadu_ps(g->alpha),
+                           _mm_andnot_ps(mask, _mm_mul_ps(time, alphavel)));
+        mask = _mm_or_ps(mask, _mm_cmpgt_ps(alpha, _mm_setzero_ps()));
+        bits = _mm_movemask_ps(mask);
+
+        time2 = _mm_mul_ps(time, time);
+        for (j = 0; j < 3; j++) {
+            _mm_storeu_ps(out[j], _mm_add_ps(_mm_add_ps(_mm_loadu_ps(g->org[j]),
+                                                        _mm_mul_ps(_mm_loadu_ps(g->vel[j]), time)),
+                                             _mm_mul_ps(_mm_loadu_ps(g->accel[j]), time2)));
         }
+        _mm_storeu_ps(out[3], alpha);
 
-        part->color = color;
-        part->alpha = alpha;
+        for (k = 0; k < 4; k++) {
+            if (bits & (1 << k))
+                emit_particle(g, k, out[0][k], out[1][k], out[2][k], out[3][k]);
+            else
+                expired_particles[cl_numexpired++] = i + k;
+        }
+    }
 
-        if (p->alphavel == INSTANT_PARTICLE) {
-            p->alphavel = 0.0;
-            p->alpha = 0.0;
+    return i;
+}
+#endif
+
+// fills holes left by expired particles with the last live ones
+static void remove_expired(void)
+{
+    int     i, last, n;
+
+    n = cl_numparticles;
+    last = cl_numexpired - 1;
+
+    for (i = 0; i <= last; i++) {
+        // expired particles at the end just go away
+        while (last >= i && expired_particles[last] == n - 1) {
+            last--;
+            n--;
         }
+        if (last < i)
+            break;
+        move_particle(expired_particles[i], --n);
     }
 
-    active_particles = active;
+    cl_numparticles = n;
+    cl_numexpired = 0;
+}
+
+static void add_particles(qboolean simd)
+{
+    int     i = 0;
+
+    CL_StoreParticles();
+
+#ifdef __SSE2__
+    if (simd)
+        i = update_particles_sse2();
+#endif
+
+    update_particles(i);
+    remove_expired();
+}
+
+/*
+===============
+CL_AddParticles
+===============
+*/
+void CL_AddParticles(void)
+{
+    add_particles(qtrue);
 }
 
 
@@ -1877,6 +2051,102 @@ void CL_ClearEffects(void)
 #endif
 }
 
+#if USE_TESTS
+
+/*
+===============
+CL_ParticleTest_f
+
+Keeps the particle pool saturated with explosion and teleport effects and
+times the update pass over the given number of frames, once with the
+scalar code and once with SIMD code on the same particles. Also checks
+that both produce the same scene particles.
+===============
+*/
+static void CL_ParticleTest_f(void)
+{
+    vec3_t      org;
+    void        *backup;
+    particle_t  *scene;
+    int         i, j, frames, oldtime, total, count, errors;
+    unsigned    start, msec[2];
+    float       d, maxdelta;
+
+    frames = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 1000;
+    if (frames < 1)
+        frames = 1;
+
+    backup = Z_Malloc(sizeof(*particle_groups) * cl_numgroups);
+    scene = Z_Malloc(sizeof(*scene) * r_maxparticles);
+
+    oldtime = cl.time;
+    total = errors = 0;
+    msec[0] = msec[1] = 0;
+    maxdelta = 0;
+    VectorClear(org);
+    CL_ClearParticles();
+
+    for (i = 0; i < frames; i++) {
+        // refill the pool
+        while (cl_numparticles + cl_numspawned < cl_allocparticles) {
+            org[0] = crand() * 512;
+            org[1] = crand() * 512;
+            org[2] = crand() * 512;
+            if (rand() & 1)
+                CL_BFGExplosionParticles(org);
+            else
+                CL_ExplosionParticles(org);
+        }
+        CL_BigTeleportParticles(org);
+        CL_StoreParticles();
+
+        total += cl_numparticles;
+        memcpy(backup, particle_groups, sizeof(*particle_groups) * cl_numgroups);
+        count = cl_numparticles;
+
+        start = Sys_Milliseconds();
+        r_numparticles = 0;
+        add_particles(qfalse);
+        msec[0] += Sys_Milliseconds() - start;
+
+        memcpy(scene, r_particles, sizeof(*scene) * r_numparticles);
+        j = r_numparticles;
+        memcpy(particle_groups, backup, sizeof(*particle_groups) * cl_numgroups);
+        cl_numparticles = count;
+
+        start = Sys_Milliseconds();
+        r_numparticles = 0;
+        add_particles(qtrue);
+        msec[1] += Sys_Milliseconds() - start;
+
+        if (j != r_numparticles) {
+            errors++;
+        } else {
+            for (j = 0; j < r_numparticles; j++) {
+                d = Distance(scene[j].origin, r_particles[j].origin) +
+                    fabs(scene[j].alpha - r_particles[j].alpha);
+                maxdelta = max(maxdelta, d);
+                errors += scene[j].color != r_particles[j].color;
+            }
+        }
+
+        cl.time += 16;
+    }
+
+    Com_Printf("%d frames, %d particles, scalar %u msec, simd %u msec\n",
+               frames, total, msec[0], msec[1]);
+    Com_Printf("%d mismatches, max delta %f\n", errors, maxdelta);
+
+    Z_Free(backup);
+    Z_Free(scene);
+
+    cl.time = oldtime;
+    r_numparticles = 0;
+    CL_ClearParticles();
+}
+
+#endif
+
 void CL_InitEffects(void)
 {
     int i, j;
@@ -1885,5 +2155,12 @@ void CL_InitEffects(void)
         for (j = 0; j < 3; j++)
             avelocities[i][j] = (rand() & 255) * 0.01f;
 
+    cl_maxparticles = Cvar_Get("cl_maxparticles", va("%d", MAX_PARTICLES), 0);
+    cl_maxparticles->changed = cl_maxparticles_changed;
+    CL_ClearParticles();
+
+#if USE_TESTS
+    Cmd_AddCommand("particletest", CL_ParticleTest_f);
+#endif
 }
 
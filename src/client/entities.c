@@ -148,6 +148,40 @@ static inline qboolean entity_new(const centity_t *ent)
     return qfalse;
 }
 
+// calculate world bounds used to reject solid entities from prediction traces
+static void entity_set_bounds(centity_t *ent)
+{
+    mmodel_t *cmodel;
+    vec_t radius;
+    int i;
+
+    if (ent->current.solid != PACKED_BSP) {
+        VectorAdd(ent->current.origin, ent->mins, ent->absmin);
+        VectorAdd(ent->current.origin, ent->maxs, ent->absmax);
+    } else if ((cmodel = cl.model_clip[ent->current.modelindex]) == NULL) {
+        // not clipped against
+        VectorClear(ent->absmin);
+        VectorClear(ent->absmax);
+        return;
+    } else if (ent->current.angles[0] || ent->current.angles[1] || ent->current.angles[2]) {
+        // expand for rotation
+        radius = RadiusFromBounds(cmodel->mins, cmodel->maxs);
+        for (i = 0; i < 3; i++) {
+            ent->absmin[i] = ent->current.origin[i] - radius;
+            ent->absmax[i] = ent->current.origin[i] + radius;
+        }
+    } else {
+        VectorAdd(ent->current.origin, cmodel->mins, ent->absmin);
+        VectorAdd(ent->current.origin, cmodel->maxs, ent->absmax);
+    }
+
+    // movement is clipped an epsilon away from an actual edge
+    for (i = 0; i < 3; i++) {
+        ent->absmin[i] -= 1;
+        ent->absmax[i] += 1;
+    }
+}
+
 static void entity_update(const entity_state_t *state)
 {
     centity_t *ent = &cl_entities[state->number];
@@ -392,6 +426,10 @@ void CL_DeltaFrame(void)
         entity_event(state->number);
     }
 
+    for (i = 0; i < cl.numSolidEntities; i++) {
+        entity_set_bounds(cl.solidEntities[i]);
+    }
+
     if (cls.demo.recording && !cls.demo.paused && !cls.demo.seeking && CL_FRAMESYNC) {
         CL_EmitDemoFrame();
     }
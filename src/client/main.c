@@ -3236,7 +3236,9 @@ unsigned CL_Frame(unsigned msec)
     CL_SendCmd();
 
     // predict all unacknowledged movements
+    PROF_BEGIN("CL_PredictMovement");
     CL_PredictMovement();
+    PROF_END();
 
     Con_RunConsole();
 
@@ -3247,7 +3249,9 @@ unsigned CL_Frame(unsigned msec)
         if (host_speeds->integer)
             time_before_ref = Sys_Milliseconds();
 
+        PROF_BEGIN("SCR_UpdateScreen");
         SCR_UpdateScreen();
+        PROF_END();
 
         if (host_speeds->integer)
             time_after_ref = Sys_Milliseconds();
@@ -3257,7 +3261,9 @@ unsigned CL_Frame(unsigned msec)
 
 run_fx:
         // update audio after the 3D view was drawn
+        PROF_BEGIN("S_Update");
         S_Update();
+        PROF_END();
 
         // advance local effects for next frame
 #if USE_DLIGHTS
@@ -3325,6 +3331,10 @@ CL_Init
 void CL_Init(void)
 {
     if (dedicated->integer) {
+#if USE_REF == REF_VKPT
+        // CPU reference tracer needs neither a window nor Vulkan
+        R_InitReferenceTracer();
+#endif
         return; // nothing running on the client
     }
 
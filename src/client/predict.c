@@ -61,6 +61,9 @@ void CL_CheckPredictionError(void)
     SHOWMISS("prediction miss on %i: %i (%d %d %d)\n",
              cl.frame.number, len, delta[0], delta[1], delta[2]);
 
+    // replay all commands from the corrected state
+    cl.predicted_count = 0;
+
     // don't predict steps against server returned data
     if (cl.predicted_step_frame <= cmd)
         cl.predicted_step_frame = cmd + 1;
@@ -79,15 +82,32 @@ CL_ClipMoveToEntities
 */
 static void CL_ClipMoveToEntities(vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, trace_t *tr)
 {
-    int         i;
+    int         i, j;
     trace_t     trace;
     mnode_t     *headnode;
     centity_t   *ent;
     mmodel_t    *cmodel;
+    vec3_t      boxmins, boxmaxs;
+
+    // bounds of the entire move
+    for (j = 0; j < 3; j++) {
+        if (end[j] > start[j]) {
+            boxmins[j] = start[j] + mins[j];
+            boxmaxs[j] = end[j] + maxs[j];
+        } else {
+            boxmins[j] = end[j] + mins[j];
+            boxmaxs[j] = start[j] + maxs[j];
+        }
+    }
 
     for (i = 0; i < cl.numSolidEntities; i++) {
         ent = cl.solidEntities[i];
 
+        if (ent->absmin[0] > boxmaxs[0] || ent->absmax[0] < boxmins[0] ||
+            ent->absmin[1] > boxmaxs[1] || ent->absmax[1] < boxmins[1] ||
+            ent->absmin[2] > boxmaxs[2] || ent->absmax[2] < boxmins[2])
+            continue;
+
         if (ent->current.solid == PACKED_BSP) {
             // special value for bmodel
             cmodel = cl.model_clip[ent->current.modelindex];
@@ -145,6 +165,11 @@ static int CL_PointContents(vec3_t point)
         if (ent->current.solid != PACKED_BSP) // special value for bmodel
             continue;
 
+        if (ent->absmin[0] > point[0] || ent->absmax[0] < point[0] ||
+            ent->absmin[1] > point[1] || ent->absmax[1] < point[1] ||
+            ent->absmin[2] > point[2] || ent->absmax[2] < point[2])
+            continue;
+
         cmodel = cl.model_clip[ent->current.modelindex];
         if (!cmodel)
             continue;
@@ -174,7 +199,7 @@ void CL_PredictAngles(void)
 
 void CL_PredictMovement(void)
 {
-    unsigned    ack, current, frame;
+    unsigned    ack, current, frame, i;
     pmove_t     pm;
     int         step, oldz;
 
@@ -223,13 +248,46 @@ void CL_PredictMovement(void)
     VectorCopy(cl.delta_angles, pm.s.delta_angles);
 #endif
 
+    // results of the last run stay valid as long as the base state and
+    // solid entities are the same, which can only change with a new frame
+    if (cl.predicted_base_frame != cl.frame.number ||
+        cl.predicted_base_cmd != ack ||
+        memcmp(&cl.predicted_base, &pm.s, sizeof(pm.s))) {
+        cl.predicted_base = pm.s;
+        cl.predicted_base_frame = cl.frame.number;
+        cl.predicted_base_cmd = ack;
+        cl.predicted_count = 0;
+    }
+
+    // skip frames with cached results
+    for (i = 0; i < cl.predicted_count && ack < current; i++) {
+        frame = (ack + 1) & CMD_MASK;
+        if (cl.predicted_states[frame].cmdNumber != ack + 1)
+            break;
+        if (memcmp(&cl.predicted_states[frame].cmd, &cl.cmds[frame], sizeof(usercmd_t)))
+            break;
+        pm.s = cl.predicted_states[frame].s;
+        VectorCopy(cl.predicted_states[frame].viewangles, pm.viewangles);
+        ack++;
+    }
+
+    cl.predicted_count = ack - cl.predicted_base_cmd;
+
     // run frames
     while (++ack <= current) {
-        pm.cmd = cl.cmds[ack & CMD_MASK];
+        frame = ack & CMD_MASK;
+        pm.cmd = cl.cmds[frame];
         Pmove(&pm, &cl.pmp);
 
         // save for debug checking
-        VectorCopy(pm.s.origin, cl.predicted_origins[ack & CMD_MASK]);
+        VectorCopy(pm.s.origin, cl.predicted_origins[frame]);
+
+        // save for next run
+        cl.predicted_states[frame].cmdNumber = ack;
+        cl.predicted_states[frame].cmd = pm.cmd;
+        cl.predicted_states[frame].s = pm.s;
+        VectorCopy(pm.viewangles, cl.predicted_states[frame].viewangles);
+        cl.predicted_count++;
     }
 
     // run pending cmd
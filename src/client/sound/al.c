@@ -31,6 +31,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // OpenAL implementation should support at least this number of sources
 #define MIN_CHANNELS 16
 
+static cvar_t   *al_sources;
+
 static ALuint s_srcnums[MAX_CHANNELS];
 static int s_framecount;
 
@@ -45,7 +47,7 @@ void AL_SoundInfo(void)
 
 qboolean AL_Init(void)
 {
-    int i;
+    int i, numsources;
 
     Com_DPrintf("Initializing OpenAL\n");
 
@@ -59,24 +61,36 @@ qboolean AL_Init(void)
         goto fail1;
     }
 
+    // MAX_CHANNELS is sized for the DMA mixer, which culls inaudible
+    // voices itself. Many OpenAL implementations limit the number of
+    // sources, so only ask for as many as configured and take what is
+    // granted, one at a time.
+    al_sources = Cvar_Get("al_sources", "32", 0);
+    numsources = Cvar_ClampInteger(al_sources, MIN_CHANNELS, MAX_CHANNELS);
+
     // generate source names
     qalGetError();
-    for (i = 0; i < MAX_CHANNELS; i++) {
+    for (i = 0; i < numsources; i++) {
         qalGenSources(1, &s_srcnums[i]);
         if (qalGetError() != AL_NO_ERROR) {
             break;
         }
     }
 
-    Com_DPrintf("Got %d AL sources\n", i);
+    Com_DPrintf("Got %d of %d AL sources\n", i, numsources);
 
     if (i < MIN_CHANNELS) {
+        if (i)
+            qalDeleteSources(i, s_srcnums);
+        memset(s_srcnums, 0, sizeof(s_srcnums));
         Com_SetLastError("Insufficient number of AL sources");
         goto fail1;
     }
 
     s_numchannels = i;
 
+    al_sources->flags |= CVAR_SOUND;
+
     Com_Printf("OpenAL initialized.\n");
     return qtrue;
 
@@ -91,6 +105,9 @@ void AL_Shutdown(void)
 {
     Com_Printf("Shutting down OpenAL.\n");
 
+    if (al_sources)
+        al_sources->flags &= ~CVAR_SOUND;
+
     if (s_numchannels) {
         // delete source names
         qalDeleteSources(s_numchannels, s_srcnums);
@@ -23,6 +23,7 @@ dma_t       dma;
 
 cvar_t      *s_khz;
 cvar_t      *s_testsound;
+cvar_t      *s_soundcache;
 #if USE_DSOUND
 static cvar_t       *s_direct;
 #endif
@@ -41,6 +42,102 @@ void DMA_SoundInfo(void)
     Com_Printf("%p dma buffer\n", dma.buffer);
 }
 
+#if USE_TESTS
+
+static sfx_t *DMA_MixTestSound(const char *name, int length, int width)
+{
+    sfx_t *sfx = Z_Mallocz(sizeof(*sfx));
+    sfxcache_t *sc = Z_Malloc(sizeof(*sc) + length * width - 1);
+    int i;
+
+    Q_strlcpy(sfx->name, name, sizeof(sfx->name));
+    sc->length = length;
+    sc->loopstart = 0;
+    sc->width = width;
+    for (i = 0; i < length * width; i++)
+        sc->data[i] = rand();
+    sfx->cache = sc;
+
+    return sfx;
+}
+
+/*
+============
+DMA_MixTest_f
+
+Mixes synthetic looping channels into a scratch buffer and reports
+mixer throughput, independent of the output device.
+============
+*/
+static void DMA_MixTest_f(void)
+{
+    sfx_t *sfx[2];
+    channel_t *ch;
+    void *buffer, *scratch;
+    int i, numchannels, samples, oldpaintedtime, oldrawend;
+    unsigned start, msec;
+
+    if (Cmd_Argc() > 3) {
+        Com_Printf("Usage: %s [channels] [seconds]\n", Cmd_Argv(0));
+        return;
+    }
+
+    numchannels = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : MAX_CHANNELS;
+    clamp(numchannels, 1, MAX_CHANNELS);
+    samples = (Cmd_Argc() > 2 ? atof(Cmd_Argv(2)) : 10) * dma.speed;
+    if (samples < 1)
+        samples = dma.speed;
+
+    S_StopAllSounds();
+
+    sfx[0] = DMA_MixTestSound("*mixtest8", dma.speed, 1);
+    sfx[1] = DMA_MixTestSound("*mixtest16", dma.speed, 2);
+
+    for (i = 0, ch = channels; i < numchannels; i++, ch++) {
+        ch->sfx = sfx[i & 1];
+        ch->leftvol = 1 + rand() % 255;
+        ch->rightvol = 1 + rand() % 255;
+        ch->pos = rand() % dma.speed;
+        ch->end = dma.speed - ch->pos;
+        ch->autosound = qtrue;
+    }
+
+    scratch = Z_Malloc(dma.samples * dma.samplebits / 8);
+
+    snddma.BeginPainting();
+    if (dma.buffer) {
+        buffer = dma.buffer;
+        dma.buffer = scratch;
+        oldpaintedtime = paintedtime;
+        oldrawend = s_rawend;
+        paintedtime = 0;
+        s_rawend = -1;
+
+        start = Sys_Milliseconds();
+        S_PaintChannels(samples);
+        msec = Sys_Milliseconds() - start;
+
+        dma.buffer = buffer;
+        paintedtime = oldpaintedtime;
+        s_rawend = oldrawend;
+
+        Com_Printf("%d channels, %d samples, %u msec, %.f samples/sec\n",
+                   numchannels, samples, msec,
+                   (double)samples * 1000 / (msec ? msec : 1));
+    }
+    snddma.Submit();
+
+    S_StopAllSounds();
+
+    for (i = 0; i < 2; i++) {
+        Z_Free(sfx[i]->cache);
+        Z_Free(sfx[i]);
+    }
+    Z_Free(scratch);
+}
+
+#endif // USE_TESTS
+
 qboolean DMA_Init(void)
 {
     sndinitstat_t ret = SIS_FAILURE;
@@ -48,6 +145,7 @@ qboolean DMA_Init(void)
     s_khz = Cvar_Get("s_khz", "22", CVAR_ARCHIVE | CVAR_SOUND);
     s_mixahead = Cvar_Get("s_mixahead", "0.2", CVAR_ARCHIVE);
     s_testsound = Cvar_Get("s_testsound", "0", 0);
+    s_soundcache = Cvar_Get("s_soundcache", "0", 0);
 
 #if USE_DSOUND
     s_direct = Cvar_Get("s_direct", "1", CVAR_SOUND);
@@ -73,11 +171,18 @@ qboolean DMA_Init(void)
 
     Com_Printf("sound sampling rate: %i\n", dma.speed);
 
+#if USE_TESTS
+    Cmd_AddCommand("mixtest", DMA_MixTest_f);
+#endif
+
     return qtrue;
 }
 
 void DMA_Shutdown(void)
 {
+#if USE_TESTS
+    Cmd_RemoveCommand("mixtest");
+#endif
     snddma.Shutdown();
     s_numchannels = 0;
 }
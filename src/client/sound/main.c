@@ -64,6 +64,12 @@ cvar_t      *s_show;
 static cvar_t   *s_enable;
 static cvar_t   *s_auto_focus;
 static cvar_t   *s_swapstereo;
+#if USE_SNDDMA
+static cvar_t   *s_maxvoices;
+
+static int      s_activevoices;
+static int      s_culledvoices;
+#endif
 
 // =======================================================================
 // Console functions
@@ -82,8 +88,12 @@ static void S_SoundInfo_f(void)
 #endif
 
 #if USE_SNDDMA
-    if (s_started == SS_DMA)
+    if (s_started == SS_DMA) {
         DMA_SoundInfo();
+        Com_Printf("%5d active voices\n", s_activevoices);
+        Com_Printf("%5d mixed voices\n", s_activevoices - s_culledvoices);
+        Com_Printf("%5d virtual voices\n", s_culledvoices);
+    }
 #endif
 }
 
@@ -162,6 +172,9 @@ void S_Init(void)
 #endif
     s_auto_focus = Cvar_Get("s_auto_focus", "0", 0);
     s_swapstereo = Cvar_Get("s_swapstereo", "0", 0);
+#if USE_SNDDMA
+    s_maxvoices = Cvar_Get("s_maxvoices", "32", 0);
+#endif
 
     // start one of available sound engines
     s_started = SS_NOT;
@@ -243,6 +256,9 @@ void S_Shutdown(void)
         return;
 
     S_StopAllSounds();
+#if USE_SNDDMA
+    S_CloseSoundCache();
+#endif
     S_FreeAllSounds();
 
 #if USE_OPENAL
@@ -379,6 +395,11 @@ void S_BeginRegistration(void)
 {
     s_registration_sequence++;
     s_registering = qtrue;
+
+#if USE_SNDDMA
+    if (s_started == SS_DMA)
+        S_OpenSoundCache();
+#endif
 }
 
 /*
@@ -562,6 +583,10 @@ void S_EndRegistration(void)
         S_LoadSound(sfx);
     }
 
+#if USE_SNDDMA
+    S_CloseSoundCache();
+#endif
+
     s_registering = qfalse;
 }
 
@@ -1067,6 +1092,59 @@ static void S_AddLoopSounds(void)
     }
 }
 
+static int S_CompareVoices(const void *p1, const void *p2)
+{
+    const channel_t *c1 = *(const channel_t **)p1;
+    const channel_t *c2 = *(const channel_t **)p2;
+    int a1 = c1->leftvol + c1->rightvol;
+    int a2 = c2->leftvol + c2->rightvol;
+
+    if (a1 != a2)
+        return a2 - a1;
+
+    return (c1 > c2) - (c1 < c2);
+}
+
+/*
+==================
+S_CullVoices
+
+Only the s_maxvoices most audible channels are mixed. The rest become
+virtual: they keep playing and being spatialized, but are skipped by
+the mixer until they become audible enough again.
+==================
+*/
+static void S_CullVoices(void)
+{
+    channel_t   *active[MAX_CHANNELS];
+    channel_t   *ch;
+    int         i, numactive, maxvoices;
+
+    numactive = 0;
+    ch = channels;
+    for (i = 0; i < s_numchannels; i++, ch++) {
+        if (!ch->sfx)
+            continue;
+        ch->culled = qfalse;
+        active[numactive++] = ch;
+    }
+
+    s_activevoices = numactive;
+    s_culledvoices = 0;
+
+    maxvoices = s_maxvoices->integer;
+    if (maxvoices < 1 || numactive <= maxvoices)
+        return;
+
+    // audibility is approximated by spatialized volume
+    qsort(active, numactive, sizeof(active[0]), S_CompareVoices);
+
+    for (i = maxvoices; i < numactive; i++)
+        active[i]->culled = qtrue;
+
+    s_culledvoices = numactive - maxvoices;
+}
+
 #endif
 
 /*
@@ -1140,6 +1218,9 @@ void S_Update(void)
     // add loopsounds
     S_AddLoopSounds();
 
+    // pick voices to mix
+    S_CullVoices();
+
 #ifdef OGG
     OGG_Stream();
 #endif
@@ -1153,7 +1234,8 @@ void S_Update(void)
         ch = channels;
         for (i = 0; i < s_numchannels; i++, ch++)
             if (ch->sfx && (ch->leftvol || ch->rightvol)) {
-                Com_Printf("%3i %3i %s\n", ch->leftvol, ch->rightvol, ch->sfx->name);
+                Com_Printf("%3i %3i %s%s\n", ch->leftvol, ch->rightvol,
+                           ch->sfx->name, ch->culled ? " (virtual)" : "");
                 total++;
             }
 
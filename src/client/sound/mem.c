@@ -18,10 +18,120 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 // snd_mem.c: sound caching
 
 #include "sound.h"
+#include "common/mdfour.h"
 
 wavinfo_t s_info;
 
 #if USE_SNDDMA
+
+/*
+===============================================================================
+
+Resampling
+
+===============================================================================
+*/
+
+#define RESAMPLE_TAPS       8
+#define RESAMPLE_PHASES     64
+#define RESAMPLE_BITS       14
+
+static int16_t  resample_kernel[RESAMPLE_PHASES][RESAMPLE_TAPS];
+static float    resample_step;
+
+static double sinc(double x)
+{
+    if (fabs(x) < 1e-9)
+        return 1;
+    return sin(M_PI * x) / (M_PI * x);
+}
+
+// builds Lanczos windowed sinc filter bank for the given step, cutoff
+// frequency is lowered when decimating to avoid aliasing
+static void BuildResampleKernel(float stepscale)
+{
+    double  cutoff, x, sum, w[RESAMPLE_TAPS];
+    int     i, j, total;
+
+    if (resample_step == stepscale)
+        return;
+
+    cutoff = stepscale > 1 ? 1 / stepscale : 1;
+
+    for (i = 0; i < RESAMPLE_PHASES; i++) {
+        sum = 0;
+        for (j = 0; j < RESAMPLE_TAPS; j++) {
+            x = j - (RESAMPLE_TAPS / 2 - 1) - (double)i / RESAMPLE_PHASES;
+            w[j] = cutoff * sinc(x * cutoff) * sinc(x / (RESAMPLE_TAPS / 2));
+            sum += w[j];
+        }
+
+        // normalize for unity gain, put rounding error into center tap
+        total = 0;
+        for (j = 0; j < RESAMPLE_TAPS; j++) {
+            resample_kernel[i][j] = Q_rint(w[j] / sum * (1 << RESAMPLE_BITS));
+            total += resample_kernel[i][j];
+        }
+        resample_kernel[i][RESAMPLE_TAPS / 2 - 1] += (1 << RESAMPLE_BITS) - total;
+    }
+
+    resample_step = stepscale;
+}
+
+static inline int GetSample(int i)
+{
+    clamp(i, 0, s_info.samples - 1);
+
+    if (s_info.width == 1)
+        return (s_info.data[i] - 128) * 256;
+
+    return (int16_t)LittleShortMem(s_info.data + i * 2);
+}
+
+static void ResampleData(sfxcache_t *sc, float stepscale)
+{
+    int         i, j, val;
+    int         srcsample, phase;
+    uint32_t    samplefrac, fracstep;
+    int16_t     *kernel;
+
+    BuildResampleKernel(stepscale);
+
+    samplefrac = 0;
+    fracstep = stepscale * 65536;
+    for (i = 0; i < sc->length; i++) {
+        srcsample = samplefrac >> 16;
+        phase = (samplefrac >> (16 - 6)) & (RESAMPLE_PHASES - 1);
+        kernel = resample_kernel[phase];
+        samplefrac += fracstep;
+
+        val = 0;
+        if (srcsample >= RESAMPLE_TAPS / 2 - 1 &&
+            srcsample < s_info.samples - RESAMPLE_TAPS / 2) {
+            // fast path, no clamping needed
+            srcsample -= RESAMPLE_TAPS / 2 - 1;
+            if (s_info.width == 1) {
+                for (j = 0; j < RESAMPLE_TAPS; j++)
+                    val += (s_info.data[srcsample + j] - 128) * 256 * kernel[j];
+            } else {
+                for (j = 0; j < RESAMPLE_TAPS; j++)
+                    val += (int16_t)LittleShortMem(s_info.data + (srcsample + j) * 2) * kernel[j];
+            }
+        } else {
+            for (j = 0; j < RESAMPLE_TAPS; j++)
+                val += GetSample(srcsample - (RESAMPLE_TAPS / 2 - 1) + j) * kernel[j];
+        }
+
+        val >>= RESAMPLE_BITS;
+        clamp(val, INT16_MIN, INT16_MAX);
+
+        if (sc->width == 1)
+            sc->data[i] = (val >> 8) + 128;
+        else
+            ((int16_t *)sc->data)[i] = val;
+    }
+}
+
 /*
 ================
 ResampleSfx
@@ -30,10 +140,10 @@ ResampleSfx
 static sfxcache_t *ResampleSfx(sfx_t *sfx)
 {
     int         outcount;
-    int         srcsample;
     float       stepscale;
+#if __BYTE_ORDER != __LITTLE_ENDIAN
     int         i;
-    int         samplefrac, fracstep;
+#endif
     sfxcache_t  *sc;
 
     stepscale = (float)s_info.rate / dma.speed;      // this is usually 0.5, 1, or 2
@@ -68,25 +178,381 @@ static sfxcache_t *ResampleSfx(sfx_t *sfx)
         }
     } else {
 // general case
-        samplefrac = 0;
-        fracstep = stepscale * 256;
-        if (sc->width == 1) {
-            for (i = 0; i < outcount; i++) {
-                srcsample = samplefrac >> 8;
-                samplefrac += fracstep;
-                sc->data[i] = s_info.data[srcsample];
-            }
-        } else {
-            for (i = 0; i < outcount; i++) {
-                srcsample = samplefrac >> 8;
-                samplefrac += fracstep;
-                ((uint16_t *)sc->data)[i] = LittleShort(((uint16_t *)s_info.data)[srcsample]);
-            }
-        }
+        ResampleData(sc, stepscale);
     }
 
     return sc;
 }
+
+/*
+===============================================================================
+
+Resampled sound cache
+
+Sounds resampled during registration are stored in a per-rate file, so
+that following registrations can skip resampling them. The file is a
+header followed by records, new records are appended. A record is only
+used if length and checksum of the source file still match.
+
+Records that were replaced by a later one, or hold values the WAV loader
+would never produce, are dead. When they make up
+more than half of the file, or the file would grow past SND_CACHE_MAX,
+it is rewritten with only the sounds of the current registration.
+
+===============================================================================
+*/
+
+#define SND_CACHE_MAGIC     MakeRawLong('S', 'N', 'D', 'C')
+#define SND_CACHE_VERSION   2
+#define SND_CACHE_HASH      256
+#define SND_CACHE_CHUNK     64
+#define SND_CACHE_MAX       0x2000000
+
+#define PAD4(x)             (((x) + 3) & ~3)
+
+#define SND_CACHE_RECORD(size)  (MAX_QPATH + 5 * 4 + PAD4(size))
+
+typedef struct {
+    char        name[MAX_QPATH];
+    int         srclen;
+    uint32_t    checksum;
+    int         length;
+    int         loopstart;
+    int         width;
+    off_t       filepos;
+    int         next;
+} sndcache_entry_t;
+
+typedef struct {
+    sfx_t       *sfx;
+    int         srclen;
+    uint32_t    checksum;
+    qboolean    cached;     // already has an up to date record
+} sndcache_sfx_t;
+
+static struct {
+    qboolean            open;
+    qboolean            valid;
+    qhandle_t           f;
+    char                path[MAX_QPATH];
+    sndcache_entry_t    *entries;
+    int                 numentries;
+    int                 hash[SND_CACHE_HASH];
+    sndcache_sfx_t      *sounds;
+    int                 numsounds;
+    int                 nummisses;
+    size_t              filesize;
+    size_t              deadsize;
+} snd_cache;
+
+static sndcache_entry_t *S_FindCacheEntry(const char *name)
+{
+    sndcache_entry_t *e;
+    int i;
+
+    for (i = snd_cache.hash[FS_HashPath(name, SND_CACHE_HASH)]; i != -1; i = e->next) {
+        e = &snd_cache.entries[i];
+        if (!FS_pathcmp(e->name, name))
+            return e;
+    }
+
+    return NULL;
+}
+
+static qboolean S_CacheEntryValid(const char *name, int length, int loopstart, int width)
+{
+    if (!memchr(name, 0, MAX_QPATH))
+        return qfalse;
+    if (width != 1 && width != 2)
+        return qfalse;
+    if (length < 1 || length > INT_MAX / width)
+        return qfalse;
+    if (loopstart < -1 || loopstart >= length)
+        return qfalse;
+    return qtrue;
+}
+
+static qboolean S_ReadCacheIndex(void)
+{
+    uint32_t header[4], rec[5];
+    char name[MAX_QPATH];
+    sndcache_entry_t *e, *old;
+    ssize_t ret, pos, len;
+    unsigned hash;
+    int size, length, loopstart, width;
+
+    ret = FS_Read(header, sizeof(header), snd_cache.f);
+    if (ret != sizeof(header))
+        return qfalse;
+
+    if (LittleLong(header[0]) != SND_CACHE_MAGIC ||
+        LittleLong(header[1]) != SND_CACHE_VERSION ||
+        LittleLong(header[2]) != dma.speed)
+        return qfalse;
+
+    len = FS_Length(snd_cache.f);
+    while (1) {
+        ret = FS_Read(name, sizeof(name), snd_cache.f);
+        if (ret == 0)
+            break;
+        if (ret != sizeof(name))
+            return qfalse;
+
+        ret = FS_Read(rec, sizeof(rec), snd_cache.f);
+        if (ret != sizeof(rec))
+            return qfalse;
+
+        pos = FS_Tell(snd_cache.f);
+        if (pos < 0)
+            return qfalse;
+
+        length = (int32_t)LittleLong(rec[2]);
+        loopstart = (int32_t)LittleLong(rec[3]);
+        width = (int32_t)LittleLong(rec[4]);
+
+        // without data size the next record can't be found
+        if (length < 0 || width < 0 || (int64_t)length * width > len - pos)
+            return qfalse;
+        size = length * width;
+
+        if (FS_Seek(snd_cache.f, pos + PAD4(size)))
+            return qfalse;
+
+        // sound will be loaded from WAV and written again
+        if (!S_CacheEntryValid(name, length, loopstart, width)) {
+            snd_cache.deadsize += SND_CACHE_RECORD(size);
+            continue;
+        }
+
+        if (!(snd_cache.numentries & (SND_CACHE_CHUNK - 1))) {
+            snd_cache.entries = Z_Realloc(snd_cache.entries, sizeof(snd_cache.entries[0]) *
+                                          (snd_cache.numentries + SND_CACHE_CHUNK));
+        }
+
+        // later records override earlier ones
+        old = S_FindCacheEntry(name);
+        if (old)
+            snd_cache.deadsize += SND_CACHE_RECORD(old->length * old->width);
+
+        hash = FS_HashPath(name, SND_CACHE_HASH);
+        e = &snd_cache.entries[snd_cache.numentries];
+        memcpy(e->name, name, sizeof(e->name));
+        e->srclen = LittleLong(rec[0]);
+        e->checksum = LittleLong(rec[1]);
+        e->length = length;
+        e->loopstart = loopstart;
+        e->width = width;
+        e->filepos = pos;
+        e->next = snd_cache.hash[hash];
+        snd_cache.hash[hash] = snd_cache.numentries++;
+    }
+
+    snd_cache.filesize = len;
+    return qtrue;
+}
+
+/*
+==============
+S_OpenSoundCache
+
+Called at the beginning of registration.
+==============
+*/
+void S_OpenSoundCache(void)
+{
+    if (snd_cache.open || !s_soundcache->integer)
+        return;
+
+    memset(snd_cache.hash, -1, sizeof(snd_cache.hash));
+    Q_snprintf(snd_cache.path, sizeof(snd_cache.path), "sound/cache%d.bin", dma.speed);
+    snd_cache.open = qtrue;
+
+    FS_FOpenFile(snd_cache.path, &snd_cache.f, FS_MODE_READ | FS_TYPE_REAL | FS_PATH_GAME);
+    if (!snd_cache.f)
+        return;
+
+    snd_cache.valid = S_ReadCacheIndex();
+    if (!snd_cache.valid)
+        Com_WPrintf("Ignoring invalid sound cache %s\n", snd_cache.path);
+    else
+        Com_DPrintf("Loaded %d entries from %s\n", snd_cache.numentries, snd_cache.path);
+}
+
+static void S_AddCacheSfx(sfx_t *sfx, int srclen, uint32_t checksum, qboolean cached)
+{
+    sndcache_sfx_t *c;
+
+    if (!(snd_cache.numsounds & (SND_CACHE_CHUNK - 1))) {
+        snd_cache.sounds = Z_Realloc(snd_cache.sounds, sizeof(snd_cache.sounds[0]) *
+                                     (snd_cache.numsounds + SND_CACHE_CHUNK));
+    }
+
+    c = &snd_cache.sounds[snd_cache.numsounds++];
+    c->sfx = sfx;
+    c->srclen = srclen;
+    c->checksum = checksum;
+    c->cached = cached;
+
+    if (!cached)
+        snd_cache.nummisses++;
+}
+
+static sfxcache_t *S_LoadCachedSfx(sfx_t *sfx, const char *name,
+                                   int srclen, uint32_t checksum)
+{
+    sndcache_entry_t *e;
+    sfxcache_t *sc;
+    int size;
+
+    if (!snd_cache.valid)
+        return NULL;
+
+    e = S_FindCacheEntry(name);
+    if (!e)
+        return NULL;
+
+    // source file must not have changed
+    if (e->srclen != srclen || e->checksum != checksum)
+        goto dead;
+
+    if (!S_CacheEntryValid(e->name, e->length, e->loopstart, e->width))
+        goto dead;
+
+    if (FS_Seek(snd_cache.f, e->filepos))
+        goto dead;
+
+    size = e->length * e->width;
+    sc = S_Malloc(size + sizeof(sfxcache_t) - 1);
+    sc->length = e->length;
+    sc->loopstart = e->loopstart;
+    sc->width = e->width;
+
+    if (FS_Read(sc->data, size, snd_cache.f) != size) {
+        Z_Free(sc);
+        goto dead;
+    }
+
+    S_AddCacheSfx(sfx, srclen, checksum, qtrue);
+    return sfx->cache = sc;
+
+dead:
+    // will be replaced by a new record
+    snd_cache.deadsize += SND_CACHE_RECORD(e->length * e->width);
+    return NULL;
+}
+
+static void S_AddCacheMiss(sfx_t *sfx, int srclen, uint32_t checksum)
+{
+    if (!snd_cache.open)
+        return;
+
+    S_AddCacheSfx(sfx, srclen, checksum, qfalse);
+}
+
+static qerror_t S_WriteCacheSounds(qhandle_t f, qboolean rewrite)
+{
+    static const byte pad[4];
+    uint32_t header[4], rec[5];
+    char name[MAX_QPATH];
+    sndcache_sfx_t *c;
+    sfxcache_t *sc;
+    ssize_t ret;
+    int i, size;
+
+    if (rewrite) {
+        header[0] = LittleLong(SND_CACHE_MAGIC);
+        header[1] = LittleLong(SND_CACHE_VERSION);
+        header[2] = LittleLong(dma.speed);
+        header[3] = 0;
+        ret = FS_Write(header, sizeof(header), f);
+        if (ret != sizeof(header))
+            return ret < 0 ? ret : Q_ERR_FAILURE;
+    }
+
+    for (i = 0, c = snd_cache.sounds; i < snd_cache.numsounds; i++, c++) {
+        if (c->cached && !rewrite)
+            continue;
+
+        sc = c->sfx->cache;
+        if (!sc)
+            continue;
+
+        memset(name, 0, sizeof(name));
+        Q_strlcpy(name, c->sfx->truename ? c->sfx->truename : c->sfx->name, sizeof(name));
+
+        // don't write records that would be thrown away when read back
+        if (!S_CacheEntryValid(name, sc->length, sc->loopstart, sc->width))
+            continue;
+        rec[0] = LittleLong(c->srclen);
+        rec[1] = LittleLong(c->checksum);
+        rec[2] = LittleLong(sc->length);
+        rec[3] = LittleLong(sc->loopstart);
+        rec[4] = LittleLong(sc->width);
+
+        size = sc->length * sc->width;
+        if ((ret = FS_Write(name, sizeof(name), f)) != sizeof(name) ||
+            (ret = FS_Write(rec, sizeof(rec), f)) != sizeof(rec) ||
+            (ret = FS_Write(sc->data, size, f)) != size ||
+            (ret = FS_Write(pad, PAD4(size) - size, f)) != PAD4(size) - size)
+            return ret < 0 ? ret : Q_ERR_FAILURE;
+    }
+
+    return Q_ERR_SUCCESS;
+}
+
+/*
+==============
+S_CloseSoundCache
+
+Called at the end of registration, appends sounds that were resampled,
+or rewrites the file if it has grown too large.
+==============
+*/
+void S_CloseSoundCache(void)
+{
+    sndcache_sfx_t *c;
+    size_t added;
+    qboolean rewrite;
+    qhandle_t f;
+    qerror_t ret;
+    int i;
+
+    if (!snd_cache.open)
+        return;
+
+    if (snd_cache.f)
+        FS_FCloseFile(snd_cache.f);
+
+    if (snd_cache.nummisses) {
+        added = 0;
+        for (i = 0, c = snd_cache.sounds; i < snd_cache.numsounds; i++, c++) {
+            if (!c->cached && c->sfx->cache)
+                added += SND_CACHE_RECORD(c->sfx->cache->length * c->sfx->cache->width);
+        }
+
+        rewrite = !snd_cache.valid ||
+                  snd_cache.deadsize > snd_cache.filesize / 2 ||
+                  snd_cache.filesize + added > SND_CACHE_MAX;
+
+        FS_FOpenFile(snd_cache.path, &f, rewrite ? FS_MODE_WRITE : FS_MODE_APPEND);
+        if (f) {
+            ret = S_WriteCacheSounds(f, rewrite);
+            FS_FCloseFile(f);
+            if (ret)
+                Com_WPrintf("Couldn't write sound cache %s: %s\n",
+                            snd_cache.path, Q_ErrorString(ret));
+            else if (rewrite)
+                Com_DPrintf("Wrote %d entries to %s\n", snd_cache.numsounds, snd_cache.path);
+            else
+                Com_DPrintf("Added %d entries to %s\n", snd_cache.nummisses, snd_cache.path);
+        }
+    }
+
+    Z_Free(snd_cache.entries);
+    Z_Free(snd_cache.sounds);
+    memset(&snd_cache, 0, sizeof(snd_cache));
+}
+
 #endif
 
 /*
@@ -291,6 +757,9 @@ sfxcache_t *S_LoadSound(sfx_t *s)
     sfxcache_t  *sc;
     ssize_t     len;
     char        *name;
+#if USE_SNDDMA
+    uint32_t    checksum = 0;
+#endif
 
     if (s->name[0] == '*')
         return NULL;
@@ -316,6 +785,15 @@ sfxcache_t *S_LoadSound(sfx_t *s)
         return NULL;
     }
 
+#if USE_SNDDMA
+    if (s_started == SS_DMA && snd_cache.open) {
+        checksum = Com_BlockChecksum(data, len);
+        sc = S_LoadCachedSfx(s, name, len, checksum);
+        if (sc)
+            goto fail;
+    }
+#endif
+
     memset(&s_info, 0, sizeof(s_info));
     s_info.name = name;
 
@@ -332,8 +810,11 @@ sfxcache_t *S_LoadSound(sfx_t *s)
 #endif
 
 #if USE_SNDDMA
-    if (s_started == SS_DMA)
+    if (s_started == SS_DMA) {
         sc = ResampleSfx(s);
+        if (sc && s_info.rate != dma.speed)
+            S_AddCacheMiss(s, len, checksum);
+    }
 #endif
 
 fail:
@@ -19,6 +19,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "sound.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define    PAINTBUFFER_SIZE    2048
 
 static int snd_scaletable[32][256];
@@ -31,7 +35,17 @@ static void WriteLinearBlast(int16_t *out, samplepair_t *samp, int count)
 {
     int i, val;
 
-    for (i = 0; i < count; i++, samp++, out += 2) {
+    i = 0;
+#ifdef __SSE2__
+    // 4 sample pairs at a time, saturating pack does the clamping
+    for (; i + 4 <= count; i += 4, samp += 4, out += 8) {
+        __m128i a = _mm_srai_epi32(_mm_loadu_si128((__m128i *)samp), 8);
+        __m128i b = _mm_srai_epi32(_mm_loadu_si128((__m128i *)(samp + 2)), 8);
+        _mm_storeu_si128((__m128i *)out, _mm_packs_epi32(a, b));
+    }
+#endif
+
+    for (; i < count; i++, samp++, out += 2) {
         val = samp->left >> 8;
         out[0] = clamp(val, INT16_MIN, INT16_MAX);
 
@@ -128,6 +142,47 @@ CHANNEL MIXING
 ===============================================================================
 */
 
+#ifdef __SSE2__
+
+// adds 8 left and 8 right 32-bit samples to interleaved sample pairs
+static inline void AddPairs(samplepair_t *samp, __m128i l0, __m128i l1, __m128i r0, __m128i r1)
+{
+    __m128i *p = (__m128i *)samp;
+
+    _mm_storeu_si128(p + 0, _mm_add_epi32(_mm_loadu_si128(p + 0), _mm_unpacklo_epi32(l0, r0)));
+    _mm_storeu_si128(p + 1, _mm_add_epi32(_mm_loadu_si128(p + 1), _mm_unpackhi_epi32(l0, r0)));
+    _mm_storeu_si128(p + 2, _mm_add_epi32(_mm_loadu_si128(p + 2), _mm_unpacklo_epi32(l1, r1)));
+    _mm_storeu_si128(p + 3, _mm_add_epi32(_mm_loadu_si128(p + 3), _mm_unpackhi_epi32(l1, r1)));
+}
+
+// (data - 128) * (hi * 256 + lo) for 8 unsigned samples, both partial
+// products fit in 16 bits
+static inline void Scale8(__m128i data, __m128i hi, __m128i lo, __m128i *out0, __m128i *out1)
+{
+    __m128i a = _mm_mullo_epi16(data, hi);
+    __m128i b = _mm_mullo_epi16(data, lo);
+
+    *out0 = _mm_add_epi32(_mm_slli_epi32(_mm_srai_epi32(_mm_unpacklo_epi16(a, a), 16), 8),
+                          _mm_srai_epi32(_mm_unpacklo_epi16(b, b), 16));
+    *out1 = _mm_add_epi32(_mm_slli_epi32(_mm_srai_epi32(_mm_unpackhi_epi16(a, a), 16), 8),
+                          _mm_srai_epi32(_mm_unpackhi_epi16(b, b), 16));
+}
+
+// (data * (hi * 256 + lo)) >> 8 for 8 signed samples, split so that both
+// multipliers fit in signed 16 bits
+static inline void Scale16(__m128i data, __m128i hi, __m128i lo, __m128i *out0, __m128i *out1)
+{
+    __m128i a = _mm_mullo_epi16(data, hi);
+    __m128i b = _mm_mulhi_epi16(data, hi);
+    __m128i c = _mm_mullo_epi16(data, lo);
+    __m128i d = _mm_mulhi_epi16(data, lo);
+
+    *out0 = _mm_add_epi32(_mm_unpacklo_epi16(a, b), _mm_srai_epi32(_mm_unpacklo_epi16(c, d), 8));
+    *out1 = _mm_add_epi32(_mm_unpackhi_epi16(a, b), _mm_srai_epi32(_mm_unpackhi_epi16(c, d), 8));
+}
+
+#endif // __SSE2__
+
 static void Paint8(channel_t *ch, sfxcache_t *sc, int count, samplepair_t *samp)
 {
     int data;
@@ -144,7 +199,28 @@ static void Paint8(channel_t *ch, sfxcache_t *sc, int count, samplepair_t *samp)
     rscale = snd_scaletable[ch->rightvol >> 3];
     sfx = (uint8_t *)sc->data + ch->pos;
 
-    for (i = 0; i < count; i++, samp++) {
+    i = 0;
+#ifdef __SSE2__
+    {
+        // same values as in snd_scaletable
+        int lvol = (ch->leftvol >> 3) * 8 * snd_vol;
+        int rvol = (ch->rightvol >> 3) * 8 * snd_vol;
+        __m128i lhi = _mm_set1_epi16(lvol >> 8), llo = _mm_set1_epi16(lvol & 255);
+        __m128i rhi = _mm_set1_epi16(rvol >> 8), rlo = _mm_set1_epi16(rvol & 255);
+        __m128i bias = _mm_set1_epi16(128), zero = _mm_setzero_si128();
+        __m128i d, l0, l1, r0, r1;
+
+        for (; i + 8 <= count; i += 8, sfx += 8, samp += 8) {
+            d = _mm_loadl_epi64((__m128i *)sfx);
+            d = _mm_sub_epi16(_mm_unpacklo_epi8(d, zero), bias);
+            Scale8(d, lhi, llo, &l0, &l1);
+            Scale8(d, rhi, rlo, &r0, &r1);
+            AddPairs(samp, l0, l1, r0, r1);
+        }
+    }
+#endif
+
+    for (; i < count; i++, samp++) {
         data = *sfx++;
         samp->left += lscale[data];
         samp->right += rscale[data];
@@ -165,7 +241,23 @@ static void Paint16(channel_t *ch, sfxcache_t *sc, int count, samplepair_t *samp
     rightvol = ch->rightvol * snd_vol;
     sfx = (int16_t *)sc->data + ch->pos;
 
-    for (i = 0; i < count; i++, samp++) {
+    i = 0;
+#ifdef __SSE2__
+    if (leftvol >= 0 && leftvol < 65536 && rightvol >= 0 && rightvol < 65536) {
+        __m128i lhi = _mm_set1_epi16(leftvol >> 8), llo = _mm_set1_epi16(leftvol & 255);
+        __m128i rhi = _mm_set1_epi16(rightvol >> 8), rlo = _mm_set1_epi16(rightvol & 255);
+        __m128i d, l0, l1, r0, r1;
+
+        for (; i + 8 <= count; i += 8, sfx += 8, samp += 8) {
+            d = _mm_loadu_si128((__m128i *)sfx);
+            Scale16(d, lhi, llo, &l0, &l1);
+            Scale16(d, rhi, rlo, &r0, &r1);
+            AddPairs(samp, l0, l1, r0, r1);
+        }
+    }
+#endif
+
+    for (; i < count; i++, samp++) {
         data = *sfx++;
         left = (data * leftvol) >> 8;
         right = (data * rightvol) >> 8;
@@ -232,7 +324,9 @@ void S_PaintChannels(int endtime)
 
                 if (count > 0 && ch->sfx) {
                     samplepair_t *samp = &paintbuffer[ltime - paintedtime];
-                    if (sc->width == 1)
+                    if (ch->culled)
+                        ch->pos += count;   // keep in sync, but don't mix
+                    else if (sc->width == 1)
                         Paint8(ch, sc, count, samp);
                     else
                         Paint16(ch, sc, count, samp);
@@ -40,6 +40,7 @@
 #include "shared/shared.h"
 #include "common/cvar.h"
 #include "common/files.h"
+#include "system/system.h"
 #include "client/client.h"
 #include "client/sound/sound.h"
 #include "client/sound/ogg.h"
@@ -54,6 +55,31 @@ ogg_status_t ogg_status = STOP;  /* Status indicator. */
 cvar_t *ogg_volume = 0;          /* Music volume. */
 OggVorbis_File ovFile;           /* Ogg Vorbis file. */
 vorbis_info *ogg_info = 0;       /* Ogg Vorbis file information */
+cvar_t *ogg_async = 0;           /* Decode in a background thread. */
+
+/* Decoded PCM data is passed from the decoder thread to the
+   main thread through a single producer, single consumer ring
+   buffer. Head is only advanced by the decoder, tail only by
+   the main thread. The mutex protects ovFile, which is also
+   accessed by the main thread when seeking. */
+#define OGG_RING_SIZE   0x40000
+#define OGG_RING_MASK   (OGG_RING_SIZE - 1)
+
+/* Give up on a file after this many holes in a row. */
+#define OGG_MAX_ERRORS  32
+
+static struct
+{
+    sys_thread_t *thread;
+    sys_mutex_t *lock;
+    sys_event_t *wakeup;
+    byte *data;
+    unsigned head;
+    unsigned tail;
+    int eof;
+    int error;
+    int shutdown;
+} ogg_stream;
 
 void
 OGG_Init(void)
@@ -73,6 +99,7 @@ OGG_Init(void)
 
     /* Cvars. */
     ogg_volume = Cvar_Get("ogg_volume", "0.7", CVAR_ARCHIVE);
+    ogg_async = Cvar_Get("ogg_async", "1", 0);
 
     /* Console commands. */
     Cmd_AddCommand("ogg_pause", OGG_PauseCmd);
@@ -124,6 +151,11 @@ OGG_Seek(ogg_seek_t type, double offset)
         return;
     }
 
+    if (ogg_stream.thread)
+    {
+        Sys_LockMutex(ogg_stream.lock);
+    }
+
     /* Get file information. */
     double pos = ov_time_tell(&ovFile);
     double total = ov_time_total(&ovFile, -1);
@@ -158,6 +190,141 @@ OGG_Seek(ogg_seek_t type, double offset)
             }
             break;
     }
+
+    if (ogg_stream.thread)
+    {
+        /* Drop samples decoded before the seek. */
+        q_atomic_store(&ogg_stream.tail, ogg_stream.head);
+        q_atomic_store(&ogg_stream.eof, 0);
+        q_atomic_store(&ogg_stream.error, 0);
+        Sys_UnlockMutex(ogg_stream.lock);
+        Sys_SetEvent(ogg_stream.wakeup);
+    }
+}
+
+// Decode ahead until the ring buffer is full or the file ends.
+static void
+OGG_DecodeThread(void *arg)
+{
+    char buf[4096];
+    unsigned head, len;
+    int res, errors = 0;
+    qboolean retry;
+
+    while (!q_atomic_load(&ogg_stream.shutdown))
+    {
+        Sys_LockMutex(ogg_stream.lock);
+
+        head = ogg_stream.head;
+        retry = qfalse;
+
+        while (!q_atomic_load(&ogg_stream.eof) &&
+               OGG_RING_SIZE - (head - q_atomic_load(&ogg_stream.tail)) >= sizeof(buf))
+        {
+            res = ov_read(&ovFile, buf, sizeof(buf),
+                    0 /* big endian */, OGG_SAMPLEWIDTH, 1,
+                    &ovSection);
+
+            if (res == 0)
+            {
+                q_atomic_store(&ogg_stream.eof, 1);
+                break;
+            }
+
+            if (res < 0)
+            {
+                /* A hole in the data can be skipped, anything else
+                   (or too many holes in a row) ends the file. The
+                   main thread stops the track once the ring drains. */
+                if (res != OV_HOLE || ++errors >= OGG_MAX_ERRORS)
+                {
+                    q_atomic_store(&ogg_stream.error, res);
+                    q_atomic_store(&ogg_stream.eof, 1);
+                    break;
+                }
+
+                /* Let the main thread in before retrying. */
+                retry = qtrue;
+                break;
+            }
+
+            errors = 0;
+
+            len = min(res, OGG_RING_SIZE - (head & OGG_RING_MASK));
+            memcpy(ogg_stream.data + (head & OGG_RING_MASK), buf, len);
+            memcpy(ogg_stream.data, buf + len, res - len);
+            head += res;
+            q_atomic_store(&ogg_stream.head, head);
+        }
+
+        Sys_UnlockMutex(ogg_stream.lock);
+
+        if (!retry)
+            Sys_WaitEvent(ogg_stream.wakeup);
+    }
+}
+
+static void
+OGG_StartThread(void)
+{
+    if (!ogg_async->integer)
+        return;
+
+    ogg_stream.data = Z_Malloc(OGG_RING_SIZE);
+    ogg_stream.lock = Sys_CreateMutex();
+    ogg_stream.wakeup = Sys_CreateEvent();
+    ogg_stream.thread = Sys_CreateThread(OGG_DecodeThread, NULL);
+
+    if (!ogg_stream.thread)
+    {
+        Sys_DestroyEvent(ogg_stream.wakeup);
+        Sys_DestroyMutex(ogg_stream.lock);
+        Z_Free(ogg_stream.data);
+        memset(&ogg_stream, 0, sizeof(ogg_stream));
+    }
+}
+
+static void
+OGG_StopThread(void)
+{
+    if (!ogg_stream.thread)
+        return;
+
+    q_atomic_store(&ogg_stream.shutdown, 1);
+    Sys_SetEvent(ogg_stream.wakeup);
+    Sys_JoinThread(ogg_stream.thread);
+    Sys_DestroyEvent(ogg_stream.wakeup);
+    Sys_DestroyMutex(ogg_stream.lock);
+    Z_Free(ogg_stream.data);
+    memset(&ogg_stream, 0, sizeof(ogg_stream));
+}
+
+// Pass decoded samples to the mixer, returns the number of bytes.
+static int
+OGG_ReadRing(void)
+{
+    unsigned head, tail, len;
+    int frame = OGG_SAMPLEWIDTH * ogg_info->channels;
+
+    tail = ogg_stream.tail;
+    head = q_atomic_load(&ogg_stream.head);
+
+    len = min(head - tail, sizeof(ovBuf));
+    len -= len % frame;
+    if (!len)
+        return 0;
+
+    unsigned n = min(len, OGG_RING_SIZE - (tail & OGG_RING_MASK));
+    memcpy(ovBuf, ogg_stream.data + (tail & OGG_RING_MASK), n);
+    memcpy(ovBuf + n, ogg_stream.data, len - n);
+
+    q_atomic_store(&ogg_stream.tail, tail + len);
+    Sys_SetEvent(ogg_stream.wakeup);
+
+    S_RawSamples(len / frame, ogg_info->rate, OGG_SAMPLEWIDTH,
+            ogg_info->channels, (byte *)ovBuf, ogg_volume->value);
+
+    return len;
 }
 
 // Play Ogg Vorbis file (with absolute or relative index).
@@ -185,13 +352,12 @@ OGG_Open(ogg_seek_t type, int offset)
     }
 
     /* Check running music. */
-    if (ogg_status == PLAY)
-    {
-        if (ogg_curfile == pos)
-            return qtrue;
-        else
-            OGG_Stop();
-    }
+    if (ogg_status == PLAY && ogg_curfile == pos)
+        return qtrue;
+
+    /* Paused stream still has its decoder thread. */
+    if (ogg_status != STOP)
+        OGG_Stop();
 
     char filename[1024];
     snprintf(filename, sizeof(filename), "%s/%d.ogg", OGG_DIR, pos);
@@ -230,6 +396,8 @@ OGG_Open(ogg_seek_t type, int offset)
     ogg_curfile = pos;
     ogg_status = PLAY;
 
+    OGG_StartThread();
+
     return qtrue;
 }
 
@@ -260,6 +428,8 @@ OGG_Stop(void)
     if (ogg_status == STOP)
         return;
 
+    OGG_StopThread();
+
     ov_clear(&ovFile);
     ogg_status = STOP;
     ogg_info = 0;
@@ -275,6 +445,8 @@ OGG_Stop(void)
 void
 OGG_Stream(void)
 {
+    int res;
+
     if (!ogg_started)
         return;
 
@@ -287,7 +459,27 @@ OGG_Stream(void)
         while (paintedtime + S_MAX_RAW_SAMPLES - 2048 > s_rawend)
         {
             if(!ogg_info) return;
-            OGG_Read();
+
+            if (!ogg_stream.thread)
+            {
+                OGG_Read();
+                continue;
+            }
+
+            /* Decoder is behind, try again next frame. */
+            if (!OGG_ReadRing())
+            {
+                if (q_atomic_load(&ogg_stream.eof) &&
+                    q_atomic_load(&ogg_stream.head) == ogg_stream.tail)
+                {
+                    res = q_atomic_load(&ogg_stream.error);
+                    if (res)
+                        Com_WPrintf("OGG_Stream: decoding error %d, "
+                                "stopping file %d.\n", res, ogg_curfile + 1);
+                    OGG_Stop();
+                }
+                break;
+            }
         }
     }
 }
@@ -373,6 +565,11 @@ OGG_SeekCmd(void)
 void
 OGG_StatusCmd(void)
 {
+    if (ogg_stream.thread)
+    {
+        Sys_LockMutex(ogg_stream.lock);
+    }
+
     switch (ogg_status)
     {
         case PLAY:
@@ -393,6 +590,11 @@ OGG_StatusCmd(void)
                         ogg_curfile + 1);
             break;
     }
+
+    if (ogg_stream.thread)
+    {
+        Sys_UnlockMutex(ogg_stream.lock);
+    }
 }
 #endif
 /* vim: set ts=8 sw=4 tw=0 et : */
@@ -79,6 +79,7 @@ typedef struct channel_s {
     float       master_vol;     // 0.0-1.0 master volume
     qboolean    fixed_origin;   // use origin instead of fetching entnum's origin
     qboolean    autosound;      // from an entity->sound, cleared each frame
+    qboolean    culled;         // virtual voice, advanced but not mixed
 #if USE_OPENAL
     int         autoframe;
     int         srcnum;
@@ -144,7 +145,7 @@ typedef enum {
 extern sndstarted_t s_started;
 extern qboolean s_active;
 
-#define MAX_CHANNELS            32
+#define MAX_CHANNELS            128
 extern  channel_t   channels[MAX_CHANNELS];
 extern  int         s_numchannels;
 
@@ -167,6 +168,7 @@ extern cvar_t   *s_volume;
 #if USE_SNDDMA
 extern cvar_t   *s_khz;
 extern cvar_t   *s_testsound;
+extern cvar_t   *s_soundcache;
 #endif
 extern cvar_t   *s_ambient;
 extern cvar_t   *s_show;
@@ -180,6 +182,8 @@ channel_t *S_PickChannel(int entnum, int entchannel);
 void S_IssuePlaysound(playsound_t *ps);
 void S_BuildSoundList(int *sounds);
 #if USE_SNDDMA
+void S_OpenSoundCache(void);
+void S_CloseSoundCache(void);
 void S_InitScaletable(void);
 void S_PaintChannels(int endtime);
 #endif
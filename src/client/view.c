@@ -57,7 +57,8 @@ int         r_numentities;
 entity_t    r_entities[MAX_ENTITIES];
 
 int         r_numparticles;
-particle_t  r_particles[MAX_PARTICLES];
+int         r_maxparticles;
+particle_t  *r_particles;       // allocated by CL_ClearParticles
 
 #if USE_LIGHTSTYLES
 lightstyle_t    r_lightstyles[MAX_LIGHTSTYLES];
@@ -103,7 +104,7 @@ V_AddParticle
 */
 void V_AddParticle(particle_t *p)
 {
-    if (r_numparticles >= MAX_PARTICLES)
+    if (r_numparticles >= r_maxparticles)
         return;
     r_particles[r_numparticles++] = *p;
 }
@@ -159,7 +160,7 @@ void V_AddLightStyle(int style, vec4_t value)
 ================
 V_TestParticles
 
-If cl_testparticles is set, create 4096 particles in the view
+If cl_testparticles is set, fill the scene with particles in the view
 ================
 */
 static void V_TestParticles(void)
@@ -168,7 +169,7 @@ static void V_TestParticles(void)
     int         i, j;
     float       d, r, u;
 
-    r_numparticles = MAX_PARTICLES;
+    r_numparticles = r_maxparticles;
     for (i = 0; i < r_numparticles; i++) {
         d = i * 0.25;
         r = 4 * ((i & 7) - 3.5);
@@ -463,7 +464,9 @@ void V_RenderView(void)
         qsort(cl.refdef.entities, cl.refdef.num_entities, sizeof(cl.refdef.entities[0]), entitycmpfnc);
     }
 
+    PROF_BEGIN("R_RenderFrame");
     R_RenderFrame(&cl.refdef);
+    PROF_END();
 #ifdef _DEBUG
     if (cl_stats->integer)
 #if USE_DLIGHTS
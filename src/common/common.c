@@ -37,6 +37,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/net/net.h"
 #include "common/net/chan.h"
 #include "common/pmove.h"
+#include "common/profile.h"
 #include "common/prompt.h"
 #include "common/protocol.h"
 #include "common/tests.h"
@@ -954,6 +955,8 @@ void Qcommon_Init(int argc, char **argv)
 
     Cmd_AddCommand("z_stats", Z_Stats_f);
 
+    Prof_Init();
+
     //Cmd_AddCommand("setenv", Com_Setenv_f);
 
     Cmd_AddMacro("com_date", Com_Date_m);
@@ -1067,6 +1070,8 @@ void Qcommon_Frame(void)
         return;            // an ERR_DROP was thrown
     }
 
+    Prof_Frame();
+
 #if USE_CLIENT
     time_before = time_event = time_between = time_after = 0;
 
@@ -1128,13 +1133,17 @@ void Qcommon_Frame(void)
 
     NET_UpdateStats();
 
+    PROF_BEGIN("SV_Frame");
     remaining = SV_Frame(msec);
+    PROF_END();
 
 #if USE_CLIENT
     if (host_speeds->integer)
         time_between = Sys_Milliseconds();
 
+    PROF_BEGIN("CL_Frame");
     clientrem = CL_Frame(msec);
+    PROF_END();
     if (remaining > clientrem) {
         remaining = clientrem;
     }
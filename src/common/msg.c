@@ -22,6 +22,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/sizebuf.h"
 #include "common/math.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /*
 ==============================================================================
 
@@ -502,6 +506,65 @@ void MSG_PackEntity(entity_packed_t *out, const entity_state_t *in, qboolean sho
     out->event = in->event;
 }
 
+// entity_packed_t has no padding, compare it as a whole
+static inline qboolean MSG_PackedEntitiesEqual(const entity_packed_t *a, const entity_packed_t *b)
+{
+#ifdef __SSE2__
+    const byte *pa = (const byte *)a;
+    const byte *pb = (const byte *)b;
+    __m128i eq;
+
+    // three loads cover all 44 bytes, the last one overlapping the second
+    eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)pa),
+                        _mm_loadu_si128((const __m128i *)pb));
+    eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pa + 16)),
+                                          _mm_loadu_si128((const __m128i *)(pb + 16))));
+    eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pa + sizeof(*a) - 16)),
+                                          _mm_loadu_si128((const __m128i *)(pb + sizeof(*b) - 16))));
+    return _mm_movemask_epi8(eq) == 0xffff;
+#else
+    return !memcmp(a, b, sizeof(*a));
+#endif
+}
+
+/*
+=============
+MSG_EntityUnchanged
+
+Returns qtrue if MSG_WriteDeltaEntity would emit nothing for the given pair.
+This is a quick rejection test for idle entities, it may return qfalse for
+some pairs that don't actually need an update.
+=============
+*/
+qboolean MSG_EntityUnchanged(const entity_packed_t *from,
+                             const entity_packed_t *to,
+                             msgEsFlags_t          flags)
+{
+    if (!from || !to)
+        return qfalse;
+
+    if (flags & MSG_ES_FORCE)
+        return qfalse;
+
+    // these are sent even if nothing has changed
+    if (to->event)
+        return qfalse;
+    if (to->renderfx & RF_FRAMELERP)
+        return qfalse;
+    if ((to->renderfx & RF_BEAM) && !(flags & MSG_ES_BEAMORIGIN))
+        return qfalse;
+
+    if (!MSG_PackedEntitiesEqual(from, to))
+        return qfalse;
+
+    // new entities compare old_origin against previous origin
+    if ((flags & (MSG_ES_NEWENTITY | MSG_ES_FIRSTPERSON)) == MSG_ES_NEWENTITY &&
+        !VectorCompare(to->old_origin, from->origin))
+        return qfalse;
+
+    return qtrue;
+}
+
 void MSG_WriteDeltaEntity(const entity_packed_t *from,
                           const entity_packed_t *to,
                           msgEsFlags_t          flags)
@@ -0,0 +1,247 @@
+/*
+Copyright (C) 2003-2008 Andrey Nazarov
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "shared/shared.h"
+#include "common/cmd.h"
+#include "common/common.h"
+#include "common/cvar.h"
+#include "common/files.h"
+#include "common/profile.h"
+#include "common/zone.h"
+#include "system/system.h"
+
+/*
+==============================================================================
+
+CPU FRAME PROFILER
+
+Every thread that opens a zone claims one of PROF_MAX_THREADS slots.
+A slot is only ever written by its owning thread: finished zones go
+into a ring of PROF_MAX_EVENTS entries and the head index is published
+atomically, so the dump command can read it from the main thread.
+The oldest events of a busy thread may be overwritten while they are
+being dumped; the trace is a debugging aid, not an exact record.
+
+==============================================================================
+*/
+
+#define PROF_MAX_THREADS    16
+#define PROF_MAX_EVENTS     (1 << 14)
+#define PROF_MAX_DEPTH      32
+#define PROF_MAX_FRAMES     256
+
+typedef struct {
+    const char  *name;
+    uint64_t    start;
+    uint32_t    duration;
+} prof_event_t;
+
+typedef struct {
+    prof_event_t    *events;
+    int             head;       // total number of events written
+    int             depth;
+    const char      *stack_name[PROF_MAX_DEPTH];
+    uint64_t        stack_start[PROF_MAX_DEPTH];
+} prof_thread_t;
+
+int prof_enabled;
+
+static cvar_t   *com_profile;
+
+static prof_thread_t    prof_threads[PROF_MAX_THREADS];
+static prof_thread_t    prof_overflow;  // no events, zones are dropped
+static int              prof_num_threads;
+static int              prof_main_thread = -1;
+
+static q_threadlocal prof_thread_t  *prof_self;
+
+// start time of the last PROF_MAX_FRAMES frames on the main thread
+static uint64_t     prof_frames[PROF_MAX_FRAMES];
+static unsigned     prof_framenum;
+
+static prof_thread_t *Prof_Self(void)
+{
+    int i;
+
+    if (prof_self)
+        return prof_self;
+
+    i = q_atomic_add(&prof_num_threads, 1) - 1;
+    if (i >= PROF_MAX_THREADS)
+        prof_self = &prof_overflow;
+    else
+        prof_self = &prof_threads[i];
+    return prof_self;
+}
+
+void Prof_Begin(const char *name)
+{
+    prof_thread_t *t = Prof_Self();
+
+    if (!t->events)
+        return;
+
+    if (t->depth < PROF_MAX_DEPTH) {
+        t->stack_name[t->depth] = name;
+        t->stack_start[t->depth] = Sys_Microseconds();
+    }
+    t->depth++;
+}
+
+void Prof_End(void)
+{
+    prof_thread_t *t = prof_self;
+    prof_event_t *e;
+    uint64_t now;
+
+    // zones opened before profiling was enabled are not on the stack
+    if (!t || !t->events || !t->depth)
+        return;
+
+    t->depth--;
+    if (t->depth >= PROF_MAX_DEPTH)
+        return;
+
+    now = Sys_Microseconds();
+    e = &t->events[t->head & (PROF_MAX_EVENTS - 1)];
+    e->name = t->stack_name[t->depth];
+    e->start = t->stack_start[t->depth];
+    e->duration = now - e->start;
+    q_atomic_store(&t->head, t->head + 1);
+}
+
+/*
+=============
+Prof_Frame
+
+Called by the main thread at the start of every frame. Zones left open
+by an aborted frame are discarded.
+=============
+*/
+void Prof_Frame(void)
+{
+    prof_thread_t *t;
+
+    if (!prof_enabled)
+        return;
+
+    t = Prof_Self();
+    if (prof_main_thread == -1 && t != &prof_overflow)
+        prof_main_thread = t - prof_threads;
+
+    t->depth = 0;
+    prof_frames[prof_framenum++ % PROF_MAX_FRAMES] = Sys_Microseconds();
+}
+
+static void com_profile_changed(cvar_t *self)
+{
+    int i;
+
+    if (self->integer && !prof_enabled) {
+        // allocate everything up front, zone memory is not thread safe
+        for (i = 0; i < PROF_MAX_THREADS; i++) {
+            if (!prof_threads[i].events)
+                prof_threads[i].events = Z_Malloc(sizeof(prof_event_t) * PROF_MAX_EVENTS);
+        }
+        prof_framenum = 0;
+    }
+
+    prof_enabled = self->integer;
+}
+
+static void Prof_Dump_f(void)
+{
+    char buffer[MAX_OSPATH], thread[16];
+    const char *name;
+    uint64_t window;
+    int i, j, frames, count, head, first;
+    unsigned k;
+    qhandle_t f;
+
+    if (!prof_enabled || !prof_framenum) {
+        Com_Printf("Set com_profile to 1 and run some frames first.\n");
+        return;
+    }
+
+    frames = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 60;
+    clamp(frames, 1, PROF_MAX_FRAMES - 1);
+    frames = min(frames, (int)prof_framenum);
+    name = Cmd_Argc() > 2 ? Cmd_Argv(2) : "profile";
+
+    // timestamps are written relative to the first frame of the window
+    window = prof_frames[(prof_framenum - frames) % PROF_MAX_FRAMES];
+
+    f = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_WRITE,
+                        "profiles/", name, ".json");
+    if (!f)
+        return;
+
+    FS_FPrintf(f, "{\"traceEvents\":[\n");
+
+    count = 0;
+    for (i = 0; i < min(prof_num_threads, PROF_MAX_THREADS); i++) {
+        prof_thread_t *t = &prof_threads[i];
+
+        if (!t->events)
+            continue;
+
+        if (i == prof_main_thread)
+            Q_strlcpy(thread, "main", sizeof(thread));
+        else
+            Q_snprintf(thread, sizeof(thread), "thread %d", i);
+        FS_FPrintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                   "\"args\":{\"name\":\"%s\"}},\n", i, thread);
+
+        head = q_atomic_load(&t->head);
+        first = max(head - PROF_MAX_EVENTS, 0);
+        for (j = first; j < head; j++) {
+            prof_event_t *e = &t->events[j & (PROF_MAX_EVENTS - 1)];
+
+            if (e->start < window)
+                continue;
+
+            FS_FPrintf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                       "\"ts\":%"PRIu64",\"dur\":%u},\n",
+                       e->name, i, e->start - window, e->duration);
+            count++;
+        }
+    }
+
+    // frame boundaries as instant events on the main thread
+    for (k = prof_framenum - frames; k < prof_framenum; k++) {
+        FS_FPrintf(f, "{\"name\":\"frame\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":%d,"
+                   "\"ts\":%"PRIu64"},\n",
+                   max(prof_main_thread, 0), prof_frames[k % PROF_MAX_FRAMES] - window);
+    }
+
+    FS_FPrintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+               "\"args\":{\"name\":\"" APPLICATION "\"}}\n]}\n");
+
+    FS_FCloseFile(f);
+
+    Com_Printf("Wrote %d zones over %d frames to %s.\n", count, frames, buffer);
+}
+
+void Prof_Init(void)
+{
+    com_profile = Cvar_Get("com_profile", "0", 0);
+    com_profile->changed = com_profile_changed;
+    com_profile_changed(com_profile);
+
+    Cmd_AddCommand("profile_dump", Prof_Dump_f);
+}
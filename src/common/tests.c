@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/cmd.h"
 #include "common/common.h"
 #include "common/files.h"
+#include "common/msg.h"
 #include "common/tests.h"
 #include "refresh/refresh.h"
 #include "system/system.h"
@@ -492,6 +493,133 @@ static void Com_TestSnprintf_f(void)
     Com_Printf("%d failures, %d strings tested\n", errors, num_snprintf_tests * 2);
 }
 
+#define DELTA_ENTITIES  64
+
+static void mutate_entity(entity_state_t *s)
+{
+    int r = rand();
+
+    switch (r % 12) {
+    case 0:
+        s->origin[rand() % 3] += crand() * 64;
+        break;
+    case 1:
+        VectorCopy(s->origin, s->old_origin);
+        s->origin[rand() % 3] += crand() * 8;
+        break;
+    case 2:
+        s->angles[rand() % 3] = frand() * 360;
+        break;
+    case 3:
+        s->modelindex = rand() & 3;
+        s->modelindex2 = (rand() & 7) == 0;
+        break;
+    case 4:
+        s->modelindex3 = rand() & 1;
+        s->modelindex4 = rand() & 1;
+        break;
+    case 5:
+        s->frame = (r >> 8) & 1 ? rand() & 0xff : rand() & 0x3ff;
+        break;
+    case 6:
+        s->skinnum = (r >> 8) & 1 ? rand() & 0xff : rand() | (rand() << 16);
+        break;
+    case 7:
+        s->effects ^= 1 << (rand() & 31);
+        break;
+    case 8:
+        s->renderfx ^= 1 << (rand() % 20);
+        break;
+    case 9:
+        s->solid = (r >> 8) & 1 ? 0 : rand() | (rand() << 16);
+        break;
+    case 10:
+        s->sound = rand() & 3;
+        break;
+    default:
+        s->event = rand() & 1 ? rand() & 7 : 0;
+        break;
+    }
+}
+
+// checks that skipping entities with MSG_EntityUnchanged gives the same
+// output as always calling MSG_WriteDeltaEntity
+static void Com_TestDelta_f(void)
+{
+    static const msgEsFlags_t flagbits[] = {
+        MSG_ES_FORCE, MSG_ES_NEWENTITY, MSG_ES_FIRSTPERSON, MSG_ES_LONGSOLID,
+        MSG_ES_UMASK, MSG_ES_BEAMORIGIN, MSG_ES_SHORTANGLES, MSG_ES_REMOVE
+    };
+    entity_state_t states[DELTA_ENTITIES];
+    entity_packed_t from[DELTA_ENTITIES], to;
+    byte ref[MAX_MSGLEN];
+    size_t reflen;
+    msgEsFlags_t flags;
+    int i, j, k, frames, errors, tested, skipped;
+    unsigned start, end;
+
+    frames = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 10000;
+
+    memset(states, 0, sizeof(states));
+    for (i = 0; i < DELTA_ENTITIES; i++) {
+        states[i].number = i + 1;
+        MSG_PackEntity(&from[i], &states[i], qfalse);
+    }
+
+    start = Sys_Milliseconds();
+
+    errors = tested = skipped = 0;
+    for (i = 0; i < frames && errors < 10; i++) {
+        for (j = 0; j < DELTA_ENTITIES; j++) {
+            // most entities stay idle between frames
+            if ((rand() & 3) == 0) {
+                for (k = rand() & 3; k >= 0; k--)
+                    mutate_entity(&states[j]);
+            }
+
+            flags = 0;
+            for (k = 0; k < q_countof(flagbits); k++)
+                if ((rand() & 7) == 0)
+                    flags |= flagbits[k];
+
+            MSG_PackEntity(&to, &states[j], flags & MSG_ES_SHORTANGLES);
+
+            SZ_Clear(&msg_write);
+            MSG_WriteDeltaEntity(&from[j], &to, flags);
+            reflen = msg_write.cursize;
+            memcpy(ref, msg_write.data, reflen);
+
+            SZ_Clear(&msg_write);
+            if (MSG_EntityUnchanged(&from[j], &to, flags))
+                skipped++;
+            else
+                MSG_WriteDeltaEntity(&from[j], &to, flags);
+
+            if (msg_write.cursize != reflen || memcmp(msg_write.data, ref, reflen)) {
+                Com_EPrintf("entity %d frame %d flags %#x: %"PRIz" bytes, expected %"PRIz"\n",
+                            to.number, i, flags, msg_write.cursize, reflen);
+                errors++;
+            }
+
+            from[j] = to;
+            tested++;
+        }
+
+        // events usually last a single frame, but keep some of them around
+        // to test that repeated events are not skipped
+        for (j = 0; j < DELTA_ENTITIES; j++)
+            if (rand() & 1)
+                states[j].event = 0;
+    }
+
+    SZ_Clear(&msg_write);
+
+    end = Sys_Milliseconds();
+
+    Com_Printf("%d msec, %d failures, %d deltas tested, %d skipped\n",
+               end - start, errors, tested, skipped);
+}
+
 #if USE_REF
 static void Com_TestModels_f(void)
 {
@@ -536,6 +664,7 @@ void TST_Init(void)
     Cmd_AddCommand("normtest", Com_TestNorm_f);
     Cmd_AddCommand("infotest", Com_TestInfo_f);
     Cmd_AddCommand("snprintftest", Com_TestSnprintf_f);
+    Cmd_AddCommand("deltatest", Com_TestDelta_f);
 #if USE_REF
     Cmd_AddCommand("modeltest", Com_TestModels_f);
 #endif
@@ -22,6 +22,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 #include "sw.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 int             r_amodels_drawn;
 
 affinetridesc_t r_affinetridesc;
@@ -73,6 +77,9 @@ static unsigned long R_AliasCheckFrameBBox(maliasframe_t *frame, float worldxf[3
     vec3_t        mins, maxs;
     vec3_t        transformed_min, transformed_max;
     qboolean      zclipped = qfalse, zfullyclipped = qtrue;
+#ifdef __SSE2__
+    __m128        planes[4];
+#endif
 
     /*
     ** get the exact frame bounding box
@@ -100,6 +107,15 @@ static unsigned long R_AliasCheckFrameBBox(maliasframe_t *frame, float worldxf[3
         return (BBOX_MUST_CLIP_XY | BBOX_MUST_CLIP_Z);
     }
 
+#ifdef __SSE2__
+    // clip planes transposed to normal x, y, z and dist vectors
+    for (i = 0; i < 3; i++)
+        planes[i] = _mm_setr_ps(view_clipplanes[0].normal[i], view_clipplanes[1].normal[i],
+                                view_clipplanes[2].normal[i], view_clipplanes[3].normal[i]);
+    planes[3] = _mm_setr_ps(view_clipplanes[0].dist, view_clipplanes[1].dist,
+                            view_clipplanes[2].dist, view_clipplanes[3].dist);
+#endif
+
     /*
     ** build a transformed bounding box from the given min and max
     */
@@ -125,6 +141,17 @@ static unsigned long R_AliasCheckFrameBBox(maliasframe_t *frame, float worldxf[3
 
         R_AliasTransformVector(tmp, transformed, worldxf);
 
+#ifdef __SSE2__
+        // test against all 4 planes at once, bit j of the mask is plane j
+        if (sw_simd->integer) {
+            __m128 dp;
+
+            dp = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(transformed[0]), planes[0]),
+                                       _mm_mul_ps(_mm_set1_ps(transformed[1]), planes[1])),
+                            _mm_mul_ps(_mm_set1_ps(transformed[2]), planes[2]));
+            clipcode = _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(dp, planes[3]), _mm_setzero_ps()));
+        } else
+#endif
         for (j = 0; j < 4; j++) {
             float dp = DotProduct(transformed, view_clipplanes[j].normal);
 
@@ -211,6 +238,118 @@ void R_AliasProjectAndClipTestFinalVert(finalvert_t *fv)
         fv->flags |= ALIAS_BOTTOM_CLIP;
 }
 
+#ifdef __SSE2__
+
+static inline __m128 R_AliasGatherVerts(const maliasvert_t *v, int c)
+{
+    return _mm_setr_ps(v[0].v[c], v[1].v[c], v[2].v[c], v[3].v[c]);
+}
+
+static inline __m128 R_AliasGatherNormals(const maliasvert_t *v, int c)
+{
+    return _mm_setr_ps(bytedirs[v[0].lightnormalindex][c],
+                       bytedirs[v[1].lightnormalindex][c],
+                       bytedirs[v[2].lightnormalindex][c],
+                       bytedirs[v[3].lightnormalindex][c]);
+}
+
+static inline __m128 R_AliasDotProduct(const __m128 *v, const float *m)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(v[0], _mm_set1_ps(m[0])),
+                                 _mm_mul_ps(v[1], _mm_set1_ps(m[1]))),
+                      _mm_mul_ps(v[2], _mm_set1_ps(m[2])));
+}
+
+/*
+================
+R_AliasTransformFinalVerts4
+
+Same as the loop in R_AliasTransformFinalVerts, for 4 vertices at once.
+Results are bit-exact with the scalar path.
+================
+*/
+static void R_AliasTransformFinalVerts4(finalvert_t *fv, const maliasvert_t *oldv, const maliasvert_t *newv)
+{
+    __m128  lerped[3], normal[3], xyz[3];
+    __m128  lightcos, neg, zi, zclip;
+    __m128i u, v, flags;
+    float   out[3][4];
+    int     l[4], izi[4], iu[4], iv[4], iflags[4];
+    int     i;
+
+    for (i = 0; i < 3; i++) {
+        lerped[i] = _mm_add_ps(_mm_add_ps(_mm_set1_ps(r_lerp_move[i]),
+                                          _mm_mul_ps(R_AliasGatherVerts(oldv, i), _mm_set1_ps(r_lerp_backv[i]))),
+                               _mm_mul_ps(R_AliasGatherVerts(newv, i), _mm_set1_ps(r_lerp_frontv[i])));
+        normal[i] = R_AliasGatherNormals(newv, i);
+    }
+
+    if (currententity->flags & RF_SHELL_MASK) {
+        __m128  scale;
+
+        scale = _mm_set1_ps((currententity->flags & RF_WEAPONMODEL) ?
+                            WEAPONSHELL_SCALE : POWERSUIT_SCALE);
+
+        for (i = 0; i < 3; i++)
+            lerped[i] = _mm_add_ps(lerped[i], _mm_mul_ps(normal[i], scale));
+    }
+
+    for (i = 0; i < 3; i++) {
+        xyz[i] = _mm_add_ps(R_AliasDotProduct(lerped, aliastransform[i]),
+                            _mm_set1_ps(aliastransform[i][3]));
+        _mm_storeu_ps(out[i], xyz[i]);
+    }
+
+    // lighting
+    lightcos = R_AliasDotProduct(normal, r_plightvec);
+    neg = _mm_cmplt_ps(lightcos, _mm_setzero_ps());
+    lightcos = _mm_or_ps(_mm_and_ps(neg, _mm_mul_ps(lightcos, _mm_set1_ps(0.3f))),
+                         _mm_andnot_ps(neg, lightcos));
+    _mm_storeu_si128((__m128i *)l, _mm_add_epi32(_mm_set1_epi32(0x8000),
+                     _mm_cvttps_epi32(_mm_mul_ps(_mm_set1_ps(0x7fff), lightcos))));
+
+    // project points, results of z clipped lanes are not stored
+    zi = _mm_div_ps(_mm_set1_ps(1.0f), xyz[2]);
+    _mm_storeu_si128((__m128i *)izi, _mm_cvttps_epi32(_mm_mul_ps(zi, _mm_set1_ps(s_ziscale))));
+
+    u = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(xyz[0], _mm_set1_ps(r_refdef.xscale)), zi),
+                                    _mm_set1_ps(r_refdef.xcenter)));
+    v = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(xyz[1], _mm_set1_ps(r_refdef.yscale)), zi),
+                                    _mm_set1_ps(r_refdef.ycenter)));
+    _mm_storeu_si128((__m128i *)iu, u);
+    _mm_storeu_si128((__m128i *)iv, v);
+
+    // clip codes
+    flags = _mm_and_si128(_mm_cmplt_epi32(u, _mm_set1_epi32(r_refdef.vrect.x)),
+                          _mm_set1_epi32(ALIAS_LEFT_CLIP));
+    flags = _mm_or_si128(flags, _mm_and_si128(_mm_cmplt_epi32(v, _mm_set1_epi32(r_refdef.vrect.y)),
+                                              _mm_set1_epi32(ALIAS_TOP_CLIP)));
+    flags = _mm_or_si128(flags, _mm_and_si128(_mm_cmpgt_epi32(u, _mm_set1_epi32(r_refdef.vrectright)),
+                                              _mm_set1_epi32(ALIAS_RIGHT_CLIP)));
+    flags = _mm_or_si128(flags, _mm_and_si128(_mm_cmpgt_epi32(v, _mm_set1_epi32(r_refdef.vrectbottom)),
+                                              _mm_set1_epi32(ALIAS_BOTTOM_CLIP)));
+
+    zclip = _mm_cmplt_ps(xyz[2], _mm_set1_ps(ALIAS_Z_CLIP_PLANE));
+    flags = _mm_or_si128(_mm_and_si128(_mm_castps_si128(zclip), _mm_set1_epi32(ALIAS_Z_CLIP)),
+                         _mm_andnot_si128(_mm_castps_si128(zclip), flags));
+    _mm_storeu_si128((__m128i *)iflags, flags);
+
+    for (i = 0; i < 4; i++, fv++) {
+        fv->xyz[0] = out[0][i];
+        fv->xyz[1] = out[1][i];
+        fv->xyz[2] = out[2][i];
+        fv->l = l[i];
+        fv->flags = iflags[i];
+        if (iflags[i] & ALIAS_Z_CLIP)
+            continue;
+        fv->zi = izi[i];
+        fv->u = iu[i];
+        fv->v = iv[i];
+    }
+}
+
+#endif // __SSE2__
+
 /*
 ================
 R_AliasTransformFinalVerts
@@ -218,9 +357,16 @@ R_AliasTransformFinalVerts
 */
 static void R_AliasTransformFinalVerts(int numpoints, finalvert_t *fv, maliasvert_t *oldv, maliasvert_t *newv)
 {
-    int i;
+    int i = 0;
 
-    for (i = 0; i < numpoints; i++, fv++, oldv++, newv++) {
+#ifdef __SSE2__
+    if (sw_simd->integer) {
+        for (; i + 4 <= numpoints; i += 4, fv += 4, oldv += 4, newv += 4)
+            R_AliasTransformFinalVerts4(fv, oldv, newv);
+    }
+#endif
+
+    for (; i < numpoints; i++, fv++, oldv++, newv++) {
         float       lightcos;
         const vec_t *plightnormal;
         vec3_t      lerped_vert;
@@ -717,3 +863,101 @@ exit:
         r_refdef.xscale = -r_refdef.xscale;
 }
 
+
+#if USE_TESTS
+
+typedef struct {
+    entity_t    *ents;
+    model_t     *model;
+    int         count;
+    int         frames;
+} aliasbench_t;
+
+static void R_AliasBenchFrames(void *arg)
+{
+    aliasbench_t    *bench = arg;
+    int             i;
+
+    r_amodels_drawn = 0;
+    for (i = 0; i < bench->frames * bench->count; i++) {
+        currententity = &bench->ents[i % bench->count];
+        currentmodel = bench->model;
+        VectorCopy(currententity->origin, r_entorigin);
+        VectorSubtract(r_origin, r_entorigin, modelorg);
+        R_AliasDrawModel();
+    }
+}
+
+/*
+================
+R_AliasBench_f
+
+Draws a crowd of the first loaded alias model in front of the view
+through the scalar and SIMD vertex paths and reports models per second.
+================
+*/
+void R_AliasBench_f(void)
+{
+    aliasbench_t    bench;
+    entity_t        *ent;
+    model_t         *model;
+    int             i, pass, count;
+    unsigned        msec[2];
+
+    if (!r_worldmodel) {
+        Com_Printf("No map loaded.\n");
+        return;
+    }
+
+    // view is set up by the last frame, which may predate a mode change
+    if (r_refdef.vrect.width <= 0 || r_refdef.vrect.height <= 0 ||
+        r_refdef.vrect.x + r_refdef.vrect.width > vid.width ||
+        r_refdef.vrect.y + r_refdef.vrect.height > vid.height) {
+        Com_Printf("No valid view, render a frame first.\n");
+        return;
+    }
+
+    for (i = 0, model = r_models; i < r_numModels; i++, model++)
+        if (model->type == MOD_ALIAS)
+            break;
+
+    if (i == r_numModels) {
+        Com_Printf("No alias models loaded.\n");
+        return;
+    }
+
+    count = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 256;
+    clamp(count, 1, 4096);
+    bench.frames = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : 10;
+    clamp(bench.frames, 1, 1000);
+    bench.count = count;
+    bench.model = model;
+
+    // rows of 16 models, receding from the view
+    bench.ents = R_Mallocz(sizeof(*bench.ents) * count);
+    for (i = 0, ent = bench.ents; i < count; i++, ent++) {
+        VectorMA(r_origin, 96 + (i / 16) * 48, vpn, ent->origin);
+        VectorMA(ent->origin, ((i % 16) - 7.5f) * 40, vright, ent->origin);
+        VectorCopy(ent->origin, ent->oldorigin);
+        ent->angles[YAW] = i * 37;
+        ent->model = (model - r_models) + 1;
+        ent->frame = i % model->numframes;
+        ent->oldframe = (i + 1) % model->numframes;
+        ent->backlerp = 0.5f;
+    }
+
+    if (R_SimdBench(R_AliasBenchFrames, &bench, msec)) {
+        for (pass = 0; pass < 2; pass++) {
+            Com_Printf("%s: %d models (%d drawn), %d frames, %u msec, %.f models/sec\n",
+                       pass ? "simd" : "scalar", count, r_amodels_drawn / bench.frames,
+                       bench.frames, msec[pass],
+                       (double)bench.frames * count * 1000 / (msec[pass] ? msec[pass] : 1));
+        }
+    }
+
+    currententity = NULL;
+
+    Z_Free(bench.ents);
+}
+
+#endif // USE_TESTS
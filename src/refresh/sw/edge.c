@@ -684,6 +684,328 @@ static int D_MipLevelForScale(float scale)
 }
 
 
+/*
+=========================================================================
+
+PARALLEL SPAN DRAWING
+
+With sw_threads enabled, spans of texture mapped surfaces are queued
+instead of drawn. Surface setup (surface cache, gradients) still runs on
+the main thread, then the spans are sorted into horizontal bands of the
+screen, and each band is drawn into the frame and z-buffer by its own
+thread. Spans never overlap, so threads only share read-only data.
+
+Before that, textures of visible world surfaces missing from the surface
+cache are built by the same threads (see D_BuildQueuedSurfaces).
+
+=========================================================================
+*/
+
+#define MAX_SPAN_THREADS    16
+
+typedef struct {
+    pixel_t     *cacheblock;
+    int         cachewidth;
+    float       sdivzstepu, tdivzstepu, zistepu;
+    float       sdivzstepv, tdivzstepv, zistepv;
+    float       sdivzorigin, tdivzorigin, ziorigin;
+    fixed16_t   sadjust, tadjust, bbextents, bbextentt;
+    float       zzistepu, zzistepv, zziorigin;  // for z-buffer pass
+} spangrad_t;
+
+typedef struct {
+    espan_t     *spans;
+    int         grad;
+} spanjob_t;
+
+typedef struct {
+    sys_thread_t    *thread;
+    sys_event_t     *start;
+    sys_event_t     *done;
+    int             index;
+    int             shutdown;
+} spanworker_t;
+
+static spanworker_t d_workers[MAX_SPAN_THREADS];
+static int          d_numworkers;
+static qboolean     d_threadsinit;
+static void         (*d_workfunc)(int index);
+static int          d_numbands = 1;
+static byte         d_rowband[MAXHEIGHT];
+
+static spangrad_t   *d_spangrads;
+static int          d_numspangrads;
+static spanjob_t    *d_bandjobs[MAX_SPAN_THREADS + 1];
+static int          d_numbandjobs[MAX_SPAN_THREADS + 1];
+static int          d_maxspanjobs;
+
+static void D_SaveGradients(spangrad_t *g)
+{
+    g->cacheblock = cacheblock;
+    g->cachewidth = cachewidth;
+    g->sdivzstepu = d_sdivzstepu;
+    g->tdivzstepu = d_tdivzstepu;
+    g->zistepu = d_zistepu;
+    g->sdivzstepv = d_sdivzstepv;
+    g->tdivzstepv = d_tdivzstepv;
+    g->zistepv = d_zistepv;
+    g->sdivzorigin = d_sdivzorigin;
+    g->tdivzorigin = d_tdivzorigin;
+    g->ziorigin = d_ziorigin;
+    g->sadjust = sadjust;
+    g->tadjust = tadjust;
+    g->bbextents = bbextents;
+    g->bbextentt = bbextentt;
+}
+
+static void D_LoadGradients(const spangrad_t *g)
+{
+    cacheblock = g->cacheblock;
+    cachewidth = g->cachewidth;
+    d_sdivzstepu = g->sdivzstepu;
+    d_tdivzstepu = g->tdivzstepu;
+    d_zistepu = g->zistepu;
+    d_sdivzstepv = g->sdivzstepv;
+    d_tdivzstepv = g->tdivzstepv;
+    d_zistepv = g->zistepv;
+    d_sdivzorigin = g->sdivzorigin;
+    d_tdivzorigin = g->tdivzorigin;
+    d_ziorigin = g->ziorigin;
+    sadjust = g->sadjust;
+    tadjust = g->tadjust;
+    bbextents = g->bbextents;
+    bbextentt = g->bbextentt;
+}
+
+static void D_DrawBand(int band)
+{
+    spanjob_t   *job;
+    spangrad_t  *g;
+    int         i;
+
+    for (i = 0, job = d_bandjobs[band]; i < d_numbandjobs[band]; i++, job++) {
+        g = &d_spangrads[job->grad];
+
+        D_LoadGradients(g);
+
+        D_DrawSpans16(job->spans);
+
+        d_zistepu = g->zzistepu;
+        d_zistepv = g->zzistepv;
+        d_ziorigin = g->zziorigin;
+
+        D_DrawZSpans(job->spans);
+    }
+}
+
+static void D_WorkerThread(void *arg)
+{
+    spanworker_t *w = arg;
+
+    while (1) {
+        Sys_WaitEvent(w->start);
+        if (q_atomic_load(&w->shutdown))
+            break;
+        d_workfunc(w->index);
+        Sys_SetEvent(w->done);
+    }
+}
+
+/*
+==============
+D_RunWorkers
+
+Calls func on the main thread with index 0 and on each worker thread with
+its own index, returning when all calls are done.
+==============
+*/
+void D_RunWorkers(void (*func)(int))
+{
+    int     i;
+
+    d_workfunc = func;
+
+    for (i = 0; i < d_numworkers; i++)
+        Sys_SetEvent(d_workers[i].start);
+
+    func(0);
+
+    for (i = 0; i < d_numworkers; i++)
+        Sys_WaitEvent(d_workers[i].done);
+}
+
+void D_InitThreads(void)
+{
+    spanworker_t    *w;
+    int             i, count;
+
+    count = Cvar_ClampInteger(sw_threads, 0, MAX_SPAN_THREADS);
+
+    for (i = 0; i < count; i++) {
+        w = &d_workers[i];
+        w->start = Sys_CreateEvent();
+        w->done = Sys_CreateEvent();
+        w->index = i + 1;
+        w->thread = Sys_CreateThread(D_WorkerThread, w);
+        if (!w->thread) {
+            Sys_DestroyEvent(w->start);
+            Sys_DestroyEvent(w->done);
+            memset(w, 0, sizeof(*w));
+            break;
+        }
+    }
+
+    d_numworkers = i;
+    d_numbands = i + 1;
+    d_threadsinit = qtrue;
+}
+
+void D_ShutdownThreads(void)
+{
+    spanworker_t    *w;
+    int             i;
+
+    for (i = 0, w = d_workers; i < d_numworkers; i++, w++) {
+        q_atomic_store(&w->shutdown, 1);
+        Sys_SetEvent(w->start);
+        Sys_JoinThread(w->thread);
+        Sys_DestroyEvent(w->start);
+        Sys_DestroyEvent(w->done);
+        memset(w, 0, sizeof(*w));
+    }
+
+    d_numworkers = 0;
+    d_numbands = 1;
+
+    Z_Free(d_spangrads);
+    d_spangrads = NULL;
+    for (i = 0; i <= MAX_SPAN_THREADS; i++) {
+        Z_Free(d_bandjobs[i]);
+        d_bandjobs[i] = NULL;
+    }
+    d_maxspanjobs = 0;
+    d_threadsinit = qfalse;
+}
+
+void D_ThreadsChanged(cvar_t *self)
+{
+    // renderer not up yet, R_Init will pick the value up
+    if (!d_threadsinit)
+        return;
+
+    D_ShutdownThreads();
+    D_InitThreads();
+}
+
+// builds textures of visible world surfaces in parallel before drawing
+static void D_PrebuildSurfaces(void)
+{
+    surf_t      *s;
+    mface_t     *pface;
+    int         miplevel;
+
+    currententity = &r_worldentity;
+
+    for (s = &surfaces[1]; s < surface_p; s++) {
+        if (!s->spans || s->insubmodel)
+            continue;
+        if (s->flags & (DSURF_SKY | DSURF_BACKGROUND | DSURF_TURB))
+            continue;
+
+        pface = s->msurf;
+        miplevel = D_MipLevelForScale(s->nearzi * r_refdef.scale_for_mip * pface->texinfo->mipadjust);
+        D_QueueSurface(pface, miplevel);
+    }
+
+    D_BuildQueuedSurfaces();
+}
+
+static void D_BeginSpanJobs(void)
+{
+    int     i, v, count, height;
+
+    // one gradient and at most one job per band for each surface
+    count = surface_p - surfaces;
+    if (count > d_maxspanjobs) {
+        d_maxspanjobs = (count + 255) & ~255;
+        Z_Free(d_spangrads);
+        d_spangrads = R_Malloc(sizeof(d_spangrads[0]) * d_maxspanjobs);
+        for (i = 0; i < d_numbands; i++) {
+            Z_Free(d_bandjobs[i]);
+            d_bandjobs[i] = R_Malloc(sizeof(d_bandjobs[i][0]) * d_maxspanjobs);
+        }
+    }
+
+    height = r_refdef.vrectbottom - r_refdef.vrect.y;
+    for (v = r_refdef.vrect.y; v < r_refdef.vrectbottom; v++)
+        d_rowband[v] = (v - r_refdef.vrect.y) * d_numbands / height;
+}
+
+static void D_QueueSpans(espan_t *spans, qboolean sky)
+{
+    espan_t     *span, *next, *heads[MAX_SPAN_THREADS + 1];
+    spangrad_t  *g;
+    spanjob_t   *job;
+    int         band;
+
+    g = &d_spangrads[d_numspangrads];
+    D_SaveGradients(g);
+
+    if (sky) {
+        // sky is at infinity distance in the z-buffer
+        g->zzistepu = 0;
+        g->zzistepv = 0;
+        g->zziorigin = -0.9;
+    } else {
+        g->zzistepu = d_zistepu;
+        g->zzistepv = d_zistepv;
+        g->zziorigin = d_ziorigin;
+    }
+
+    // relink spans into per band lists
+    memset(heads, 0, sizeof(heads[0]) * d_numbands);
+    for (span = spans; span; span = next) {
+        next = span->pnext;
+        band = d_rowband[span->v];
+        span->pnext = heads[band];
+        heads[band] = span;
+    }
+
+    for (band = 0; band < d_numbands; band++) {
+        if (!heads[band])
+            continue;
+        job = &d_bandjobs[band][d_numbandjobs[band]++];
+        job->spans = heads[band];
+        job->grad = d_numspangrads;
+    }
+
+    d_numspangrads++;
+}
+
+/*
+==============
+D_FlushSpanJobs
+
+Draws all queued spans. Also called before surface cache blocks that
+queued spans may reference are evicted.
+==============
+*/
+void D_FlushSpanJobs(void)
+{
+    spangrad_t  saved;
+
+    if (!d_numspangrads)
+        return;
+
+    // may be called in the middle of surface setup
+    D_SaveGradients(&saved);
+    D_RunWorkers(D_DrawBand);
+    D_LoadGradients(&saved);
+
+    d_numspangrads = 0;
+    memset(d_numbandjobs, 0, sizeof(d_numbandjobs));
+}
+
 /*
 ==============
 D_FlatFillSurface
@@ -867,6 +1189,11 @@ static void D_SkySurf(surf_t *s)
 
         D_CalcGradients(pface);
 
+        if (d_numworkers) {
+            D_QueueSpans(s->spans, qtrue);
+            return;
+        }
+
         D_DrawSpans16(s->spans);
     }
 
@@ -923,9 +1250,12 @@ static void D_SolidSurf(surf_t *s)
 
     D_CalcGradients(pface);
 
-    D_DrawSpans16(s->spans);
-
-    D_DrawZSpans(s->spans);
+    if (d_numworkers) {
+        D_QueueSpans(s->spans, qfalse);
+    } else {
+        D_DrawSpans16(s->spans);
+        D_DrawZSpans(s->spans);
+    }
 
     if (s->insubmodel) {
         //
@@ -1012,6 +1342,11 @@ void D_DrawSurfaces(void)
     } else if (sw_drawflat->integer) {
         D_DrawflatSurfaces();
     } else {
+        if (d_numworkers) {
+            D_PrebuildSurfaces();
+            D_BeginSpanJobs();
+        }
+
         for (s = &surfaces[1]; s < surface_p; s++) {
             if (!s->spans)
                 continue;
@@ -1027,6 +1362,9 @@ void D_DrawSurfaces(void)
             else
                 D_SolidSurf(s);
         }
+
+        // span memory is reused after this returns
+        D_FlushSpanJobs();
     }
 
     currententity = NULL;   //&r_worldentity;
@@ -204,7 +204,7 @@ void R_LightPoint(vec3_t point, vec3_t color)
 
 //===================================================================
 
-blocklight_t        blocklights[MAX_BLOCKLIGHTS * LIGHTMAP_BYTES];
+q_threadlocal blocklight_t  blocklights[MAX_BLOCKLIGHTS * LIGHTMAP_BYTES];
 
 /*
 ===============
@@ -86,6 +86,8 @@ cvar_t  *sw_waterwarp;
 cvar_t  *sw_dynamic;
 cvar_t  *sw_modulate;
 cvar_t  *sw_lockpvs;
+cvar_t  *sw_threads;
+cvar_t  *sw_simd;
 
 //Start Added by Lewey
 // These flags allow you to turn SIRDS on and
@@ -113,14 +115,15 @@ cvar_t  *vid_gamma;
 // FIXME: make into one big structure, like cl or sv
 // FIXME: do separately for refresh engine and driver
 
-float   d_sdivzstepu, d_tdivzstepu, d_zistepu;
-float   d_sdivzstepv, d_tdivzstepv, d_zistepv;
-float   d_sdivzorigin, d_tdivzorigin, d_ziorigin;
+// span drawing state is per thread, see D_DrawSurfaces
+q_threadlocal float d_sdivzstepu, d_tdivzstepu, d_zistepu;
+q_threadlocal float d_sdivzstepv, d_tdivzstepv, d_zistepv;
+q_threadlocal float d_sdivzorigin, d_tdivzorigin, d_ziorigin;
 
-fixed16_t   sadjust, tadjust, bbextents, bbextentt;
+q_threadlocal fixed16_t sadjust, tadjust, bbextents, bbextentt;
 
-pixel_t         *cacheblock;
-int             cachewidth;
+q_threadlocal pixel_t   *cacheblock;
+q_threadlocal int       cachewidth;
 
 pixel_t     *d_viewbuffer;
 int         d_screenrowbytes;
@@ -166,6 +169,9 @@ static void R_Register(void)
     sw_dynamic = Cvar_Get("sw_dynamic", "1", 0);
     sw_modulate = Cvar_Get("sw_modulate", "1", 0);
     sw_lockpvs = Cvar_Get("sw_lockpvs", "0", 0);
+    sw_threads = Cvar_Get("sw_threads", "0", 0);
+    sw_threads->changed = D_ThreadsChanged;
+    sw_simd = Cvar_Get("sw_simd", "1", 0);
 
     //Start Added by Lewey
     sw_drawsird = Cvar_Get("sw_drawsird", "0", 0);
@@ -181,11 +187,21 @@ static void R_Register(void)
     vid_gamma = Cvar_Get("vid_gamma", "1.0", CVAR_ARCHIVE | CVAR_FILES);
 
     Cmd_AddCommand("scdump", D_SCDump_f);
+#if USE_TESTS
+    Cmd_AddCommand("spanbench", D_SpanBench_f);
+    Cmd_AddCommand("aliasbench", R_AliasBench_f);
+#endif
 }
 
 static void R_UnRegister(void)
 {
+    sw_threads->changed = NULL;
+
     Cmd_RemoveCommand("scdump");
+#if USE_TESTS
+    Cmd_RemoveCommand("spanbench");
+    Cmd_RemoveCommand("aliasbench");
+#endif
 }
 
 void R_ModeChanged(int width, int height, int flags, int rowbytes, void *pixels)
@@ -269,6 +285,8 @@ qboolean R_Init(qboolean total)
 
     R_InitTurb();
 
+    D_InitThreads();
+
     return qtrue;
 }
 
@@ -316,6 +334,8 @@ void R_Shutdown(qboolean total)
     // free surface cache
     R_FreeCaches();
 
+    D_ShutdownThreads();
+
     R_UnRegister();
 
     IMG_Shutdown();
@@ -329,3 +329,72 @@ void R_SetupFrame(void)
         d_scalemip[i] = basemip[i] * sw_mipscale->value;
 }
 
+
+#if USE_TESTS
+
+/*
+================
+R_SimdBench
+
+Runs func once with sw_simd off and once with it on, and returns the
+time taken by each pass in msec. Drawing goes to scratch color and z
+buffers of the current video size, so span tables left over from the
+last frame, or from before a mode change, are never used.
+================
+*/
+qboolean R_SimdBench(void (*func)(void *), void *arg, unsigned msec[2])
+{
+    static byte     *spantable[MAXHEIGHT];
+    static short    *zspantable[MAXHEIGHT];
+    pixel_t     *viewbuffer, *color;
+    short       *z;
+    int         i, pass, screenrowbytes, zwidth, oldsimd;
+    unsigned    start;
+
+    if (!vid.width || !vid.height) {
+        Com_Printf("No video mode set.\n");
+        return qfalse;
+    }
+
+    color = R_Mallocz(vid.width * vid.height * VID_BYTES);
+    z = R_Malloc(vid.width * vid.height * sizeof(z[0]));
+    memset(z, 0xff, vid.width * vid.height * sizeof(z[0]));
+
+    viewbuffer = d_viewbuffer;
+    screenrowbytes = d_screenrowbytes;
+    zwidth = d_zwidth;
+    memcpy(spantable, d_spantable, sizeof(spantable));
+    memcpy(zspantable, d_zspantable, sizeof(zspantable));
+
+    d_viewbuffer = color;
+    d_screenrowbytes = vid.width * VID_BYTES;
+    d_zwidth = vid.width;
+    for (i = 0; i < vid.height; i++) {
+        d_spantable[i] = d_viewbuffer + i * d_screenrowbytes;
+        d_zspantable[i] = z + i * d_zwidth;
+    }
+
+    oldsimd = sw_simd->integer;
+
+    for (pass = 0; pass < 2; pass++) {
+        Cvar_SetInteger(sw_simd, pass, FROM_CODE);
+
+        start = Sys_Milliseconds();
+        func(arg);
+        msec[pass] = Sys_Milliseconds() - start;
+    }
+
+    Cvar_SetInteger(sw_simd, oldsimd, FROM_CODE);
+
+    d_viewbuffer = viewbuffer;
+    d_screenrowbytes = screenrowbytes;
+    d_zwidth = zwidth;
+    memcpy(d_spantable, spantable, sizeof(spantable));
+    memcpy(d_zspantable, zspantable, sizeof(zspantable));
+
+    Z_Free(color);
+    Z_Free(z);
+    return qtrue;
+}
+
+#endif // USE_TESTS
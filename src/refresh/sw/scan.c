@@ -21,6 +21,86 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "sw.h"
 
+#if defined(__SSE2__) && VID_BYTES == 4
+#include <emmintrin.h>
+#define USE_SIMD_SPANS  1
+#else
+#define USE_SIMD_SPANS  0
+#endif
+
+#if USE_SIMD_SPANS
+
+// converts 4 texels from surface cache (BGR) to frame buffer (RGB) order,
+// keeping the padding byte of destination pixels intact
+static inline void D_StoreTexels4(byte *pdest, __m128i tex)
+{
+    const __m128i lo = _mm_set1_epi32(0x000000ff);
+    const __m128i mid = _mm_set1_epi32(0x0000ff00);
+    const __m128i pad = _mm_set1_epi32(0xff000000);
+    __m128i dst, r, g, b;
+
+    dst = _mm_loadu_si128((__m128i *)pdest);
+    r = _mm_and_si128(_mm_srli_epi32(tex, 16), lo);
+    g = _mm_and_si128(tex, mid);
+    b = _mm_slli_epi32(_mm_and_si128(tex, lo), 16);
+    dst = _mm_and_si128(dst, pad);
+    _mm_storeu_si128((__m128i *)pdest, _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, dst)));
+}
+
+// low 32 bits of 4 unsigned products, SSE2 lacks pmulld
+static inline __m128i D_MulLo32(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+#define TEXEL(ofs)  (*(uint32_t *)(pbase + (ofs)))
+
+static void D_DrawSpanSIMD(byte *pdest, byte *pbase, fixed16_t s, fixed16_t t,
+                           fixed16_t sstep, fixed16_t tstep, int count)
+{
+    __m128i sv, tv, sstep4, tstep4, width, ofs;
+    int     o[4];
+    byte    *ptex;
+
+    sv = _mm_setr_epi32(s, s + sstep, s + sstep * 2, s + sstep * 3);
+    tv = _mm_setr_epi32(t, t + tstep, t + tstep * 2, t + tstep * 3);
+    sstep4 = _mm_set1_epi32(sstep * 4);
+    tstep4 = _mm_set1_epi32(tstep * 4);
+    width = _mm_set1_epi32(cachewidth);
+
+    // texel addresses for 4 pixels at once, t >> 16 is never negative
+    do {
+        ofs = _mm_add_epi32(_mm_slli_epi32(_mm_srai_epi32(sv, 16), 2),
+                            D_MulLo32(_mm_srai_epi32(tv, 16), width));
+        _mm_storeu_si128((__m128i *)o, ofs);
+        D_StoreTexels4(pdest, _mm_setr_epi32(TEXEL(o[0]), TEXEL(o[1]),
+                                             TEXEL(o[2]), TEXEL(o[3])));
+        pdest += 4 * VID_BYTES;
+        sv = _mm_add_epi32(sv, sstep4);
+        tv = _mm_add_epi32(tv, tstep4);
+        count -= 4;
+    } while (count >= 4);
+
+    s = _mm_cvtsi128_si32(sv);
+    t = _mm_cvtsi128_si32(tv);
+
+    while (count-- > 0) {
+        ptex = pbase + (s >> 16) * TEX_BYTES + (t >> 16) * cachewidth;
+        pdest[0] = ptex[2];
+        pdest[1] = ptex[1];
+        pdest[2] = ptex[0];
+        pdest += VID_BYTES;
+        s += sstep;
+        t += tstep;
+    }
+}
+
+#endif // USE_SIMD_SPANS
+
 /*
 =============
 D_WarpScreen
@@ -194,7 +274,30 @@ void D_DrawTurbulent16(espan_t *pspan, int *warptable)
             s = s & ((CYCLE << 16) - 1);
             t = t & ((CYCLE << 16) - 1);
 
+#if USE_SIMD_SPANS
+            // texel addresses come from table lookups, but
+            // swizzle and store 4 pixels at once
+            if (sw_simd->integer) {
+                int o[4], i;
+
+                for (; spancount >= 4; spancount -= 4) {
+                    for (i = 0; i < 4; i++) {
+                        turb_s = ((s + turb[(t >> 16) & (CYCLE - 1)]) >> 16) & TURB_MASK;
+                        turb_t = ((t + turb[(s >> 16) & (CYCLE - 1)]) >> 16) & TURB_MASK;
+                        o[i] = (turb_t * TURB_SIZE * TEX_BYTES) + turb_s * TEX_BYTES;
+                        s += sstep;
+                        t += tstep;
+                    }
+                    D_StoreTexels4(pdest, _mm_setr_epi32(TEXEL(o[0]), TEXEL(o[1]),
+                                                         TEXEL(o[2]), TEXEL(o[3])));
+                    pdest += 4 * VID_BYTES;
+                }
+            }
+
+            while (spancount > 0) {
+#else
             do {
+#endif
                 turb_s = ((s + turb[(t >> 16) & (CYCLE - 1)]) >> 16) & TURB_MASK;
                 turb_t = ((t + turb[(s >> 16) & (CYCLE - 1)]) >> 16) & TURB_MASK;
                 ptex = pbase + (turb_t * TURB_SIZE * TEX_BYTES) + turb_s * TEX_BYTES;
@@ -204,7 +307,12 @@ void D_DrawTurbulent16(espan_t *pspan, int *warptable)
                 pdest += VID_BYTES;
                 s += sstep;
                 t += tstep;
+#if USE_SIMD_SPANS
+                spancount--;
+            }
+#else
             } while (--spancount > 0);
+#endif
 
             s = snext;
             t = tnext;
@@ -226,6 +334,9 @@ void D_DrawSpans16(espan_t *pspan)
     fixed16_t       s, t, snext, tnext, sstep, tstep;
     float           sdivz, tdivz, zi, z, du, dv, spancountminus1;
     float           sdivz16stepu, tdivz16stepu, zi16stepu;
+#if USE_SIMD_SPANS
+    int             simd = sw_simd->integer;
+#endif
 
     sstep = 0;  // keep compiler happy
     tstep = 0;  // ditto
@@ -326,6 +437,12 @@ void D_DrawSpans16(espan_t *pspan)
                 }
             }
 
+#if USE_SIMD_SPANS
+            if (spancount >= 4 && simd) {
+                D_DrawSpanSIMD(pdest, pbase, s, t, sstep, tstep, spancount);
+                pdest += spancount * VID_BYTES;
+            } else
+#endif
             do {
                 ptex = pbase + (s >> 16) * TEX_BYTES + (t >> 16) * cachewidth;
                 pdest[0] = ptex[2];
@@ -357,6 +474,10 @@ void D_DrawZSpans(espan_t *pspan)
     uint32_t        ltemp;
     float           zi;
     float           du, dv;
+#if USE_SIMD_SPANS
+    int             simd = sw_simd->integer;
+    __m128i         izi0, izi1, izistep8;
+#endif
 
 // FIXME: check for clamping/range problems
 // we count on FP exceptions being turned off to avoid range problems
@@ -375,6 +496,27 @@ void D_DrawZSpans(espan_t *pspan)
         // we count on FP exceptions being turned off to avoid range problems
         izi = (int)(zi * 0x8000 * 0x10000);
 
+#if USE_SIMD_SPANS
+        // 8 depth values per store
+        if (count >= 8 && simd) {
+            izi0 = _mm_setr_epi32(izi, izi + izistep, izi + izistep * 2, izi + izistep * 3);
+            izi1 = _mm_add_epi32(izi0, _mm_set1_epi32(izistep * 4));
+            izistep8 = _mm_set1_epi32(izistep * 8);
+            do {
+                _mm_storeu_si128((__m128i *)pdest,
+                                 _mm_packs_epi32(_mm_srai_epi32(izi0, 16),
+                                                 _mm_srai_epi32(izi1, 16)));
+                izi0 = _mm_add_epi32(izi0, izistep8);
+                izi1 = _mm_add_epi32(izi1, izistep8);
+                pdest += 8;
+                count -= 8;
+            } while (count >= 8);
+            izi = _mm_cvtsi128_si32(izi0);
+            if (!count)
+                continue;
+        }
+#endif
+
         if ((uintptr_t)pdest & 0x02) {
             *pdest++ = (short)(izi >> 16);
             izi += izistep;
@@ -398,3 +540,90 @@ void D_DrawZSpans(espan_t *pspan)
     } while ((pspan = pspan->pnext) != NULL);
 }
 
+
+#if USE_TESTS
+
+typedef struct {
+    espan_t *spans;
+    int     frames;
+} spanbench_t;
+
+static void D_SpanBenchFrames(void *arg)
+{
+    spanbench_t *bench = arg;
+    int         i;
+
+    for (i = 0; i < bench->frames; i++) {
+        D_DrawSpans16(bench->spans);
+        D_DrawZSpans(bench->spans);
+    }
+}
+
+/*
+=============
+D_SpanBench_f
+
+Fills the screen with a synthetic perspective correct plane and reports
+span drawing throughput for the scalar and SIMD paths.
+=============
+*/
+void D_SpanBench_f(void)
+{
+    static const int sizes[2][2] = { { 1920, 1080 }, { 3840, 2160 } };
+    spanbench_t bench;
+    espan_t     *spans;
+    byte        *texture;
+    int         i, v, pass;
+    unsigned    msec[2];
+    double      pixels, rate;
+
+    bench.frames = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 100;
+    if (bench.frames < 1)
+        bench.frames = 1;
+
+    spans = bench.spans = R_Malloc(sizeof(*spans) * vid.height);
+    for (v = 0; v < vid.height; v++) {
+        spans[v].u = 0;
+        spans[v].v = v;
+        spans[v].count = vid.width;
+        spans[v].pnext = v < vid.height - 1 ? &spans[v + 1] : NULL;
+    }
+
+    texture = R_Malloc(256 * 256 * TEX_BYTES);
+    for (i = 0; i < 256 * 256 * TEX_BYTES; i++)
+        texture[i] = i * 31 + (i >> 10);
+
+    // floor plane receding towards the top of the screen
+    cacheblock = texture;
+    cachewidth = 256 * TEX_BYTES;
+    d_ziorigin = 0.1f;
+    d_zistepu = 0.05f / vid.width;
+    d_zistepv = 0.3f / vid.height;
+    d_sdivzorigin = 0;
+    d_sdivzstepu = 0.1f * 255 / vid.width;
+    d_sdivzstepv = 0;
+    d_tdivzorigin = 0;
+    d_tdivzstepu = 0;
+    d_tdivzstepv = 0.4f * 255 / vid.height;
+    sadjust = tadjust = 0;
+    bbextents = bbextentt = (256 << 16) - 1;
+
+    if (R_SimdBench(D_SpanBenchFrames, &bench, msec)) {
+        pixels = (double)vid.width * vid.height * bench.frames;
+        for (pass = 0; pass < 2; pass++) {
+            rate = pixels * 1000 / (msec[pass] ? msec[pass] : 1);
+            Com_Printf("%s: %d frames at %dx%d, %u msec, %.1f Mpixels/sec",
+                       pass ? "simd" : "scalar", bench.frames, vid.width, vid.height,
+                       msec[pass], rate / 1e6);
+            for (i = 0; i < 2; i++)
+                Com_Printf(", %.1f fps at %dx%d", rate / (sizes[i][0] * sizes[i][1]),
+                           sizes[i][0], sizes[i][1]);
+            Com_Printf("\n");
+        }
+    }
+
+    Z_Free(texture);
+    Z_Free(spans);
+}
+
+#endif // USE_TESTS
@@ -19,17 +19,18 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "sw.h"
 
-drawsurf_t  r_drawsurf;
-
-static int          sourcetstep;
-static void         *prowdestbase;
-static byte         *pbasesource;
-static int          surfrowbytes;
-static unsigned     *r_lightptr;
-static int          r_stepback;
-static int          r_lightwidth;
-static int          r_numhblocks, r_numvblocks;
-static byte         *r_source, *r_sourcemax;
+// surface building state is per thread, see D_BuildQueuedSurfaces
+q_threadlocal drawsurf_t    r_drawsurf;
+
+static q_threadlocal int        sourcetstep;
+static q_threadlocal void       *prowdestbase;
+static q_threadlocal byte       *pbasesource;
+static q_threadlocal int        surfrowbytes;
+static q_threadlocal unsigned   *r_lightptr;
+static q_threadlocal int        r_stepback;
+static q_threadlocal int        r_lightwidth;
+static q_threadlocal int        r_numhblocks, r_numvblocks;
+static q_threadlocal byte       *r_source, *r_sourcemax;
 
 static void R_DrawSurfaceBlock8_mip0(void);
 static void R_DrawSurfaceBlock8_mip1(void);
@@ -43,8 +44,27 @@ static void (*surfmiptable[4])(void) = {
     R_DrawSurfaceBlock8_mip3
 };
 
-static int          sc_size;
-static surfcache_t  *sc_rover, *sc_base;
+/*
+Surface cache blocks are allocated in size classes 1.5x or 1.33x apart.
+Each class keeps its blocks in a LRU list, most recently used first.
+Blocks used in the current frame are never evicted; if the budget is
+exhausted by a single frame, it grows up to sc_maxbudget.
+*/
+#define SC_NUMCLASSES   24
+
+static int          sc_classsize[SC_NUMCLASSES];
+static surfcache_t  sc_lru[SC_NUMCLASSES];      // list heads
+static int          sc_budget, sc_maxbudget;
+static int          sc_used, sc_numblocks;
+
+static struct {
+    unsigned    hits, misses, evictions, grows;
+    int         startframe;
+} sc_stats;
+
+static drawsurf_t   *sc_jobs;
+static int          sc_numjobs;
+static int          sc_nextjob;
 
 /*
 ===============
@@ -171,7 +191,7 @@ R_InitCaches
 */
 void R_InitCaches(void)
 {
-    int     size;
+    int     i, size;
     int     pix;
 
     // calculate size to allocate
@@ -189,29 +209,70 @@ void R_InitCaches(void)
 
     size *= TEX_BYTES;
 
-    // round up to page size
-    size = (size + 8191) & ~8191;
-
     Com_DPrintf("%ik surface cache\n", size / 1024);
 
-    sc_size = size;
-    sc_base = (surfcache_t *)R_Malloc(size);
-    sc_rover = sc_base;
+    sc_budget = size;
 
-    sc_base->next = NULL;
-    sc_base->owner = NULL;
-    sc_base->size = sc_size;
+    // explicitly sized cache never grows
+    if (sw_surfcacheoverride->integer)
+        sc_maxbudget = size;
+    else
+        sc_maxbudget = max(size, SURFCACHE_SIZE_AT_320X240 * 25 * TEX_BYTES);
+
+    for (i = 0, size = 256; i < SC_NUMCLASSES; i++) {
+        sc_classsize[i] = size;
+        size = (i & 1) ? size * 4 / 3 : size * 3 / 2;
+        sc_lru[i].next = sc_lru[i].prev = &sc_lru[i];
+    }
+
+    sc_used = 0;
+    sc_numblocks = 0;
+
+    memset(&sc_stats, 0, sizeof(sc_stats));
+    sc_stats.startframe = r_framecount;
 }
 
 void R_FreeCaches(void)
 {
-    if (sc_base) {
-        Z_Free(sc_base);
-        sc_base = NULL;
-    }
+    D_FlushCaches();
+
+    sc_budget = sc_maxbudget = 0;
+
+    Z_Free(sc_jobs);
+    sc_jobs = NULL;
+    sc_numjobs = 0;
+}
+
+static void D_SCUnlink(surfcache_t *c)
+{
+    c->prev->next = c->next;
+    c->next->prev = c->prev;
+}
+
+static void D_SCLinkHead(surfcache_t *c)
+{
+    surfcache_t *head = &sc_lru[c->sizeclass];
+
+    c->prev = head;
+    c->next = head->next;
+    head->next->prev = c;
+    head->next = c;
+}
+
+static void D_SCFree(surfcache_t *c)
+{
+    D_SCUnlink(c);
+    sc_used -= c->size;
+    sc_numblocks--;
+    Z_Free(c);
+}
 
-    sc_size = 0;
-    sc_rover = NULL;
+static void D_SCEvict(surfcache_t *c)
+{
+    D_FlushSpanJobs();  // queued spans may still use it
+    *c->owner = NULL;
+    c->owner = NULL;
+    sc_stats.evictions++;
 }
 
 /*
@@ -221,21 +282,41 @@ D_FlushCaches
 */
 void D_FlushCaches(void)
 {
-    surfcache_t     *c;
+    surfcache_t     *c, *next;
+    int             i;
 
-    if (!sc_base)
+    if (!sc_budget)
         return;
 
-    for (c = sc_base; c; c = c->next) {
-        if (c->owner) {
-            *c->owner = NULL;
+    for (i = 0; i < SC_NUMCLASSES; i++) {
+        for (c = sc_lru[i].next; c != &sc_lru[i]; c = next) {
+            next = c->next;
+            if (c->owner)
+                *c->owner = NULL;
+            Z_Free(c);
         }
+        sc_lru[i].next = sc_lru[i].prev = &sc_lru[i];
+    }
+
+    sc_used = 0;
+    sc_numblocks = 0;
+}
+
+// finds least recently used block of all classes not used this frame
+static surfcache_t *D_SCOldest(void)
+{
+    surfcache_t     *c, *best = NULL;
+    int             i;
+
+    for (i = 0; i < SC_NUMCLASSES; i++) {
+        c = sc_lru[i].prev;
+        if (c == &sc_lru[i] || c->lastframe == r_framecount)
+            continue;
+        if (!best || c->lastframe < best->lastframe)
+            best = c;
     }
 
-    sc_rover = sc_base;
-    sc_base->next = NULL;
-    sc_base->owner = NULL;
-    sc_base->size = sc_size;
+    return best;
 }
 
 /*
@@ -245,7 +326,8 @@ D_SCAlloc
 */
 static surfcache_t *D_SCAlloc(int width, int size)
 {
-    surfcache_t             *new;
+    surfcache_t     *new, *old;
+    int             sizeclass, height;
 
     if ((width < 0) || (width > 256))
         Com_Error(ERR_FATAL, "D_SCAlloc: bad cache width %d\n", width);
@@ -253,51 +335,52 @@ static surfcache_t *D_SCAlloc(int width, int size)
     if ((size <= 0) || (size > 0x10000 * TEX_BYTES))
         Com_Error(ERR_FATAL, "D_SCAlloc: bad cache size %d\n", size);
 
-    size += sizeof(surfcache_t) - 4;
-    size = (size + 3) & ~3;
-    if (size > sc_size)
-        Com_Error(ERR_FATAL, "D_SCAlloc: %i > cache size of %i", size, sc_size);
-
-// if there is not size bytes after the rover, reset to the start
-    if (!sc_rover || (byte *)sc_rover - (byte *)sc_base > sc_size - size) {
-        sc_rover = sc_base;
-    }
+    height = width > 0 ? size / width : 0;
 
-// colect and free surfcache_t blocks until the rover block is large enough
-    new = sc_rover;
-    if (sc_rover->owner)
-        *sc_rover->owner = NULL;
-
-    while (new->size < size) {
-        // free another
-        sc_rover = sc_rover->next;
-        if (!sc_rover)
-            Com_Error(ERR_FATAL, "D_SCAlloc: hit the end of memory");
-        if (sc_rover->owner)
-            *sc_rover->owner = NULL;
-
-        new->size += sc_rover->size;
-        new->next = sc_rover->next;
+    size += sizeof(surfcache_t) - 4;
+    for (sizeclass = 0; sizeclass < SC_NUMCLASSES - 1; sizeclass++)
+        if (sc_classsize[sizeclass] >= size)
+            break;
+    size = sc_classsize[sizeclass];
+
+    new = NULL;
+    if (sc_used + size > sc_budget) {
+        // reuse least recently used block of the same class
+        old = sc_lru[sizeclass].prev;
+        if (old != &sc_lru[sizeclass] && old->lastframe != r_framecount) {
+            D_SCEvict(old);
+            D_SCUnlink(old);
+            new = old;
+        } else {
+            // free least recently used blocks of other classes
+            while (sc_used + size > sc_budget && (old = D_SCOldest())) {
+                D_SCEvict(old);
+                D_SCFree(old);
+            }
+        }
     }
 
-// create a fragment out of any leftovers
-    if (new->size - size > 256) {
-        sc_rover = (surfcache_t *)((byte *)new + size);
-        sc_rover->size = new->size - size;
-        sc_rover->next = new->next;
-        sc_rover->width = 0;
-        sc_rover->owner = NULL;
-        new->next = sc_rover;
+    if (!new) {
+        // everything is in use this frame, cache is too small for the view
+        if (sc_used + size > sc_budget && sc_budget < sc_maxbudget) {
+            sc_budget = min(max(sc_budget + sc_budget / 4, sc_used + size), sc_maxbudget);
+            sc_stats.grows++;
+            Com_DPrintf("%ik surface cache\n", sc_budget / 1024);
+        }
+        new = R_Malloc(size);
         new->size = size;
-    } else
-        sc_rover = new->next;
+        new->sizeclass = sizeclass;
+        sc_used += size;
+        sc_numblocks++;
+    }
 
     new->width = width;
-// DEBUG
-    if (width > 0)
-        new->height = (size - sizeof(*new) + sizeof(new->data)) / width;
-
+    new->height = height;
     new->owner = NULL;              // should be set properly after return
+    new->lastframe = r_framecount;
+    new->buildframe = -1;
+
+    D_SCLinkHead(new);
 
     return new;
 }
@@ -306,28 +389,52 @@ static surfcache_t *D_SCAlloc(int width, int size)
 /*
 =================
 D_SCDump
+
+Reports cache usage and lookup statistics since the previous dump.
 =================
 */
 void D_SCDump_f(void)
 {
-    surfcache_t             *test;
+    surfcache_t     *c;
+    int             i, count, frames;
+    unsigned        lookups;
+
+    if (!sc_budget)
+        return;
 
-    for (test = sc_base; test; test = test->next) {
-        if (test == sc_rover)
-            Com_Printf("ROVER:\n");
-        Com_Printf("%p : %i bytes     %i width\n", test, test->size,
-                   test->width);
+    for (i = 0; i < SC_NUMCLASSES; i++) {
+        for (c = sc_lru[i].next, count = 0; c != &sc_lru[i]; c = c->next)
+            count++;
+        if (count)
+            Com_Printf("%7i bytes: %i blocks\n", sc_classsize[i], count);
     }
+
+    Com_Printf("%i blocks, %ik used, %ik budget, %ik max\n", sc_numblocks,
+               sc_used / 1024, sc_budget / 1024, sc_maxbudget / 1024);
+
+    lookups = sc_stats.hits + sc_stats.misses;
+    frames = max(r_framecount - sc_stats.startframe, 1);
+    Com_Printf("%u lookups in %i frames, %.1f%% hits, %.1f misses/frame, "
+               "%.1f evictions/frame, %u grows\n", lookups, frames,
+               lookups ? sc_stats.hits * 100.0 / lookups : 0.0,
+               (double)sc_stats.misses / frames,
+               (double)sc_stats.evictions / frames, sc_stats.grows);
+
+    memset(&sc_stats, 0, sizeof(sc_stats));
+    sc_stats.startframe = r_framecount;
 }
 
 //=============================================================================
 
 /*
 ================
-D_CacheSurface
+D_SetupSurface
+
+Finds the cached texture for the surface, allocating a new block if
+needed. Returns qtrue if the texture needs to be built from r_drawsurf.
 ================
 */
-surfcache_t *D_CacheSurface(mface_t *surface, int miplevel)
+static qboolean D_SetupSurface(mface_t *surface, int miplevel, surfcache_t **out)
 {
     surfcache_t     *cache;
     float           surfscale;
@@ -343,16 +450,28 @@ surfcache_t *D_CacheSurface(mface_t *surface, int miplevel)
 
 //
 // see if the cache holds apropriate data
+// (textures built by D_BuildQueuedSurfaces this frame include dlights)
 //
     cache = surface->cachespots[miplevel];
+    *out = cache;
 
-    if (cache && !cache->dlight && surface->dlightframe != r_framecount
+    if (cache && (cache->buildframe == r_framecount ||
+                  (!cache->dlight && surface->dlightframe != r_framecount))
         && cache->image == r_drawsurf.image
         && cache->lightadj[0] == r_drawsurf.lightadj[0]
         && cache->lightadj[1] == r_drawsurf.lightadj[1]
         && cache->lightadj[2] == r_drawsurf.lightadj[2]
-        && cache->lightadj[3] == r_drawsurf.lightadj[3])
-        return cache;
+        && cache->lightadj[3] == r_drawsurf.lightadj[3]) {
+        cache->lastframe = r_framecount;
+        D_SCUnlink(cache);
+        D_SCLinkHead(cache);
+        // already counted as a miss when it was queued
+        if (cache->buildframe != r_framecount)
+            sc_stats.hits++;
+        return qfalse;
+    }
+
+    sc_stats.misses++;
 
 //
 // determine shape of surface
@@ -372,6 +491,13 @@ surfcache_t *D_CacheSurface(mface_t *surface, int miplevel)
         surface->cachespots[miplevel] = cache;
         cache->owner = &surface->cachespots[miplevel];
         cache->mipscale = surfscale;
+        *out = cache;
+    } else {
+        // rebuilt in place, must not be reused for another surface
+        // (possibly while still queued) later this frame
+        cache->lastframe = r_framecount;
+        D_SCUnlink(cache);
+        D_SCLinkHead(cache);
     }
 
     if (surface->dlightframe == r_framecount)
@@ -387,20 +513,84 @@ surfcache_t *D_CacheSurface(mface_t *surface, int miplevel)
     cache->lightadj[2] = r_drawsurf.lightadj[2];
     cache->lightadj[3] = r_drawsurf.lightadj[3];
 
-//
-// draw and light the surface texture
-//
     r_drawsurf.surf = surface;
 
     c_surf++;
 
-    // calculate the lightings
-    R_BuildLightMap();
+    return qtrue;
+}
+
+/*
+================
+D_CacheSurface
+================
+*/
+surfcache_t *D_CacheSurface(mface_t *surface, int miplevel)
+{
+    surfcache_t     *cache;
+
+    if (D_SetupSurface(surface, miplevel, &cache)) {
+        // calculate the lightings
+        R_BuildLightMap();
 
-    // rasterize the surface into the cache
-    R_DrawSurface();
+        // rasterize the surface into the cache
+        R_DrawSurface();
+    }
 
     return cache;
 }
 
+/*
+================
+D_QueueSurface
+
+Sets up the cached texture of a world surface visible this frame, deferring
+the build to D_BuildQueuedSurfaces. Must be called with currententity set
+to the world entity.
+================
+*/
+void D_QueueSurface(mface_t *surface, int miplevel)
+{
+    surfcache_t     *cache;
+
+    // let R_BuildLightMap error out on the main thread
+    if (S_MAX(surface) * T_MAX(surface) > MAX_BLOCKLIGHTS)
+        return;
+
+    if (!D_SetupSurface(surface, miplevel, &cache))
+        return;
+
+    cache->buildframe = r_framecount;
+
+    if (!(sc_numjobs & 255))
+        sc_jobs = Z_Realloc(sc_jobs, sizeof(sc_jobs[0]) * (sc_numjobs + 256));
+    sc_jobs[sc_numjobs++] = r_drawsurf;
+}
+
+static void D_BuildSurfaceJobs(int index)
+{
+    int     i;
+
+    while ((i = q_atomic_add(&sc_nextjob, 1) - 1) < sc_numjobs) {
+        r_drawsurf = sc_jobs[i];
+        R_BuildLightMap();
+        R_DrawSurface();
+    }
+}
+
+/*
+================
+D_BuildQueuedSurfaces
+
+Builds textures of the queued surfaces on all worker threads.
+================
+*/
+void D_BuildQueuedSurfaces(void)
+{
+    if (!sc_numjobs)
+        return;
 
+    sc_nextjob = 0;
+    D_RunWorkers(D_BuildSurfaceJobs);
+    sc_numjobs = 0;
+}
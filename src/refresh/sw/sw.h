@@ -205,11 +205,14 @@ typedef struct clipplane_s {
 typedef int blocklight_t;
 
 typedef struct surfcache_s {
-    struct surfcache_s      *next;
+    struct surfcache_s      *next, *prev;   // LRU list of the size class
     struct surfcache_s      **owner;                // NULL is an empty chunk of memory
     int                     lightadj[MAX_LIGHTMAPS]; // checked for strobe flush
     int                     dlight;
     int                     size;           // including header
+    int                     sizeclass;
+    int                     lastframe;      // for LRU eviction
+    int                     buildframe;     // built by D_BuildQueuedSurfaces
     unsigned                width;
     unsigned                height;         // DEBUG only needed for debug
     float                   mipscale;
@@ -313,24 +316,26 @@ void D_WarpScreen(void);
 
 //=======================================================================//
 
-extern drawsurf_t       r_drawsurf;
+extern q_threadlocal drawsurf_t  r_drawsurf;
 
 extern int              c_surf;
 
 extern byte             r_warpbuffer[WARP_WIDTH * WARP_HEIGHT * VID_BYTES];
 
-extern float    d_sdivzstepu, d_tdivzstepu, d_zistepu;
-extern float    d_sdivzstepv, d_tdivzstepv, d_zistepv;
-extern float    d_sdivzorigin, d_tdivzorigin, d_ziorigin;
+extern q_threadlocal float  d_sdivzstepu, d_tdivzstepu, d_zistepu;
+extern q_threadlocal float  d_sdivzstepv, d_tdivzstepv, d_zistepv;
+extern q_threadlocal float  d_sdivzorigin, d_tdivzorigin, d_ziorigin;
 
-extern fixed16_t    sadjust, tadjust;
-extern fixed16_t    bbextents, bbextentt;
+extern q_threadlocal fixed16_t  sadjust, tadjust;
+extern q_threadlocal fixed16_t  bbextents, bbextentt;
 
 void D_DrawTurbulent16(espan_t *pspan, int *warptable);
 void D_DrawSpans16(espan_t *pspans);
 void D_DrawZSpans(espan_t *pspans);
 
 surfcache_t     *D_CacheSurface(mface_t *surface, int miplevel);
+void D_QueueSurface(mface_t *surface, int miplevel);
+void D_BuildQueuedSurfaces(void);
 
 extern pixel_t  *d_viewbuffer;
 extern int      d_screenrowbytes;
@@ -348,8 +353,8 @@ extern oldrefdef_t      r_refdef;
 
 //===================================================================
 
-extern int      cachewidth;
-extern pixel_t  *cacheblock;
+extern q_threadlocal int        cachewidth;
+extern q_threadlocal pixel_t    *cacheblock;
 
 extern int      r_drawnpolycount;
 
@@ -395,6 +400,8 @@ extern cvar_t   *sw_waterwarp;
 extern cvar_t   *sw_drawsird;
 extern cvar_t   *sw_dynamic;
 extern cvar_t   *sw_modulate;
+extern cvar_t   *sw_threads;
+extern cvar_t   *sw_simd;
 
 extern cvar_t   *r_fullbright;
 extern cvar_t   *r_drawentities;
@@ -463,9 +470,6 @@ extern int      c_faceclip;
 extern int      r_polycount;
 extern int      r_wholepolycount;
 
-extern fixed16_t    sadjust, tadjust;
-extern fixed16_t    bbextents, bbextentt;
-
 extern mvertex_t    *r_ptverts, *r_ptvertsmax;
 
 extern int          r_currentkey;
@@ -510,7 +514,7 @@ extern int      r_dlightframecount;
 
 extern bsp_t    *r_worldmodel;
 
-extern blocklight_t     blocklights[MAX_BLOCKLIGHTS * LIGHTMAP_BYTES];   // allow some very large lightmaps
+extern q_threadlocal blocklight_t    blocklights[MAX_BLOCKLIGHTS * LIGHTMAP_BYTES];   // allow some very large lightmaps
 
 void R_PrintAliasStats(void);
 void R_PrintTimes(void);
@@ -528,6 +532,17 @@ void R_InitCaches(void);
 void R_FreeCaches(void);
 void D_FlushCaches(void);
 void D_SCDump_f(void);
+#if USE_TESTS
+qboolean R_SimdBench(void (*func)(void *), void *arg, unsigned msec[2]);
+void D_SpanBench_f(void);
+void R_AliasBench_f(void);
+#endif
+
+void D_InitThreads(void);
+void D_ShutdownThreads(void);
+void D_ThreadsChanged(cvar_t *self);
+void D_FlushSpanJobs(void);
+void D_RunWorkers(void (*func)(int));
 
 void R_InitTurb(void);
 
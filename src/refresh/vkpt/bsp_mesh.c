@@ -17,6 +17,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "vkpt.h"
+#include "system/system.h"
 #include "shader/global_textures.h"
 
 #include <assert.h>
@@ -84,13 +85,14 @@ create_poly(
         } \
     } while(0)
 
+/* materials are stored per triangle */
 #define CP_M(idx) \
     do { \
         if(material_out) { \
-            material_out[k] = (int)(texinfo->image - r_images); \
-			if(flags & SURF_LIGHT)      material_out[k] |= BSP_FLAG_LIGHT; \
-			if(flags & SURF_WARP)       material_out[k] |= BSP_FLAG_WATER; \
-			if(flags & SURF_TRANS_MASK) material_out[k] |= BSP_FLAG_TRANSPARENT; \
+            material_out[(idx) / 3] = (int)(texinfo->image - r_images); \
+			if(flags & SURF_LIGHT)      material_out[(idx) / 3] |= BSP_FLAG_LIGHT; \
+			if(flags & SURF_WARP)       material_out[(idx) / 3] |= BSP_FLAG_WATER; \
+			if(flags & SURF_TRANS_MASK) material_out[(idx) / 3] |= BSP_FLAG_TRANSPARENT; \
         } \
     } while(0)
 
@@ -116,12 +118,10 @@ create_poly(
 
 		CP_V(k, positions + i1 * 3);
 		CP_T(k, tex_coords + i1 * 2);
-		CP_M(k);
 		k++;
 
 		CP_V(k, positions + i2 * 3);
 		CP_T(k, tex_coords + i2 * 2);
-		CP_M(k);
 		k++;
 
 	}
@@ -134,40 +134,123 @@ create_poly(
 	return k;
 }
 
-static int
-belongs_to_model(bsp_t *bsp, mface_t *surf)
+/* number of vertices create_poly() emits for surf */
+static inline int
+poly_num_vertices(const mface_t *surf)
 {
-	for (int i = 0; i < bsp->nummodels; i++) {
-		if (surf >= bsp->models[i].firstface
-		&& surf < bsp->models[i].firstface + bsp->models[i].numfaces)
-			return 1;
-	}
-	return 0;
+	int tess_center = surf->numsurfedges > 4;
+	return 3 * (tess_center ? surf->numsurfedges : surf->numsurfedges - 2);
 }
 
+/*
+ * Surfaces are extracted in two phases.  The counting pass computes the
+ * flags and vertex count of every face in parallel, then the faces of each
+ * model and skip/filter combination are laid out serially by prefix sum,
+ * keeping the order of the old serial builder.  The emission pass then
+ * triangulates all faces in parallel directly into the final arrays.
+ */
+
+#define MAX_MESH_THREADS    32
+#define MESH_BATCH_SIZE     64
+
+typedef struct {
+	int face;
+	int first_vertex;
+	int cluster;
+} mesh_emit_t;
+
+typedef struct {
+	bsp_mesh_t  *wm;
+	bsp_t       *bsp;
+	int         *face_flags;
+	int         *face_verts;
+	int         *face_model;
+	int         *face_clusters;
+	mesh_emit_t *emits;
+	int          num_emits;
+	int          num_vertices;
+} mesh_build_t;
+
+typedef struct {
+	void       (*func)(mesh_build_t *, int, int);
+	mesh_build_t *build;
+	int          count;
+	int          next;
+} mesh_work_t;
+
+/* 0 uses all cores */
+static int bsp_mesh_threads;
+
 static void
-collect_surfaces(int *idx_ctr, bsp_mesh_t *wm, bsp_t *bsp, int model_idx, int skip_mask, int filter_mask)
+mesh_worker(void *arg)
 {
-	mface_t *surfaces = model_idx < 0 ? bsp->faces : bsp->models[model_idx].firstface;
-	int num_faces = model_idx < 0 ? bsp->numfaces : bsp->models[model_idx].numfaces;
+	mesh_work_t *work = arg;
+	int start;
 
-	int *face_clusters = model_idx < 0 ? collect_light_clusters(wm, bsp) : NULL;
+	while ((start = q_atomic_add(&work->next, MESH_BATCH_SIZE) - MESH_BATCH_SIZE) < work->count)
+		work->func(work->build, start, min(start + MESH_BATCH_SIZE, work->count));
+}
 
-	for (int i = 0; i < num_faces; i++) {
-		mface_t *surf = surfaces + i;
+static void
+mesh_run_parallel(void (*func)(mesh_build_t *, int, int), mesh_build_t *build, int count)
+{
+	sys_thread_t *threads[MAX_MESH_THREADS];
+	mesh_work_t work = { func, build, count, 0 };
+	int num_threads = bsp_mesh_threads > 0 ? bsp_mesh_threads : SDL_GetCPUCount();
+
+	num_threads = min(num_threads, (count + MESH_BATCH_SIZE - 1) / MESH_BATCH_SIZE);
+	clamp(num_threads, 1, MAX_MESH_THREADS);
+
+	for (int i = 1; i < num_threads; i++)
+		threads[i] = Sys_CreateThread(mesh_worker, &work);
+	mesh_worker(&work);
+	for (int i = 1; i < num_threads; i++)
+		if (threads[i])
+			Sys_JoinThread(threads[i]);
+}
+
+static void
+count_faces(mesh_build_t *build, int start, int end)
+{
+	for (int i = start; i < end; i++) {
+		mface_t *surf = build->bsp->faces + i;
 		int flags = surf->drawflags;
 		flags |= (surf->texinfo ? surf->texinfo->c.flags : 0);
 		flags &= (surf->texinfo && surf->texinfo->radiance ? ~0 : ~SURF_LIGHT);
 
-#if 0
-		if (surf->texinfo && surf->texinfo->image && (flags & SURF_LIGHT)) {
-			int material_slot = (int)(surf->texinfo->image - r_images);
-			if (material_slot >= 0 && material_slot < MAX_MATERIALS) {
-				material_buffer.material_data[material_slot].emission = 1.0;
-				material_buffer.dirty = 1;
-			}
-		}
-#endif
+		build->face_flags[i] = flags;
+		build->face_verts[i] = poly_num_vertices(surf);
+	}
+}
+
+static void
+emit_faces(mesh_build_t *build, int start, int end)
+{
+	bsp_mesh_t *wm = build->wm;
+
+	for (int i = start; i < end; i++) {
+		const mesh_emit_t *e = &build->emits[i];
+		int v = e->first_vertex;
+		int cnt = create_poly(build->bsp->faces + e->face,
+			&wm->positions[v * 3],
+			&wm->tex_coords[v * 2],
+			&wm->materials[v / 3]);
+
+		for (int it = v / 3, k = 0; k < cnt; k += 3, ++it)
+			wm->clusters[it] = e->cluster;
+	}
+}
+
+/* lays out the faces of one pass after everything collected so far */
+static void
+collect_surfaces(mesh_build_t *build, int model_idx, int skip_mask, int filter_mask)
+{
+	bsp_t *bsp = build->bsp;
+	int first = model_idx < 0 ? 0 : bsp->models[model_idx].firstface - bsp->faces;
+	int num_faces = model_idx < 0 ? bsp->numfaces : bsp->models[model_idx].numfaces;
+
+	for (int i = first; i < first + num_faces; i++) {
+		int flags = build->face_flags[i];
 
 		if ((flags & skip_mask))
 			continue;
@@ -175,27 +258,385 @@ collect_surfaces(int *idx_ctr, bsp_mesh_t *wm, bsp_t *bsp, int model_idx, int sk
 		if (filter_mask && !(flags & filter_mask))
 			continue;
 
-		if (model_idx < 0 && belongs_to_model(bsp, surf)) {
+		if (model_idx < 0 && build->face_model[i] >= 0)
 			continue;
-		}
 
-		if (*idx_ctr + create_poly(surf, NULL, NULL, NULL) >= WM_MAX_VERTICES) {
+		if (build->num_vertices + build->face_verts[i] >= WM_MAX_VERTICES) {
 			Com_Error(ERR_FATAL, "error: exceeding max vertex limit\n");
 		}
 
-		int cnt = create_poly(surf,
-			&wm->positions[*idx_ctr * 3],
-			&wm->tex_coords[*idx_ctr * 2],
-			&wm->materials[*idx_ctr / 3]);
+		if (!(build->num_emits & 255))
+			build->emits = Z_Realloc(build->emits, sizeof(*build->emits) * (build->num_emits + 256));
+
+		mesh_emit_t *e = &build->emits[build->num_emits++];
+		e->face = i;
+		e->first_vertex = build->num_vertices;
+		e->cluster = model_idx < 0 ? build->face_clusters[i] : -1;
+
+		build->num_vertices += build->face_verts[i];
+	}
+}
+
+static void
+extract_surfaces(bsp_mesh_t *wm, bsp_t *bsp)
+{
+	mesh_build_t build;
+
+	memset(&build, 0, sizeof(build));
+	build.wm = wm;
+	build.bsp = bsp;
+	build.face_flags = Z_Malloc(bsp->numfaces * sizeof(int));
+	build.face_verts = Z_Malloc(bsp->numfaces * sizeof(int));
+	build.face_model = Z_Malloc(bsp->numfaces * sizeof(int));
+	build.face_clusters = collect_light_clusters(wm, bsp);
+
+	memset(build.face_model, -1, bsp->numfaces * sizeof(int));
+	for (int k = 0; k < bsp->nummodels; k++) {
+		int first = bsp->models[k].firstface - bsp->faces;
+		for (int i = 0; i < bsp->models[k].numfaces; i++)
+			build.face_model[first + i] = k;
+	}
+
+	mesh_run_parallel(count_faces, &build, bsp->numfaces);
+
+	const int flags_static_world = SURF_NODRAW | SURF_SKY;
+
+	collect_surfaces(&build, -1, flags_static_world, 0);
+	wm->world_idx_count = build.num_vertices;
+
+	wm->world_fluid_offset = build.num_vertices;
+	collect_surfaces(&build, -1, 0, SURF_WARP);
+	wm->world_fluid_count = build.num_vertices - wm->world_fluid_offset;
+
+	wm->world_light_offset = build.num_vertices;
+	collect_surfaces(&build, -1, flags_static_world, SURF_LIGHT);
+	wm->world_light_count = build.num_vertices - wm->world_light_offset;
+
+	for (int k = 0; k < bsp->nummodels; k++) {
+		wm->models_idx_offset[k] = build.num_vertices;
+		collect_surfaces(&build, k, flags_static_world, 0);
+		wm->models_idx_count[k] = build.num_vertices - wm->models_idx_offset[k];
+	}
+
+	mesh_run_parallel(emit_faces, &build, build.num_emits);
 
-		if(face_clusters) {
-			for (int it = *idx_ctr / 3, k = 0; k < cnt; k += 3, ++it) {
-				wm->clusters[it] = face_clusters[i];
+	wm->num_indices = build.num_vertices;
+	wm->num_vertices = build.num_vertices;
+
+	Z_Free(build.face_flags);
+	Z_Free(build.face_verts);
+	Z_Free(build.face_model);
+	Z_Free(build.face_clusters);
+	Z_Free(build.emits);
+}
+
+/*
+ * Optional welded mode (vkpt_weld_world): vertices with bit-identical
+ * position and texture coordinate are shared, both between the triangles
+ * of a face and across adjacent faces with continuous texture mapping.
+ * Triangles are then reordered for the post-transform vertex cache with
+ * Tom Forsyth's linear-speed algorithm, within each model and
+ * skip/filter range so that the range offsets stay valid, and vertices
+ * are renumbered in order of first use.
+ */
+
+#define WELD_CACHE_SIZE     32
+
+static inline uint32_t
+weld_hash(const float *p, const float *t)
+{
+	uint32_t h = 2166136261u, v[5];
+
+	memcpy(v, p, sizeof(float) * 3);
+	memcpy(v + 3, t, sizeof(float) * 2);
+	for (int i = 0; i < 5; i++) {
+		h ^= v[i];
+		h *= 16777619u;
+		h ^= h >> 15;
+	}
+	return h;
+}
+
+/* returns the number of distinct vertices, indices refer to the first occurrence */
+static int
+weld_vertices(bsp_mesh_t *wm)
+{
+	int size = 1, num_unique = 0;
+	int *table;
+
+	while (size < wm->num_indices * 2)
+		size <<= 1;
+
+	table = Z_Malloc(size * sizeof(int));
+	memset(table, -1, size * sizeof(int));
+
+	for (int i = 0; i < wm->num_indices; i++) {
+		const float *p = wm->positions + i * 3;
+		const float *t = wm->tex_coords + i * 2;
+		uint32_t h = weld_hash(p, t) & (size - 1);
+
+		for (;; h = (h + 1) & (size - 1)) {
+			int j = table[h];
+			if (j < 0) {
+				table[h] = i;
+				wm->indices[i] = i;
+				num_unique++;
+				break;
+			}
+			if (!memcmp(wm->positions + j * 3, p, sizeof(float) * 3) &&
+			    !memcmp(wm->tex_coords + j * 2, t, sizeof(float) * 2)) {
+				wm->indices[i] = j;
+				break;
 			}
 		}
+	}
+
+	Z_Free(table);
+	return num_unique;
+}
+
+static float
+forsyth_vertex_score(int cache_pos, int remaining)
+{
+	float score;
+
+	if (!remaining)
+		return -1.0f;
+
+	if (cache_pos < 0)
+		score = 0.0f;
+	else if (cache_pos < 3)
+		score = 0.75f;
+	else
+		score = powf(1.0f - (cache_pos - 3) * (1.0f / (WELD_CACHE_SIZE - 3)), 1.5f);
+
+	return score + 2.0f / sqrtf(remaining);
+}
 
-		*idx_ctr += cnt;
+/* misses per triangle of a FIFO cache, for reporting */
+static float
+vertex_cache_acmr(const int *indices, int num_indices, int *stamp)
+{
+	int misses = 0;
+
+	for (int i = 0; i < num_indices; i++) {
+		int v = indices[i];
+		if (stamp[v] < 0 || misses - stamp[v] >= WELD_CACHE_SIZE)
+			stamp[v] = misses++;
 	}
+
+	for (int i = 0; i < num_indices; i++)
+		stamp[indices[i]] = -1;
+
+	return num_indices ? misses * 3.0f / num_indices : 0;
+}
+
+/*
+ * Reorders the triangles in [first, first + count) of wm.  vmap has one
+ * entry per mesh vertex and must be all -1, it is left that way.
+ */
+static void
+forsyth_reorder(bsp_mesh_t *wm, int first, int count, int *vmap)
+{
+	int *idx = wm->indices + first * 3;
+	int num_verts = 0;
+
+	if (count < 2)
+		return;
+
+	/* local vertex numbering and triangle adjacency */
+	int *local = Z_Malloc(count * 3 * sizeof(int));
+	for (int i = 0; i < count * 3; i++) {
+		if (vmap[idx[i]] < 0)
+			vmap[idx[i]] = num_verts++;
+		local[i] = vmap[idx[i]];
+	}
+	for (int i = 0; i < count * 3; i++)
+		vmap[idx[i]] = -1;
+
+	int   *vt_offset = Z_Mallocz((num_verts + 1) * sizeof(int));
+	int   *vt_count  = Z_Mallocz(num_verts * sizeof(int));
+	int   *vt_tris   = Z_Malloc(count * 3 * sizeof(int));
+	int   *vt_cache  = Z_Malloc(num_verts * sizeof(int));
+	float *vt_score  = Z_Malloc(num_verts * sizeof(float));
+	byte  *tri_added = Z_Mallocz(count);
+	int   *order     = Z_Malloc(count * sizeof(int));
+	int    cache[WELD_CACHE_SIZE + 3], cache_size = 0;
+	int    best = -1, cursor = 0;
+
+	for (int i = 0; i < count * 3; i++)
+		vt_offset[local[i] + 1]++;
+	for (int v = 0; v < num_verts; v++)
+		vt_offset[v + 1] += vt_offset[v];
+	for (int i = 0; i < count * 3; i++) {
+		int v = local[i];
+		vt_tris[vt_offset[v] + vt_count[v]++] = i / 3;
+	}
+
+	for (int v = 0; v < num_verts; v++) {
+		vt_cache[v] = -1;
+		vt_score[v] = forsyth_vertex_score(-1, vt_count[v]);
+	}
+
+	for (int n = 0; n < count; n++) {
+		int new_cache[WELD_CACHE_SIZE + 3], new_size = 0;
+		float best_score = -1.0f;
+
+		if (best < 0) {
+			while (tri_added[cursor])
+				cursor++;
+			best = cursor;
+		}
+
+		order[n] = best;
+		tri_added[best] = 1;
+
+		/* remove the triangle from its vertices, put them in front of the cache */
+		for (int k = 0; k < 3; k++) {
+			int v = local[best * 3 + k];
+			int *tris = vt_tris + vt_offset[v];
+
+			for (int j = 0; j < vt_count[v]; j++) {
+				if (tris[j] == best) {
+					tris[j] = tris[--vt_count[v]];
+					break;
+				}
+			}
+
+			if (vt_cache[v] != -2) {
+				vt_cache[v] = -2;
+				new_cache[new_size++] = v;
+			}
+		}
+
+		for (int j = 0; j < cache_size; j++) {
+			int v = cache[j];
+			if (vt_cache[v] != -2) {
+				vt_cache[v] = -2;
+				new_cache[new_size++] = v;
+			}
+		}
+
+		/* rescore everything that was or is in the cache */
+		best = -1;
+		for (int j = 0; j < new_size; j++) {
+			int v = new_cache[j];
+
+			vt_cache[v] = j < WELD_CACHE_SIZE ? j : -1;
+			vt_score[v] = forsyth_vertex_score(vt_cache[v], vt_count[v]);
+		}
+
+		for (int j = 0; j < new_size; j++) {
+			int v = new_cache[j];
+
+			for (int i = 0; i < vt_count[v]; i++) {
+				int t = vt_tris[vt_offset[v] + i];
+				float score = vt_score[local[t * 3]] + vt_score[local[t * 3 + 1]] + vt_score[local[t * 3 + 2]];
+
+				if (score > best_score) {
+					best_score = score;
+					best = t;
+				}
+			}
+		}
+
+		cache_size = min(new_size, WELD_CACHE_SIZE);
+		memcpy(cache, new_cache, cache_size * sizeof(int));
+	}
+
+	/* apply the permutation to the indices and the per triangle data */
+	{
+		int      *idx_tmp = Z_Malloc(count * 3 * sizeof(int));
+		uint32_t *mat_tmp = Z_Malloc(count * sizeof(uint32_t));
+		int      *cl_tmp  = Z_Malloc(count * sizeof(int));
+
+		memcpy(idx_tmp, idx, count * 3 * sizeof(int));
+		memcpy(mat_tmp, wm->materials + first, count * sizeof(uint32_t));
+		memcpy(cl_tmp, wm->clusters + first, count * sizeof(int));
+
+		for (int n = 0; n < count; n++) {
+			int t = order[n];
+			memcpy(idx + n * 3, idx_tmp + t * 3, 3 * sizeof(int));
+			wm->materials[first + n] = mat_tmp[t];
+			wm->clusters[first + n] = cl_tmp[t];
+		}
+
+		Z_Free(idx_tmp);
+		Z_Free(mat_tmp);
+		Z_Free(cl_tmp);
+	}
+
+	Z_Free(local);
+	Z_Free(vt_offset);
+	Z_Free(vt_count);
+	Z_Free(vt_tris);
+	Z_Free(vt_cache);
+	Z_Free(vt_score);
+	Z_Free(tri_added);
+	Z_Free(order);
+}
+
+static void
+weld_mesh(bsp_mesh_t *wm)
+{
+	int num_ranges = 0, num_unique, num_vertices = 0;
+	int *ranges = Z_Malloc((wm->num_models + 4) * sizeof(int));
+	int *vmap = Z_Malloc(wm->num_indices * sizeof(int));
+	float acmr_before, acmr_after;
+
+	/* triangle offsets of the model and skip/filter ranges, in order */
+	ranges[num_ranges++] = 0;
+	ranges[num_ranges++] = wm->world_fluid_offset / 3;
+	ranges[num_ranges++] = wm->world_light_offset / 3;
+	for (int k = 0; k < wm->num_models; k++)
+		ranges[num_ranges++] = wm->models_idx_offset[k] / 3;
+	ranges[num_ranges++] = wm->num_indices / 3;
+
+	num_unique = weld_vertices(wm);
+
+	memset(vmap, -1, wm->num_indices * sizeof(int));
+	acmr_before = vertex_cache_acmr(wm->indices, wm->num_indices, vmap);
+
+	for (int r = 0; r < num_ranges - 1; r++)
+		forsyth_reorder(wm, ranges[r], ranges[r + 1] - ranges[r], vmap);
+
+	acmr_after = vertex_cache_acmr(wm->indices, wm->num_indices, vmap);
+
+	/* renumber the vertices in order of first use and compact them */
+	float *positions  = Z_Malloc(num_unique * 3 * sizeof(float));
+	float *tex_coords = Z_Malloc(num_unique * 2 * sizeof(float));
+
+	for (int i = 0; i < wm->num_indices; i++) {
+		int v = wm->indices[i];
+		if (vmap[v] < 0) {
+			vmap[v] = num_vertices;
+			memcpy(positions + num_vertices * 3, wm->positions + v * 3, sizeof(float) * 3);
+			memcpy(tex_coords + num_vertices * 2, wm->tex_coords + v * 2, sizeof(float) * 2);
+			num_vertices++;
+		}
+		wm->indices[i] = vmap[v];
+	}
+	assert(num_vertices == num_unique);
+
+	memcpy(wm->positions, positions, num_vertices * 3 * sizeof(float));
+	memcpy(wm->tex_coords, tex_coords, num_vertices * 2 * sizeof(float));
+	wm->num_vertices = num_vertices;
+
+	{
+		const size_t vertex_size = sizeof(float) * 5;
+		size_t before = wm->num_indices * vertex_size;
+		size_t after = num_vertices * vertex_size;
+
+		Com_Printf("%s: %d -> %d vertices, %"PRIz" -> %"PRIz" KB of vertex data, "
+			"saved %"PRIz" KB, ACMR %.3f -> %.3f\n", __func__,
+			wm->num_indices, num_vertices, before >> 10, after >> 10,
+			(before - after) >> 10, acmr_before, acmr_after);
+	}
+
+	Z_Free(positions);
+	Z_Free(tex_coords);
+	Z_Free(ranges);
+	Z_Free(vmap);
 }
 
 void
@@ -216,29 +657,9 @@ bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp)
 	wm->materials     = Z_Malloc(WM_MAX_VERTICES / 3 * sizeof(*wm->materials));
 	wm->clusters      = Z_Malloc(WM_MAX_VERTICES / 3 * sizeof(*wm->clusters));
 
-	int idx_ctr = 0;
-
-	const int flags_static_world = SURF_NODRAW | SURF_SKY;
-
-	collect_surfaces(&idx_ctr, wm, bsp, -1, flags_static_world, 0);
-	wm->world_idx_count = idx_ctr;
-
-	wm->world_fluid_offset = idx_ctr;
-	collect_surfaces(&idx_ctr, wm, bsp, -1, 0, SURF_WARP);
-	wm->world_fluid_count = idx_ctr - wm->world_fluid_offset;
+	extract_surfaces(wm, bsp);
 
-	wm->world_light_offset = idx_ctr;
-	collect_surfaces(&idx_ctr, wm, bsp, -1, flags_static_world, SURF_LIGHT);
-	wm->world_light_count = idx_ctr - wm->world_light_offset;
-
-	for (int k = 0; k < bsp->nummodels; k++) {
-		wm->models_idx_offset[k] = idx_ctr;
-		collect_surfaces(&idx_ctr, wm, bsp, k, flags_static_world, 0);
-		wm->models_idx_count[k] = idx_ctr - wm->models_idx_offset[k];
-	}
-
-	wm->num_indices = idx_ctr;
-	wm->num_vertices = idx_ctr;
+	int idx_ctr = wm->num_indices;
 
 	wm->indices = Z_Malloc(idx_ctr * sizeof(int));
 	for (int i = 0; i < wm->num_vertices; i++)
@@ -248,15 +669,19 @@ bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp)
 		Com_Error(ERR_FATAL, "too many vertices\n");
 	}
 
+	if (vkpt_weld_world->integer)
+		weld_mesh(wm);
+
 	for(int i = 0; i < wm->num_models; i++) {
 		vec3_t aabb_min = {  999999999.0f,  999999999.0f,  999999999.0f };
 		vec3_t aabb_max = { -999999999.0f, -999999999.0f, -999999999.0f };
 
 		for(int j = 0; j < wm->models_idx_count[i]; j++) {
 			vec3_t v;
-			v[0] = wm->positions[(wm->models_idx_offset[i] + j) * 3 + 0];
-			v[1] = wm->positions[(wm->models_idx_offset[i] + j) * 3 + 1];
-			v[2] = wm->positions[(wm->models_idx_offset[i] + j) * 3 + 2];
+			int idx = wm->indices[wm->models_idx_offset[i] + j];
+			v[0] = wm->positions[idx * 3 + 0];
+			v[1] = wm->positions[idx * 3 + 1];
+			v[2] = wm->positions[idx * 3 + 2];
 
 			aabb_min[0] = MIN(aabb_min[0], v[0]);
 			aabb_min[1] = MIN(aabb_min[1], v[1]);
@@ -273,7 +698,7 @@ bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp)
 	}
 
 	//FILE *f = fopen("/tmp/lights", "a+");
-	for(int i = 0; i < wm->num_indices; i++) {
+	for(int i = 0; i < wm->num_indices / 3; i++) {
 		uint32_t m = wm->materials[i];
 		m &= BSP_TEXTURE_MASK;
 
@@ -300,6 +725,10 @@ bsp_mesh_destroy(bsp_mesh_t *wm)
 	Z_Free(wm->positions);
 	Z_Free(wm->tex_coords);
 	Z_Free(wm->indices);
+	Z_Free(wm->materials);
+	Z_Free(wm->clusters);
+	Z_Free(wm->cluster_light_offsets);
+	Z_Free(wm->cluster_lights);
 
 	memset(wm, 0, sizeof(*wm));
 }
@@ -322,4 +751,115 @@ bsp_mesh_register_textures(bsp_t *bsp)
 	}
 }
 
+#if USE_TESTS
+
+/* number of triangles whose material differs between the meshes */
+static int
+material_mismatches(const bsp_mesh_t *a, const bsp_mesh_t *b)
+{
+	int count = 0;
+
+	for (int i = 0; i < a->num_vertices / 3; i++)
+		if (a->materials[i] != b->materials[i])
+			count++;
+
+	return count;
+}
+
+/* if ref is given, checks the materials of every run against it */
+static double
+extract_time(bsp_mesh_t *wm, bsp_t *bsp, int threads, int iterations,
+	const bsp_mesh_t *ref, int *mismatches)
+{
+	uint64_t start, best = UINT64_MAX;
+
+	bsp_mesh_threads = threads;
+	for (int i = 0; i < iterations; i++) {
+		start = SDL_GetPerformanceCounter();
+		extract_surfaces(wm, bsp);
+		best = min(best, SDL_GetPerformanceCounter() - start);
+
+		if (ref)
+			*mismatches += material_mismatches(ref, wm);
+	}
+	bsp_mesh_threads = 0;
+
+	return best * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+/*
+=================
+bsp_mesh_bench_f
+
+bsp_mesh_bench <map> [iterations]
+
+Times surface extraction with one thread and with all cores, and checks
+that both produce the same mesh. Materials of every parallel run are
+compared with the serial one, as races between batches may not show up
+every time.
+=================
+*/
+void
+bsp_mesh_bench_f(void)
+{
+	char bsp_path[MAX_QPATH];
+	bsp_mesh_t serial, parallel;
+	int iterations, threads, mismatches = 0;
+	double t_serial, t_parallel;
+	qboolean match;
+	qerror_t ret;
+	bsp_t *bsp;
+
+	if (Cmd_Argc() < 2) {
+		Com_Printf("Usage: %s <map> [iterations]\n", Cmd_Argv(0));
+		return;
+	}
+
+	iterations = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : 5;
+	clamp(iterations, 1, 1000);
+	threads = min(SDL_GetCPUCount(), MAX_MESH_THREADS);
+
+	Q_concat(bsp_path, sizeof(bsp_path), "maps/", Cmd_Argv(1), ".bsp", NULL);
+	ret = BSP_Load(bsp_path, &bsp);
+	if (!bsp) {
+		Com_EPrintf("Couldn't load %s: %s\n", bsp_path, Q_ErrorString(ret));
+		return;
+	}
+	bsp_mesh_register_textures(bsp);
+
+	memset(&serial, 0, sizeof(serial));
+	memset(&parallel, 0, sizeof(parallel));
+	for (int i = 0; i < 2; i++) {
+		bsp_mesh_t *wm = i ? &parallel : &serial;
+		wm->models_idx_offset = Z_Mallocz(bsp->nummodels * sizeof(int));
+		wm->models_idx_count  = Z_Mallocz(bsp->nummodels * sizeof(int));
+		wm->positions  = Z_Malloc(WM_MAX_VERTICES * 3 * sizeof(*wm->positions));
+		wm->tex_coords = Z_Malloc(WM_MAX_VERTICES * 2 * sizeof(*wm->tex_coords));
+		wm->materials  = Z_Malloc(WM_MAX_VERTICES / 3 * sizeof(*wm->materials));
+		wm->clusters   = Z_Malloc(WM_MAX_VERTICES / 3 * sizeof(*wm->clusters));
+	}
+
+	t_serial = extract_time(&serial, bsp, 1, iterations, NULL, NULL);
+	t_parallel = extract_time(&parallel, bsp, threads, iterations, &serial, &mismatches);
+
+	match = serial.num_indices == parallel.num_indices
+		&& !memcmp(serial.models_idx_offset, parallel.models_idx_offset, bsp->nummodels * sizeof(int))
+		&& !memcmp(serial.positions, parallel.positions, serial.num_vertices * 3 * sizeof(float))
+		&& !memcmp(serial.tex_coords, parallel.tex_coords, serial.num_vertices * 2 * sizeof(float))
+		&& !mismatches
+		&& !memcmp(serial.clusters, parallel.clusters, serial.num_vertices / 3 * sizeof(int));
+
+	Com_Printf("%s: %d faces, %d triangles\n", bsp_path, bsp->numfaces, serial.num_indices / 3);
+	Com_Printf("1 thread: %.2f ms, %d threads: %.2f ms, %.2fx speedup, output %s\n",
+		t_serial, threads, t_parallel, t_serial / max(t_parallel, 1e-6), match ? "identical" : "MISMATCH");
+	if (mismatches)
+		Com_Printf("%d triangle materials differ over %d parallel runs\n", mismatches, iterations);
+
+	bsp_mesh_destroy(&serial);
+	bsp_mesh_destroy(&parallel);
+	BSP_Free(bsp);
+}
+
+#endif
+
 // vim: shiftwidth=4 noexpandtab tabstop=4 cindent
@@ -0,0 +1,903 @@
+/*
+Copyright (C) 2018 Christoph Schied
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/*
+ * CPU reference tracer.
+ *
+ * Renders the static world of a bsp_mesh_t with the same direct lighting
+ * estimator as shader/light_lists.h (cluster light lists, brute force
+ * importance sampling over a strided subset of MAX_BRUTEFORCE_SAMPLING
+ * lights, solid angle sampling of the chosen triangle) plus a shadow ray.
+ * Nothing in here touches Vulkan. vkpt_reference renders the current view
+ * of the loaded world, vkpt_reference_map loads a map itself and is also
+ * registered when running with +set dedicated 1, so it works on machines
+ * without a ray tracing capable GPU. With enough spp either gives a
+ * noise-free reference.
+ *
+ * The output is the untextured lighting, matching the demodulated
+ * illumination the GPU path tracer feeds to the denoiser.
+ */
+
+#include "vkpt.h"
+#include "system/system.h"
+
+#include "include/stb_image_write.h"
+
+#define MAX_BRUTEFORCE_SAMPLING 8
+#define PHONG_IS_EXP            20.0f
+#define LIGHT_ENERGY            500.0f
+#define SHADOW_TMIN             0.01f
+
+#define BVH_MAX_LEAF            4
+#define BVH_NUM_BINS            12
+#define BVH_STACK_SIZE          64
+
+#define TILE_SIZE               16
+#define MAX_TRACE_THREADS       64
+
+#define REFERENCE_WIDTH         640
+#define REFERENCE_HEIGHT        480
+
+typedef struct {
+	float    mins[3];
+	float    maxs[3];
+	int      first; /* first triangle for leaves, left child otherwise */
+	int      count; /* 0 for interior nodes */
+} cpu_bvh_node_t;
+
+typedef struct {
+	const bsp_mesh_t *wm;
+	cpu_bvh_node_t   *nodes;
+	int              *tris;
+	int               num_nodes;
+	int               num_tris;
+} cpu_bvh_t;
+
+typedef struct {
+	const cpu_bvh_t  *bvh;
+	float            *rgb;
+	int               width, height;
+	int               spp;
+	vec3_t            origin;
+	vec3_t            forward, right, up;
+	float             tan_x, tan_y;
+	int               num_tiles_x;
+	int               num_tiles;
+	int               next_tile;
+} cpu_trace_job_t;
+
+typedef struct {
+	cpu_trace_job_t  *job;
+	sys_thread_t     *thread;
+	uint64_t          primary_rays;
+	uint64_t          shadow_rays;
+} cpu_trace_worker_t;
+
+/*
+==============================================================================
+
+BVH
+
+==============================================================================
+*/
+
+static inline const float *
+tri_vertex(const bsp_mesh_t *wm, int tri, int i)
+{
+	return wm->positions + wm->indices[tri * 3 + i] * 3;
+}
+
+static void
+bvh_bounds(cpu_bvh_t *bvh, cpu_bvh_node_t *node)
+{
+	ClearBounds(node->mins, node->maxs);
+	for (int i = 0; i < node->count; i++) {
+		int tri = bvh->tris[node->first + i];
+		for (int j = 0; j < 3; j++)
+			AddPointToBounds(tri_vertex(bvh->wm, tri, j), node->mins, node->maxs);
+	}
+}
+
+static float
+half_area(const float *mins, const float *maxs)
+{
+	float dx = maxs[0] - mins[0];
+	float dy = maxs[1] - mins[1];
+	float dz = maxs[2] - mins[2];
+	return dx * dy + dy * dz + dz * dx;
+}
+
+/* binned SAH split, returns qfalse if the node should stay a leaf */
+static qboolean
+bvh_split(cpu_bvh_t *bvh, cpu_bvh_node_t *node, const float *centroids, int *mid)
+{
+	vec3_t cmins, cmaxs;
+	float best_cost = node->count * half_area(node->mins, node->maxs);
+	int best_axis = -1, best_bin = 0;
+
+	if (node->count <= BVH_MAX_LEAF)
+		return qfalse;
+
+	ClearBounds(cmins, cmaxs);
+	for (int i = 0; i < node->count; i++)
+		AddPointToBounds(centroids + bvh->tris[node->first + i] * 3, cmins, cmaxs);
+
+	for (int axis = 0; axis < 3; axis++) {
+		struct { vec3_t mins, maxs; int count; } bins[BVH_NUM_BINS];
+		float right_area[BVH_NUM_BINS];
+		int right_count[BVH_NUM_BINS];
+		vec3_t mins, maxs;
+		float extent = cmaxs[axis] - cmins[axis];
+		float scale;
+		int count;
+
+		if (extent <= 0)
+			continue;
+
+		scale = BVH_NUM_BINS / extent;
+		for (int b = 0; b < BVH_NUM_BINS; b++) {
+			ClearBounds(bins[b].mins, bins[b].maxs);
+			bins[b].count = 0;
+		}
+
+		for (int i = 0; i < node->count; i++) {
+			int tri = bvh->tris[node->first + i];
+			int b = (int)((centroids[tri * 3 + axis] - cmins[axis]) * scale);
+			clamp(b, 0, BVH_NUM_BINS - 1);
+			bins[b].count++;
+			for (int j = 0; j < 3; j++)
+				AddPointToBounds(tri_vertex(bvh->wm, tri, j), bins[b].mins, bins[b].maxs);
+		}
+
+		ClearBounds(mins, maxs);
+		count = 0;
+		for (int b = BVH_NUM_BINS - 1; b > 0; b--) {
+			if (bins[b].count) {
+				AddPointToBounds(bins[b].mins, mins, maxs);
+				AddPointToBounds(bins[b].maxs, mins, maxs);
+			}
+			count += bins[b].count;
+			right_count[b] = count;
+			right_area[b] = count ? half_area(mins, maxs) : 0;
+		}
+
+		ClearBounds(mins, maxs);
+		count = 0;
+		for (int b = 0; b < BVH_NUM_BINS - 1; b++) {
+			float cost;
+
+			if (bins[b].count) {
+				AddPointToBounds(bins[b].mins, mins, maxs);
+				AddPointToBounds(bins[b].maxs, mins, maxs);
+			}
+			count += bins[b].count;
+			if (!count || !right_count[b + 1])
+				continue;
+
+			cost = count * half_area(mins, maxs) + right_count[b + 1] * right_area[b + 1];
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_axis = axis;
+				best_bin = b;
+			}
+		}
+	}
+
+	if (best_axis < 0)
+		return qfalse;
+
+	/* partition in place */
+	{
+		float scale = BVH_NUM_BINS / (cmaxs[best_axis] - cmins[best_axis]);
+		int *tris = bvh->tris + node->first;
+		int i = 0, j = node->count - 1;
+
+		while (i <= j) {
+			int b = (int)((centroids[tris[i] * 3 + best_axis] - cmins[best_axis]) * scale);
+			clamp(b, 0, BVH_NUM_BINS - 1);
+			if (b <= best_bin) {
+				i++;
+			} else {
+				int tmp = tris[i];
+				tris[i] = tris[j];
+				tris[j--] = tmp;
+			}
+		}
+
+		if (i == 0 || i == node->count)
+			return qfalse;
+
+		*mid = i;
+	}
+
+	return qtrue;
+}
+
+/* qbvhmp.c has its own traversal, but it is not part of either build and
+ * uses Windows threads, so the tracer builds this small binned SAH BVH */
+static void
+bvh_build(cpu_bvh_t *bvh, const bsp_mesh_t *wm)
+{
+	int num_tris = wm->world_idx_count / 3;
+	float *centroids = Z_Malloc(num_tris * 3 * sizeof(float));
+	int stack[BVH_STACK_SIZE], sp = 0;
+
+	bvh->wm = wm;
+	bvh->num_tris = num_tris;
+	bvh->tris = Z_Malloc(num_tris * sizeof(int));
+	bvh->nodes = Z_Malloc(max(2 * num_tris - 1, 1) * sizeof(cpu_bvh_node_t));
+	bvh->num_nodes = 1;
+
+	for (int i = 0; i < num_tris; i++) {
+		const float *p0 = tri_vertex(wm, i, 0);
+		const float *p1 = tri_vertex(wm, i, 1);
+		const float *p2 = tri_vertex(wm, i, 2);
+		for (int j = 0; j < 3; j++)
+			centroids[i * 3 + j] = (p0[j] + p1[j] + p2[j]) * (1.0f / 3.0f);
+		bvh->tris[i] = i;
+	}
+
+	bvh->nodes[0].first = 0;
+	bvh->nodes[0].count = num_tris;
+	bvh_bounds(bvh, &bvh->nodes[0]);
+	stack[sp++] = 0;
+
+	while (sp) {
+		cpu_bvh_node_t *node = &bvh->nodes[stack[--sp]];
+		cpu_bvh_node_t *left, *right;
+		int mid;
+
+		if (sp >= BVH_STACK_SIZE - 2 || !bvh_split(bvh, node, centroids, &mid))
+			continue;
+
+		left = &bvh->nodes[bvh->num_nodes];
+		right = left + 1;
+		left->first = node->first;
+		left->count = mid;
+		right->first = node->first + mid;
+		right->count = node->count - mid;
+		bvh_bounds(bvh, left);
+		bvh_bounds(bvh, right);
+
+		node->first = bvh->num_nodes;
+		node->count = 0;
+		stack[sp++] = bvh->num_nodes;
+		stack[sp++] = bvh->num_nodes + 1;
+		bvh->num_nodes += 2;
+	}
+
+	Z_Free(centroids);
+}
+
+static void
+bvh_destroy(cpu_bvh_t *bvh)
+{
+	Z_Free(bvh->nodes);
+	Z_Free(bvh->tris);
+	memset(bvh, 0, sizeof(*bvh));
+}
+
+static inline qboolean
+ray_box(const float *mins, const float *maxs, const vec3_t org, const vec3_t inv_dir, float tmin, float tmax)
+{
+	for (int i = 0; i < 3; i++) {
+		float t0 = (mins[i] - org[i]) * inv_dir[i];
+		float t1 = (maxs[i] - org[i]) * inv_dir[i];
+		if (t0 > t1) {
+			float tmp = t0;
+			t0 = t1;
+			t1 = tmp;
+		}
+		tmin = max(tmin, t0);
+		tmax = min(tmax, t1);
+		if (tmin > tmax)
+			return qfalse;
+	}
+	return qtrue;
+}
+
+/* Moller-Trumbore, double sided */
+static inline qboolean
+ray_triangle(const bsp_mesh_t *wm, int tri, const vec3_t org, const vec3_t dir, float tmin, float *t)
+{
+	const float *p0 = tri_vertex(wm, tri, 0);
+	const float *p1 = tri_vertex(wm, tri, 1);
+	const float *p2 = tri_vertex(wm, tri, 2);
+	vec3_t e1, e2, pv, tv, qv;
+	float det, inv_det, u, v, d;
+
+	VectorSubtract(p1, p0, e1);
+	VectorSubtract(p2, p0, e2);
+	CrossProduct(dir, e2, pv);
+	det = DotProduct(e1, pv);
+	if (fabsf(det) < 1e-12f)
+		return qfalse;
+
+	inv_det = 1.0f / det;
+	VectorSubtract(org, p0, tv);
+	u = DotProduct(tv, pv) * inv_det;
+	if (u < 0 || u > 1)
+		return qfalse;
+
+	CrossProduct(tv, e1, qv);
+	v = DotProduct(dir, qv) * inv_det;
+	if (v < 0 || u + v > 1)
+		return qfalse;
+
+	d = DotProduct(e2, qv) * inv_det;
+	if (d <= tmin || d >= *t)
+		return qfalse;
+
+	*t = d;
+	return qtrue;
+}
+
+/* closest hit if any_hit is false, otherwise returns on the first hit */
+static int
+bvh_trace(const cpu_bvh_t *bvh, const vec3_t org, const vec3_t dir, float tmin, float *tmax, qboolean any_hit)
+{
+	int stack[BVH_STACK_SIZE], sp = 0;
+	int hit = -1;
+	vec3_t inv_dir;
+
+	for (int i = 0; i < 3; i++)
+		inv_dir[i] = 1.0f / dir[i];
+
+	if (!bvh->num_tris)
+		return -1;
+
+	stack[sp++] = 0;
+	while (sp) {
+		const cpu_bvh_node_t *node = &bvh->nodes[stack[--sp]];
+
+		if (!ray_box(node->mins, node->maxs, org, inv_dir, tmin, *tmax))
+			continue;
+
+		if (node->count) {
+			for (int i = 0; i < node->count; i++) {
+				int tri = bvh->tris[node->first + i];
+				if (ray_triangle(bvh->wm, tri, org, dir, tmin, tmax)) {
+					hit = tri;
+					if (any_hit)
+						return hit;
+				}
+			}
+			continue;
+		}
+
+		/* visit the nearer child first */
+		{
+			const cpu_bvh_node_t *left = &bvh->nodes[node->first];
+			vec3_t center;
+			VectorAvg(left->mins, left->maxs, center);
+			if (DotProduct(center, dir) - DotProduct(node->mins, dir) <
+			    DotProduct(node->maxs, dir) - DotProduct(center, dir)) {
+				stack[sp++] = node->first + 1;
+				stack[sp++] = node->first;
+			} else {
+				stack[sp++] = node->first;
+				stack[sp++] = node->first + 1;
+			}
+		}
+	}
+
+	return hit;
+}
+
+/*
+==============================================================================
+
+LIGHT SAMPLING (C port of shader/light_lists.h)
+
+==============================================================================
+*/
+
+static inline float
+blinn_phong_based_brdf(const vec3_t V, const vec3_t L, const vec3_t N, float phong_exp)
+{
+	vec3_t H;
+	float F, spec;
+
+	VectorAdd(V, L, H);
+	VectorNormalize(H);
+	F = powf(1.0f - max(0.0f, DotProduct(H, V)), 5.0f);
+	spec = 0.05f + 10.25f * powf(max(0.0f, DotProduct(H, N)), phong_exp);
+	return (0.15f + (spec - 0.15f) * F) / (float)M_PI;
+}
+
+static float
+projected_tri_area(const bsp_mesh_t *wm, int tri, const vec3_t p, const vec3_t n, const vec3_t V)
+{
+	vec3_t q[3], g, e1, e2, L, a;
+
+	for (int i = 0; i < 3; i++)
+		VectorSubtract(tri_vertex(wm, tri, i), p, q[i]);
+
+	VectorSubtract(q[1], q[0], e1);
+	VectorSubtract(q[2], q[0], e2);
+	CrossProduct(e1, e2, g);
+	if (DotProduct(n, q[0]) <= 0 && DotProduct(n, q[1]) <= 0 && DotProduct(n, q[2]) <= 0)
+		return 0;
+	if (DotProduct(g, q[0]) >= 0 && DotProduct(g, q[1]) >= 0 && DotProduct(g, q[2]) >= 0)
+		return 0;
+
+	VectorAdd(q[0], q[1], L);
+	VectorAdd(L, q[2], L);
+	VectorNormalize(L);
+
+	for (int i = 0; i < 3; i++)
+		VectorNormalize(q[i]);
+
+	VectorSubtract(q[1], q[0], e1);
+	VectorSubtract(q[2], q[0], e2);
+	CrossProduct(e1, e2, a);
+	return max(-DotProduct(n, a), 0.0f) * blinn_phong_based_brdf(V, L, n, PHONG_IS_EXP);
+}
+
+static void
+sample_projected_triangle(const bsp_mesh_t *wm, int tri, const vec3_t p, float u, float v,
+                          vec3_t pos_out, vec3_t n_out, float *pdf)
+{
+	vec3_t q[3], e1, e2, n2, d, lo;
+	float sqrt_u = sqrtf(u), b[3], o, dl, lol;
+
+	VectorSubtract(tri_vertex(wm, tri, 1), tri_vertex(wm, tri, 0), e1);
+	VectorSubtract(tri_vertex(wm, tri, 2), tri_vertex(wm, tri, 0), e2);
+	CrossProduct(e1, e2, n_out);
+	VectorNormalize(n_out);
+
+	for (int i = 0; i < 3; i++)
+		VectorSubtract(tri_vertex(wm, tri, i), p, q[i]);
+
+	o = DotProduct(n_out, q[0]);
+
+	for (int i = 0; i < 3; i++)
+		VectorNormalize(q[i]);
+
+	VectorSubtract(q[1], q[0], e1);
+	VectorSubtract(q[2], q[0], e2);
+	CrossProduct(e1, e2, n2);
+
+	b[0] = 1.0f - sqrt_u;
+	b[1] = sqrt_u * (1.0f - v);
+	b[2] = sqrt_u * v;
+	for (int i = 0; i < 3; i++)
+		d[i] = q[0][i] * b[0] + q[1][i] * b[1] + q[2][i] * b[2];
+	dl = VectorLength(d);
+
+	VectorScale(d, o / DotProduct(n_out, d), lo);
+	lol = VectorLength(lo);
+
+	*pdf *= 2.0f / DotProduct(n2, d) * DotProduct(n_out, lo);
+	*pdf *= (dl * dl * dl) / (lol * lol * lol);
+	VectorAdd(p, lo, pos_out);
+}
+
+static float
+sample_light_list(const bsp_mesh_t *wm, int cluster, const vec3_t V, const vec3_t p, const vec3_t n,
+                  const float rng[3], vec3_t pos_light, vec3_t normal_light, vec3_t color)
+{
+	float light_masses[MAX_BRUTEFORCE_SAMPLING];
+	float mass = 0, partitions, fpart, pdf, x = rng[0];
+	int list_start, list_end, stride, current_idx = -1;
+	uint32_t c;
+
+	if (cluster < 0 || cluster >= wm->num_clusters)
+		return 0;
+
+	list_start = wm->cluster_light_offsets[cluster];
+	list_end   = wm->cluster_light_offsets[cluster + 1];
+	if (list_start >= list_end)
+		return 0;
+
+	partitions = ceilf((float)(list_end - list_start) / MAX_BRUTEFORCE_SAMPLING);
+	x *= partitions;
+	fpart = min(floorf(x), partitions - 1);
+	x -= fpart;
+	list_start += (int)fpart;
+	stride = (int)partitions;
+
+	for (int i = 0, n_idx = list_start; i < MAX_BRUTEFORCE_SAMPLING; i++, n_idx += stride) {
+		if (n_idx >= list_end)
+			break;
+		light_masses[i] = projected_tri_area(wm, wm->cluster_lights[n_idx], p, n, V);
+		mass += light_masses[i];
+	}
+
+	if (!(mass > 0))
+		return 0;
+
+	x *= mass;
+	mass *= partitions;
+	pdf = 0;
+
+	for (int i = 0, n_idx = list_start; i < MAX_BRUTEFORCE_SAMPLING; i++, n_idx += stride) {
+		if (n_idx >= list_end)
+			break;
+		pdf = light_masses[i];
+		current_idx = n_idx;
+		x -= pdf;
+		if (!(x > 0))
+			break;
+	}
+
+	pdf /= mass;
+
+	current_idx = wm->cluster_lights[current_idx];
+	sample_projected_triangle(wm, current_idx, p, rng[1], rng[2], pos_light, normal_light, &pdf);
+
+	c = r_images[wm->materials[current_idx] & BSP_TEXTURE_MASK].light_color;
+	color[0] = ((c >>  0) & 255) / 255.0f;
+	color[1] = ((c >>  8) & 255) / 255.0f;
+	color[2] = ((c >> 16) & 255) / 255.0f;
+
+	return pdf;
+}
+
+/*
+==============================================================================
+
+RENDERING
+
+==============================================================================
+*/
+
+static inline uint32_t
+hash_u32(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+static inline float
+rng_next(uint32_t *state)
+{
+	*state = hash_u32(*state + 0x9e3779b9);
+	return (*state >> 8) * (1.0f / 16777216.0f);
+}
+
+static void
+trace_sample(cpu_trace_worker_t *w, int x, int y, uint32_t *rng, vec3_t out)
+{
+	const cpu_trace_job_t *job = w->job;
+	const bsp_mesh_t *wm = job->bvh->wm;
+	vec3_t dir, pos, normal, V, e1, e2, L;
+	vec3_t pos_light, normal_light, color;
+	float sx, sy, t = 1e10f, pdf, dist, cos_l, geom, brdf;
+	float r[3];
+	uint32_t m;
+	int tri;
+
+	sx = (2.0f * (x + rng_next(rng)) / job->width - 1.0f) * job->tan_x;
+	sy = (1.0f - 2.0f * (y + rng_next(rng)) / job->height) * job->tan_y;
+	VectorMA(job->forward, sx, job->right, dir);
+	VectorMA(dir, sy, job->up, dir);
+	VectorNormalize(dir);
+
+	w->primary_rays++;
+	tri = bvh_trace(job->bvh, job->origin, dir, 0, &t, qfalse);
+	if (tri < 0)
+		return;
+
+	m = wm->materials[tri];
+	if (m & BSP_FLAG_LIGHT) {
+		uint32_t c = r_images[m & BSP_TEXTURE_MASK].light_color;
+		out[0] += ((c >>  0) & 255) / 255.0f;
+		out[1] += ((c >>  8) & 255) / 255.0f;
+		out[2] += ((c >> 16) & 255) / 255.0f;
+		return;
+	}
+
+	VectorMA(job->origin, t, dir, pos);
+	VectorSubtract(tri_vertex(wm, tri, 1), tri_vertex(wm, tri, 0), e1);
+	VectorSubtract(tri_vertex(wm, tri, 2), tri_vertex(wm, tri, 0), e2);
+	CrossProduct(e1, e2, normal);
+	VectorNormalize(normal);
+	if (DotProduct(dir, normal) > 0)
+		VectorInverse(normal);
+	VectorNegate(dir, V);
+
+	r[0] = rng_next(rng);
+	r[1] = rng_next(rng);
+	r[2] = rng_next(rng);
+	pdf = sample_light_list(wm, wm->clusters[tri], V, pos, normal, r, pos_light, normal_light, color);
+	if (!(pdf > 0))
+		return;
+
+	VectorSubtract(pos_light, pos, L);
+	dist = VectorNormalize(L);
+
+	cos_l = max(0.0f, -DotProduct(normal_light, L));
+	geom = max(0.0f, DotProduct(normal, L)) * cos_l * cos_l / max(0.01f, dist * dist);
+	brdf = blinn_phong_based_brdf(V, L, normal, PHONG_IS_EXP);
+	if (!(geom * brdf > 0))
+		return;
+
+	/* traced from the light towards the surface, like trace_shadow_ray */
+	w->shadow_rays++;
+	t = dist - SHADOW_TMIN;
+	VectorNegate(L, L);
+	if (bvh_trace(job->bvh, pos_light, L, SHADOW_TMIN, &t, qtrue) >= 0)
+		return;
+
+	VectorMA(out, LIGHT_ENERGY * geom * brdf / pdf, color, out);
+}
+
+static void
+trace_worker(void *arg)
+{
+	cpu_trace_worker_t *w = arg;
+	cpu_trace_job_t *job = w->job;
+	int tile;
+
+	while ((tile = q_atomic_add(&job->next_tile, 1) - 1) < job->num_tiles) {
+		int x0 = (tile % job->num_tiles_x) * TILE_SIZE;
+		int y0 = (tile / job->num_tiles_x) * TILE_SIZE;
+		int x1 = min(x0 + TILE_SIZE, job->width);
+		int y1 = min(y0 + TILE_SIZE, job->height);
+
+		for (int y = y0; y < y1; y++) {
+			for (int x = x0; x < x1; x++) {
+				float *out = job->rgb + (y * job->width + x) * 3;
+				uint32_t rng = hash_u32(y * job->width + x);
+				vec3_t sum = { 0, 0, 0 };
+
+				for (int s = 0; s < job->spp; s++)
+					trace_sample(w, x, y, &rng, sum);
+
+				VectorScale(sum, 1.0f / job->spp, out);
+			}
+		}
+	}
+}
+
+/*
+=================
+cpu_trace_frame
+
+Renders the static world of wm as seen from fd into rgb (width * height
+linear RGB floats). Returns the number of primary and shadow rays cast.
+=================
+*/
+void
+cpu_trace_frame(const bsp_mesh_t *wm, const refdef_t *fd, int width, int height,
+                int spp, int num_threads, float *rgb, uint64_t rays[2])
+{
+	cpu_trace_worker_t workers[MAX_TRACE_THREADS];
+	cpu_trace_job_t job;
+	cpu_bvh_t bvh;
+	vec3_t angles;
+
+	clamp(num_threads, 1, MAX_TRACE_THREADS);
+
+	memset(&bvh, 0, sizeof(bvh));
+	bvh_build(&bvh, wm);
+
+	memset(&job, 0, sizeof(job));
+	job.bvh = &bvh;
+	job.rgb = rgb;
+	job.width = width;
+	job.height = height;
+	job.spp = max(spp, 1);
+	VectorCopy(fd->vieworg, job.origin);
+	VectorCopy(fd->viewangles, angles);
+	AngleVectors(angles, job.forward, job.right, job.up);
+	job.tan_x = tan(fd->fov_x * M_PI / 360.0);
+	job.tan_y = tan(fd->fov_y * M_PI / 360.0);
+	job.num_tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+	job.num_tiles = job.num_tiles_x * ((height + TILE_SIZE - 1) / TILE_SIZE);
+
+	memset(workers, 0, sizeof(workers));
+	for (int i = 0; i < num_threads; i++)
+		workers[i].job = &job;
+
+	/* the calling thread works on tiles as well */
+	for (int i = 1; i < num_threads; i++)
+		workers[i].thread = Sys_CreateThread(trace_worker, &workers[i]);
+	trace_worker(&workers[0]);
+	for (int i = 1; i < num_threads; i++)
+		if (workers[i].thread)
+			Sys_JoinThread(workers[i].thread);
+
+	rays[0] = rays[1] = 0;
+	for (int i = 0; i < num_threads; i++) {
+		rays[0] += workers[i].primary_rays;
+		rays[1] += workers[i].shadow_rays;
+	}
+
+	bvh_destroy(&bvh);
+}
+
+static void
+write_func(void *context, void *data, int size)
+{
+	FS_Write(data, size, *(qhandle_t *)context);
+}
+
+static void
+write_image(const char *name, const char *ext, int width, int height, const float *rgb)
+{
+	char buffer[MAX_OSPATH];
+	qhandle_t f;
+	int ok;
+
+	f = FS_EasyOpenFile(buffer, sizeof(buffer), FS_MODE_WRITE, "screenshots/", name, ext);
+	if (!f)
+		return;
+
+	if (!strcmp(ext, ".hdr")) {
+		ok = stbi_write_hdr_to_func(write_func, &f, width, height, 3, rgb);
+	} else {
+		byte *pixels = Z_Malloc(width * height * 3);
+
+		/* Reinhard and gamma 2.2, just enough to eyeball the result */
+		for (int i = 0; i < width * height * 3; i++) {
+			float v = rgb[i] / (1.0f + rgb[i]);
+			pixels[i] = (byte)(powf(v, 1.0f / 2.2f) * 255.0f + 0.5f);
+		}
+		ok = stbi_write_png_to_func(write_func, &f, width, height, 3, pixels, width * 3);
+		Z_Free(pixels);
+	}
+
+	FS_FCloseFile(f);
+
+	if (!ok)
+		Com_EPrintf("Couldn't write %s\n", buffer);
+	else
+		Com_Printf("Wrote %s\n", buffer);
+}
+
+static void
+reference_render(const bsp_mesh_t *wm, const refdef_t *fd, int spp, int threads, const char *name)
+{
+	unsigned start, msec;
+	uint64_t rays[2];
+	float *rgb;
+
+	clamp(spp, 1, 65536);
+	clamp(threads, 1, MAX_TRACE_THREADS);
+	rgb = Z_Malloc(fd->width * fd->height * 3 * sizeof(float));
+
+	Com_Printf("Tracing %dx%d at %d spp on %d threads...\n",
+		fd->width, fd->height, spp, threads);
+
+	start = Sys_Milliseconds();
+	cpu_trace_frame(wm, fd, fd->width, fd->height, spp, threads, rgb, rays);
+	msec = max(Sys_Milliseconds() - start, 1);
+
+	Com_Printf("%u ms, %llu primary + %llu shadow rays, %.2f Mrays/s\n", msec,
+		(unsigned long long)rays[0], (unsigned long long)rays[1],
+		(rays[0] + rays[1]) / (msec * 1000.0));
+
+	write_image(name, ".png", fd->width, fd->height, rgb);
+	write_image(name, ".hdr", fd->width, fd->height, rgb);
+
+	Z_Free(rgb);
+}
+
+/*
+=================
+vkpt_reference_f
+
+vkpt_reference [spp] [threads] [name]
+=================
+*/
+void
+vkpt_reference_f(void)
+{
+	const char *name = Cmd_Argc() > 3 ? Cmd_Argv(3) : "reference";
+	int spp = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 16;
+	int threads = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : SDL_GetCPUCount();
+	refdef_t *fd = vkpt_refdef.fd;
+
+	if (!vkpt_refdef.bsp_mesh_world_loaded || !fd) {
+		Com_Printf("No map loaded.\n");
+		return;
+	}
+
+	if (fd->width < 1 || fd->height < 1)
+		return;
+
+	reference_render(&vkpt_refdef.bsp_mesh_world, fd, spp, threads, name);
+}
+
+/*
+=================
+vkpt_reference_map_f
+
+vkpt_reference_map <map> <x> <y> <z> <pitch> <yaw> [fov] [spp] [threads] [name]
+
+Loads the map into its own image table and bsp_mesh_t and renders a
+REFERENCE_WIDTH x REFERENCE_HEIGHT view from the given camera. Only
+registered while the renderer is down, see R_InitReferenceTracer.
+=================
+*/
+static void
+vkpt_reference_map_f(void)
+{
+	char bsp_path[MAX_QPATH];
+	const char *name = Cmd_Argc() > 10 ? Cmd_Argv(10) : "reference";
+	int spp = Cmd_Argc() > 8 ? atoi(Cmd_Argv(8)) : 16;
+	int threads = Cmd_Argc() > 9 ? atoi(Cmd_Argv(9)) : SDL_GetCPUCount();
+	bsp_mesh_t wm;
+	refdef_t fd;
+	qerror_t ret;
+	bsp_t *bsp;
+
+	if (Cmd_Argc() < 7) {
+		Com_Printf("Usage: %s <map> <x> <y> <z> <pitch> <yaw> [fov] [spp] [threads] [name]\n", Cmd_Argv(0));
+		return;
+	}
+
+	memset(&fd, 0, sizeof(fd));
+	fd.width = REFERENCE_WIDTH;
+	fd.height = REFERENCE_HEIGHT;
+	for (int i = 0; i < 3; i++)
+		fd.vieworg[i] = atof(Cmd_Argv(2 + i));
+	fd.viewangles[PITCH] = atof(Cmd_Argv(5));
+	fd.viewangles[YAW] = atof(Cmd_Argv(6));
+	fd.fov_x = Cmd_Argc() > 7 ? atof(Cmd_Argv(7)) : 90;
+	clamp(fd.fov_x, 1, 179);
+	fd.fov_y = atan(tan(fd.fov_x * M_PI / 360.0) * fd.height / fd.width) * 360.0 / M_PI;
+
+	Q_concat(bsp_path, sizeof(bsp_path), "maps/", Cmd_Argv(1), ".bsp", NULL);
+	ret = BSP_Load(bsp_path, &bsp);
+	if (!bsp) {
+		Com_EPrintf("Couldn't load %s: %s\n", bsp_path, Q_ErrorString(ret));
+		return;
+	}
+
+	IMG_Init();
+	IMG_GetPalette();
+
+	bsp_mesh_register_textures(bsp);
+	memset(&wm, 0, sizeof(wm));
+	bsp_mesh_create_from_bsp(&wm, bsp);
+
+	Com_Printf("%s: %d triangles, %d light triangles\n", bsp_path,
+		wm.world_idx_count / 3, wm.world_light_count / 3);
+
+	reference_render(&wm, &fd, spp, threads, name);
+
+	bsp_mesh_destroy(&wm);
+	BSP_Free(bsp);
+	IMG_Shutdown();
+}
+
+/*
+=================
+R_InitReferenceTracer
+
+Makes vkpt_reference_map available without R_Init, e.g. when running
+with +set dedicated 1 where no window or Vulkan device is created.
+=================
+*/
+void
+R_InitReferenceTracer(void)
+{
+	/* normally registered by R_Init, read by bsp_mesh_create_from_bsp */
+	vkpt_weld_world = Cvar_Get("vkpt_weld_world", "0", 0);
+
+	Cmd_AddCommand("vkpt_reference_map", &vkpt_reference_map_f);
+}
+
+// vim: shiftwidth=4 noexpandtab tabstop=4 cindent
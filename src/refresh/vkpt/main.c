@@ -46,6 +46,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 cvar_t *vkpt_reconstruction;
 cvar_t *cvar_rtx;
 cvar_t *vkpt_profiler;
+cvar_t *vkpt_weld_world;
 
 static bsp_t *bsp_world_model;
 
@@ -888,12 +889,14 @@ upload_entity_transforms(uint32_t *num_instances, uint32_t *num_vertices)
 	QVKUniformBuffer_t *ubo = &vkpt_refdef.uniform_buffer;
 	ubo->num_lights = 0;
 	ubo->num_instances_model_bsp = 0;
+	/* only the instances of the last frame can be referenced through the
+	 * current_to_prev maps, leave the rest alone so it is not re-uploaded */
 	memcpy(ubo->bsp_mesh_instances_prev,
 			ubo->bsp_mesh_instances,
-			sizeof(ubo->bsp_mesh_instances_prev));
+			sizeof(ubo->bsp_mesh_instances[0]) * world_entity_id_count[!entity_frame_num]);
 	memcpy(ubo->model_instances_prev,
 			ubo->model_instances,
-			sizeof(ubo->model_instances_prev));
+			sizeof(ubo->model_instances[0]) * model_entity_id_count[!entity_frame_num]);
 	int model_instance_idx = 0;
 	int bsp_mesh_idx = 0;
 	int num_instanced_vert = 0; /* need to track this here to find lights */
@@ -963,8 +966,8 @@ upload_entity_transforms(uint32_t *num_instances, uint32_t *num_vertices)
 
 			ModelInstance_t *mi = &vkpt_refdef.uniform_buffer.model_instances[model_instance_idx];
 			memcpy(mi->M, M, sizeof(float) * 16);
-			mi->offset_curr = mesh->vertex_offset + e->frame    * mesh->numverts;
-			mi->offset_prev = mesh->vertex_offset + e->oldframe * mesh->numverts;
+			mi->offset_curr = mesh->frame_offset + e->frame;
+			mi->offset_prev = mesh->frame_offset + e->oldframe;
 			mi->backlerp  = e->backlerp;
 			mi->material  = img ? (int)(img - r_images) : ~0;
 			mi->material |= get_model_flags(model->name);
@@ -998,10 +1001,20 @@ upload_entity_transforms(uint32_t *num_instances, uint32_t *num_vertices)
 	/* anchor for last element */
 	ubo->instance_buf_offset[instance_idx / 4][instance_idx % 4] = num_instanced_vert / 3;
 
-	memset(ubo->world_current_to_prev, ~0u, sizeof(ubo->world_current_to_prev));
-	memset(ubo->world_prev_to_current, ~0u, sizeof(ubo->world_prev_to_current));
-	memset(ubo->model_current_to_prev, ~0u, sizeof(ubo->model_current_to_prev));
-	memset(ubo->model_prev_to_current, ~0u, sizeof(ubo->model_prev_to_current));
+	/* clear what the last two frames may have written and what this one
+	 * will read, the tail beyond is already ~0 */
+	static qboolean maps_cleared;
+	int world_map_cnt = max(max(world_entity_id_count[0], world_entity_id_count[1]), bsp_mesh_idx);
+	int model_map_cnt = max(max(model_entity_id_count[0], model_entity_id_count[1]), model_instance_idx);
+	if(!maps_cleared) {
+		world_map_cnt = SHADER_MAX_BSP_ENTITIES;
+		model_map_cnt = SHADER_MAX_ENTITIES;
+		maps_cleared = qtrue;
+	}
+	memset(ubo->world_current_to_prev, ~0u, sizeof(uint32_t) * world_map_cnt);
+	memset(ubo->world_prev_to_current, ~0u, sizeof(uint32_t) * world_map_cnt);
+	memset(ubo->model_current_to_prev, ~0u, sizeof(uint32_t) * model_map_cnt);
+	memset(ubo->model_prev_to_current, ~0u, sizeof(uint32_t) * model_map_cnt);
 
 	world_entity_id_count[entity_frame_num] = bsp_mesh_idx;
 	uint32_t *world_current_to_prev = &ubo->world_current_to_prev[0][0];
@@ -1080,7 +1093,7 @@ update_lights()
 					ent_is_light |= 1;
 					for(int k = 0; k < 3; k++) {
 						float tmp[4];
-						memcpy(tmp, bsp->positions + (idx_off + j * 3 + k) * 3, 3 * sizeof(float));
+						memcpy(tmp, bsp->positions + bsp->indices[idx_off + j * 3 + k] * 3, 3 * sizeof(float));
 						tmp[3] = 1.0;
 						mult_matrix_vector(light_pos, M, tmp);
 						light_pos += 3;
@@ -1117,14 +1130,16 @@ update_lights()
 			for(int j = 0; j < idx_cnt; j++) {
 				int idx = mesh->indices[j];
 
-				float pos[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
-				pos[0] += mesh->positions[idx + vert_off_curr][0] * (1.0f - backlerp);
-				pos[1] += mesh->positions[idx + vert_off_curr][1] * (1.0f - backlerp);
-				pos[2] += mesh->positions[idx + vert_off_curr][2] * (1.0f - backlerp);
+				const maliasframe_t *f_curr = &model->frames[e->frame];
+				const maliasframe_t *f_prev = &model->frames[e->oldframe];
+				const maliasvert_t *v_curr = &mesh->verts[idx + vert_off_curr];
+				const maliasvert_t *v_prev = &mesh->verts[idx + vert_off_prev];
 
-				pos[0] += mesh->positions[idx + vert_off_prev][0] * (backlerp);
-				pos[1] += mesh->positions[idx + vert_off_prev][1] * (backlerp);
-				pos[2] += mesh->positions[idx + vert_off_prev][2] * (backlerp);
+				float pos[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+				for(int k = 0; k < 3; k++) {
+					pos[k] += ((int16_t)v_curr->pos[k] * f_curr->scale[k] + f_curr->translate[k]) * (1.0f - backlerp);
+					pos[k] += ((int16_t)v_prev->pos[k] * f_prev->scale[k] + f_prev->translate[k]) * (backlerp);
+				}
 
 				mult_matrix_vector(light_pos, M, pos);
 				light_pos += 3;
@@ -1457,6 +1472,7 @@ R_Init(qboolean total)
 	vkpt_profiler       = Cvar_Get("vkpt_profiler",       "0",    0);
 	vkpt_reconstruction = Cvar_Get("vkpt_reconstruction", "1",    0);
 	cvar_rtx            = Cvar_Get("rtx",                 "off",  0);
+	vkpt_weld_world     = Cvar_Get("vkpt_weld_world",     "0",    0);
 
 	qvk.win_width  = r_config.width;
 	qvk.win_height = r_config.height;
@@ -1493,6 +1509,12 @@ R_Init(qboolean total)
 	_VK(vkpt_initialize_all(VKPT_INIT_DEFAULT));
 
 	Cmd_AddCommand("reload_shader", (xcommand_t)&vkpt_reload_shader);
+	Cmd_AddCommand("vkpt_reference", &vkpt_reference_f);
+#if USE_TESTS
+	Cmd_AddCommand("bsp_mesh_bench", &bsp_mesh_bench_f);
+	Cmd_AddCommand("vkpt_ubo_test", &vkpt_ubo_test_f);
+	Cmd_AddCommand("vkpt_model_test", &vkpt_model_test_f);
+#endif
 
 	return qtrue;
 }
@@ -1601,7 +1623,9 @@ R_BeginRegistration(const char *name)
 
 	_VK(vkpt_pt_destroy_static());
 	const bsp_mesh_t *m = &vkpt_refdef.bsp_mesh_world;
-	_VK(vkpt_pt_create_static(qvk.buf_vertex.buffer, offsetof(VertexBuffer, positions_bsp), m->world_idx_count));
+	_VK(vkpt_pt_create_static(qvk.buf_vertex.buffer,
+		offsetof(VertexBuffer, positions_bsp), m->num_vertices,
+		offsetof(VertexBuffer, idx_bsp), m->world_idx_count));
 
 	{
 		int num_prims = 0;
@@ -51,6 +51,146 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #error TESS_MAX_INDICES
 #endif
 
+/*
+ * Compact model vertices.  Positions are kept as 16 bit integers relative
+ * to the per-frame scale and translate, like the MD2 and MD3 native
+ * encodings, so decoding reproduces the float path exactly.  Normals are
+ * octahedral encoded with 8 bits per component and texture coordinates
+ * are half floats stored once per mesh vertex instead of once per frame.
+ */
+
+static uint16_t
+vkpt_float_to_half(float f)
+{
+	uint32_t x, sign, mant, h;
+	int exp;
+
+	memcpy(&x, &f, sizeof(x));
+	sign = (x >> 16) & 0x8000;
+	exp = (int)((x >> 23) & 0xff) - 127 + 15;
+	mant = x & 0x7fffff;
+
+	if (exp <= 0) {
+		if (exp < -10)
+			return sign;
+		mant |= 0x800000;
+		h = mant >> (14 - exp);
+		if ((mant >> (13 - exp)) & 1)
+			h++;
+		return sign | h;
+	}
+
+	if (exp >= 31)
+		return sign | 0x7c00;
+
+	h = sign | (exp << 10) | (mant >> 13);
+	if (mant & 0x1000)
+		h++;
+	return h;
+}
+
+static float
+vkpt_half_to_float(uint16_t h)
+{
+	uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	uint32_t exp = (h >> 10) & 0x1f;
+	uint32_t mant = h & 0x3ff;
+	uint32_t x;
+	float f;
+
+	if (!exp) {
+		f = ldexpf((float)mant, -24);
+		return sign ? -f : f;
+	}
+
+	if (exp == 31)
+		x = sign | 0x7f800000 | (mant << 13);
+	else
+		x = sign | ((exp + 112) << 23) | (mant << 13);
+
+	memcpy(&f, &x, sizeof(f));
+	return f;
+}
+
+static void
+vkpt_decode_normal(uint16_t v, vec3_t n)
+{
+	float x = (v & 255) * (2.0f / 255.0f) - 1.0f;
+	float y = (v >> 8) * (2.0f / 255.0f) - 1.0f;
+
+	n[0] = x;
+	n[1] = y;
+	n[2] = 1.0f - fabsf(x) - fabsf(y);
+	if (n[2] < 0) {
+		n[0] = (1.0f - fabsf(y)) * (x >= 0 ? 1.0f : -1.0f);
+		n[1] = (1.0f - fabsf(x)) * (y >= 0 ? 1.0f : -1.0f);
+	}
+	VectorNormalize(n);
+}
+
+/* picks the best of the four surrounding grid points */
+static uint16_t
+vkpt_encode_normal(const vec3_t n)
+{
+	float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+	float x, y, best_dot = -2.0f;
+	uint16_t best = 0;
+
+	if (l1 <= 0)
+		return 127 | (127 << 8);
+
+	x = n[0] / l1;
+	y = n[1] / l1;
+	if (n[2] < 0) {
+		float t = (1.0f - fabsf(y)) * (x >= 0 ? 1.0f : -1.0f);
+		y = (1.0f - fabsf(x)) * (y >= 0 ? 1.0f : -1.0f);
+		x = t;
+	}
+
+	x = (x * 0.5f + 0.5f) * 255.0f;
+	y = (y * 0.5f + 0.5f) * 255.0f;
+
+	for (int i = 0; i < 4; i++) {
+		int ux = (int)x + (i & 1);
+		int uy = (int)y + (i >> 1);
+		uint16_t v;
+		vec3_t d;
+		float dot;
+
+		clamp(ux, 0, 255);
+		clamp(uy, 0, 255);
+		v = ux | (uy << 8);
+		vkpt_decode_normal(v, d);
+		dot = DotProduct(d, n);
+		if (dot > best_dot) {
+			best_dot = dot;
+			best = v;
+		}
+	}
+
+	return best;
+}
+
+/* tracks the worst normal (radians) and texcoord error against the float path */
+static void
+check_vertex(uint16_t norm, uint32_t tc, const vec3_t normal, const vec2_t st, float max_err[2])
+{
+	float len = VectorLength(normal);
+	vec3_t n;
+
+	if (len > 0) {
+		float d;
+
+		vkpt_decode_normal(norm, n);
+		d = DotProduct(n, normal) / len;
+		clamp(d, -1.0f, 1.0f);
+		max_err[0] = max(max_err[0], acosf(d));
+	}
+
+	max_err[1] = max(max_err[1], fabsf(vkpt_half_to_float(tc & 0xffff) - st[0]));
+	max_err[1] = max(max_err[1], fabsf(vkpt_half_to_float(tc >> 16) - st[1]));
+}
+
 qerror_t MOD_LoadMD2(model_t *model, const void *rawdata, size_t length)
 {
 	dmd2header_t    header;
@@ -70,6 +210,7 @@ qerror_t MOD_LoadMD2(model_t *model, const void *rawdata, size_t length)
 	char            skinname[MAX_QPATH];
 	vec_t           scale_s, scale_t;
 	vec3_t          mins, maxs;
+	float           max_err[2] = { 0.0f, 0.0f };
 	qerror_t        ret;
 
 	if (length < sizeof(header)) {
@@ -161,9 +302,8 @@ qerror_t MOD_LoadMD2(model_t *model, const void *rawdata, size_t length)
 	dst_mesh->numindices = numindices;
 	dst_mesh->numverts   = numverts;
 	dst_mesh->numskins   = header.num_skins;
-	dst_mesh->positions  = MOD_Malloc(numverts   * header.num_frames * sizeof(vec3_t));
-	dst_mesh->normals    = MOD_Malloc(numverts   * header.num_frames * sizeof(vec3_t));
-	dst_mesh->tex_coords = MOD_Malloc(numverts   * header.num_frames * sizeof(vec2_t));
+	dst_mesh->verts      = MOD_Malloc(numverts   * header.num_frames * sizeof(maliasvert_t));
+	dst_mesh->tex_coords = MOD_Malloc(numverts   * sizeof(uint32_t));
 	dst_mesh->indices    = MOD_Malloc(numindices * sizeof(int));
 
 	if (dst_mesh->numtris != header.num_tris) {
@@ -206,30 +346,29 @@ qerror_t MOD_LoadMD2(model_t *model, const void *rawdata, size_t length)
 				continue;
 			}
 			src_vert = &src_frame->verts[vertIndices[i]];
-			vec3_t *dst_pos = &dst_mesh->positions [j * numverts + finalIndices[i]];
-			vec3_t *dst_nrm = &dst_mesh->normals   [j * numverts + finalIndices[i]];
-			vec2_t *dst_tc  = &dst_mesh->tex_coords[j * numverts + finalIndices[i]];
+			maliasvert_t *dst_vert = &dst_mesh->verts[j * numverts + finalIndices[i]];
+			uint32_t *dst_tc = &dst_mesh->tex_coords[finalIndices[i]];
+			vec3_t normal = { 0.0f, 0.0f, 0.0f };
+			vec2_t st;
 
-			(*dst_tc)[0] = scale_s * src_tc[tcIndices[i]].s;
-			(*dst_tc)[1] = scale_t * src_tc[tcIndices[i]].t;
+			st[0] = scale_s * src_tc[tcIndices[i]].s;
+			st[1] = scale_t * src_tc[tcIndices[i]].t;
+			*dst_tc = vkpt_float_to_half(st[0]) | (vkpt_float_to_half(st[1]) << 16);
 
-			(*dst_pos)[0] = src_vert->v[0] * dst_frame->scale[0] + dst_frame->translate[0];
-			(*dst_pos)[1] = src_vert->v[1] * dst_frame->scale[1] + dst_frame->translate[1];
-			(*dst_pos)[2] = src_vert->v[2] * dst_frame->scale[2] + dst_frame->translate[2];
-
-			(*dst_nrm)[0] = 0.0f;
-			(*dst_nrm)[1] = 0.0f;
-			(*dst_nrm)[2] = 0.0f;
+			dst_vert->pos[0] = src_vert->v[0];
+			dst_vert->pos[1] = src_vert->v[1];
+			dst_vert->pos[2] = src_vert->v[2];
 
 			val = src_vert->lightnormalindex;
 			if (val < NUMVERTEXNORMALS) {
-				(*dst_nrm)[0] = bytedirs[val][0];
-				(*dst_nrm)[1] = bytedirs[val][1];
-				(*dst_nrm)[2] = bytedirs[val][2];
+				VectorCopy(bytedirs[val], normal);
 			}
+			dst_vert->norm = vkpt_encode_normal(normal);
+
+			check_vertex(dst_vert->norm, *dst_tc, normal, st, max_err);
 
 			for (int k = 0; k < 3; k++) {
-				val = (*dst_pos)[k];
+				val = src_vert->v[k];
 				if (val < mins[k])
 					mins[k] = val;
 				if (val > maxs[k])
@@ -249,6 +388,9 @@ qerror_t MOD_LoadMD2(model_t *model, const void *rawdata, size_t length)
 		dst_frame++;
 	}
 
+	Com_DPrintf("%s: max normal error %.2f deg, max texcoord error %g\n",
+			model->name, RAD2DEG(max_err[0]), max_err[1]);
+
 	// fix winding order
 	for (int i = 0; i < dst_mesh->numindices; i += 3) {
 		int tmp = dst_mesh->indices[i + 1];
@@ -275,8 +417,8 @@ static qerror_t MOD_LoadMD3Mesh(model_t *model, maliasmesh_t *mesh,
 	dmd3skin_t      *src_skin;
 	uint32_t        *src_idx;
 	maliasvert_t    *dst_vert;
-	maliastc_t      *dst_tc;
-	int  *dst_idx;
+	uint32_t        *dst_tc;
+	int             *dst_idx;
 	uint32_t        index;
 	char            skinname[MAX_QPATH];
 	int             i;
@@ -319,7 +461,7 @@ static qerror_t MOD_LoadMD3Mesh(model_t *model, maliasmesh_t *mesh,
 	mesh->numverts = header.num_verts;
 	mesh->numskins = header.num_skins;
 	mesh->verts = MOD_Malloc(sizeof(maliasvert_t) * header.num_verts * model->numframes);
-	mesh->tcoords = MOD_Malloc(sizeof(maliastc_t) * header.num_verts);
+	mesh->tex_coords = MOD_Malloc(sizeof(uint32_t) * header.num_verts);
 	mesh->indices = MOD_Malloc(sizeof(int) * header.num_tris * 3);
 
 	// load all skins
@@ -339,23 +481,28 @@ static qerror_t MOD_LoadMD3Mesh(model_t *model, maliasmesh_t *mesh,
 		dst_vert->pos[1] = (int16_t)LittleShort(src_vert->point[1]);
 		dst_vert->pos[2] = (int16_t)LittleShort(src_vert->point[2]);
 
-		dst_vert->norm[0] = src_vert->norm[0];
-		dst_vert->norm[1] = src_vert->norm[1];
-		assert(!"need to convert from latlong to cartesian");
+		// unpack the latitude/longitude normal and re-encode it
+		float lat = src_vert->norm[0] * (2 * M_PI / 255.0f);
+		float lng = src_vert->norm[1] * (2 * M_PI / 255.0f);
+		vec3_t normal;
+		normal[0] = sinf(lat) * cosf(lng);
+		normal[1] = sinf(lat) * sinf(lng);
+		normal[2] = cosf(lat);
+		dst_vert->norm = vkpt_encode_normal(normal);
 
 		src_vert++; dst_vert++;
 	}
 
 	// load all texture coords
 	src_tc = (dmd3coord_t *)(rawdata + header.ofs_tcs);
-	dst_tc = mesh->tcoords;
+	dst_tc = mesh->tex_coords;
 	for (i = 0; i < header.num_verts; i++) {
-		dst_tc->st[0] = LittleFloat(src_tc->st[0]);
-		dst_tc->st[1] = LittleFloat(src_tc->st[1]);
+		*dst_tc = vkpt_float_to_half(LittleFloat(src_tc->st[0])) |
+			(vkpt_float_to_half(LittleFloat(src_tc->st[1])) << 16);
 		src_tc++; dst_tc++;
 	}
 
-	// load all triangle indices
+	// load all triangle indices, fixing the winding order like MD2
 	src_idx = (uint32_t *)(rawdata + header.ofs_indexes);
 	dst_idx = mesh->indices;
 	for (i = 0; i < header.num_tris * 3; i++) {
@@ -364,6 +511,11 @@ static qerror_t MOD_LoadMD3Mesh(model_t *model, maliasmesh_t *mesh,
 			return Q_ERR_BAD_INDEX;
 		*dst_idx++ = index;
 	}
+	for (i = 0; i < mesh->numindices; i += 3) {
+		int tmp = mesh->indices[i + 1];
+		mesh->indices[i + 1] = mesh->indices[i + 2];
+		mesh->indices[i + 2] = tmp;
+	}
 
 	*offset_p = header.meshsize;
 	return Q_ERR_SUCCESS;
@@ -474,4 +626,86 @@ void MOD_Reference(model_t *model)
 	model->registration_sequence = registration_sequence;
 }
 
+#if USE_TESTS
+
+/* worst angle between a unit vector and its encoded normal, in degrees */
+#define NORMAL_MAX_ERROR    0.65f
+
+static uint32_t
+test_rand(uint32_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+/* checks the vertex encodings used for alias models, no device needed */
+void
+vkpt_model_test_f(void)
+{
+	static const vec3_t axes[6] = {
+		{ 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }
+	};
+	uint32_t state = 0x12345678;
+	int count = 1000000, errors = 0, i;
+	float max_err = 0, max_rel = 0;
+	vec3_t n, d;
+
+	/* random directions, uniform on the sphere */
+	for (i = 0; i < count + 6; i++) {
+		float err;
+
+		if (i < 6) {
+			VectorCopy(axes[i], n);
+		} else {
+			float z = (test_rand(&state) & 0xffffff) * (2.0f / 0xffffff) - 1.0f;
+			float a = (test_rand(&state) & 0xffffff) * (2.0f * M_PI / 0xffffff);
+			float r = sqrtf(max(1.0f - z * z, 0.0f));
+			VectorSet(n, r * cosf(a), r * sinf(a), z);
+		}
+
+		vkpt_decode_normal(vkpt_encode_normal(n), d);
+		err = DotProduct(n, d) / VectorLength(n);
+		clamp(err, -1.0f, 1.0f);
+		err = RAD2DEG(acosf(err));
+		if (err > NORMAL_MAX_ERROR) {
+			if (errors++ < 10)
+				Com_Printf("normal (%f %f %f): error %.3f degrees\n", n[0], n[1], n[2], err);
+		}
+		max_err = max(max_err, err);
+	}
+
+	/* every finite half converts to float and back unchanged */
+	for (i = 0; i < 0x10000; i++) {
+		uint16_t h = i;
+
+		if ((h & 0x7c00) == 0x7c00)
+			continue;
+		if (vkpt_float_to_half(vkpt_half_to_float(h)) != h) {
+			if (errors++ < 10)
+				Com_Printf("half %#06x does not round trip\n", h);
+		}
+	}
+
+	/* texture coordinates round to within half a unit in the last place */
+	for (i = 0; i < count; i++) {
+		float f = (int32_t)test_rand(&state) * (8.0f / 0x80000000u);
+		float g = vkpt_half_to_float(vkpt_float_to_half(f));
+		float rel = fabsf(f) >= 6.103515625e-05f ? fabsf(g - f) / fabsf(f) : 0;
+
+		if (rel > 1.0f / 2048 || !signbit(f) != !signbit(g)) {
+			if (errors++ < 10)
+				Com_Printf("%f converts to %f\n", f, g);
+		}
+		max_rel = max(max_rel, rel);
+	}
+
+	Com_Printf("%d normals, max error %.3f degrees (limit %.2f), "
+		"half max relative error %g, %d errors\n",
+		count + 6, max_err, NORMAL_MAX_ERROR, max_rel, errors);
+}
+
+#endif
+
 // vim: shiftwidth=4 noexpandtab tabstop=4 cindent
@@ -230,6 +230,18 @@ get_geometry(VkBuffer buffer, size_t offset, uint32_t num_vertices)
 	return geometry;
 }
 
+static inline VkGeometryNV
+get_geometry_indexed(VkBuffer buffer, size_t vertex_offset, uint32_t num_vertices,
+		size_t index_offset, uint32_t num_indices)
+{
+	VkGeometryNV geometry = get_geometry(buffer, vertex_offset, num_vertices);
+	geometry.geometry.triangles.indexData   = buffer;
+	geometry.geometry.triangles.indexOffset = index_offset;
+	geometry.geometry.triangles.indexCount  = num_indices;
+	geometry.geometry.triangles.indexType   = VK_INDEX_TYPE_UINT32;
+	return geometry;
+}
+
 VkResult
 vkpt_pt_destroy_static()
 {
@@ -260,9 +272,7 @@ vkpt_pt_destroy_dynamic(int idx)
 
 static VkResult
 vkpt_pt_create_accel_bottom(
-		VkBuffer vertex_buffer,
-		size_t buffer_offset,
-		int num_vertices,
+		VkGeometryNV geometry,
 		VkAccelerationStructureNV *accel,
 		VkDeviceMemory *mem_accel,
 		VkCommandBuffer cmd_buf
@@ -273,8 +283,6 @@ vkpt_pt_create_accel_bottom(
 	assert(mem_accel);
 	assert(!*mem_accel);
 
-	VkGeometryNV geometry = get_geometry(vertex_buffer, buffer_offset, num_vertices);
-
 	VkAccelerationStructureCreateInfoNV accel_create_info = {
 		.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_NV,
 		.info = {
@@ -340,8 +348,10 @@ vkpt_pt_create_accel_bottom(
 VkResult
 vkpt_pt_create_static(
 		VkBuffer vertex_buffer,
-		size_t buffer_offset,
-		int num_vertices
+		size_t vertex_offset,
+		int num_vertices,
+		size_t index_offset,
+		int num_indices
 		)
 {
 	VkCommandBufferAllocateInfo cmd_buf_info = {
@@ -362,9 +372,7 @@ vkpt_pt_create_static(
 	vkBeginCommandBuffer(cmd_buf, &cmd_begin_info);
 
 	VkResult ret = vkpt_pt_create_accel_bottom(
-		vertex_buffer,
-		buffer_offset,
-		num_vertices,
+		get_geometry_indexed(vertex_buffer, vertex_offset, num_vertices, index_offset, num_indices),
 		&accel_static,
 		&mem_accel_static,
 		cmd_buf);
@@ -394,9 +402,7 @@ vkpt_pt_create_dynamic(
 		)
 {
 	return vkpt_pt_create_accel_bottom(
-		vertex_buffer,
-		buffer_offset,
-		num_vertices,
+		get_geometry(vertex_buffer, buffer_offset, num_vertices),
 		accel_dynamic + idx,
 		mem_accel_dynamic + idx,
 		qvk.cmd_buf_current);
@@ -106,4 +106,9 @@ draw_profiler()
 	draw_query(x, y, font, #name + 9, name); y += 10;
 PROFILER_LIST
 #undef PROFILER_DO
+
+	char buf[256];
+	R_DrawString(x, y, 0, 128, "ubo upload", font);
+	snprintf(buf, sizeof buf, "%8.2f KiB", vkpt_uniform_buffer_upload_size() / 1024.0);
+	R_DrawString(x + 256, y, 0, 128, buf, font);
 }
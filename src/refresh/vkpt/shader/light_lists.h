@@ -150,10 +150,7 @@ sample_light_list(
 		
 		uint current_idx = get_light_list_lights(n_idx);
 
-		mat3 positions = mat3x3(
-				get_positions_bsp(current_idx * 3 + 0),
-				get_positions_bsp(current_idx * 3 + 1),
-				get_positions_bsp(current_idx * 3 + 2));
+		mat3 positions = get_bsp_triangle_positions(current_idx);
 
 		float m = projected_tri_area(positions, p, n, V);
 		mass += m;
@@ -177,10 +174,7 @@ sample_light_list(
 #if 0
 		
 		current_idx = int(get_light_list_lights(n_idx));
-		mat3 positions = mat3x3(
-				get_positions_bsp(current_idx * 3 + 0),
-				get_positions_bsp(current_idx * 3 + 1),
-				get_positions_bsp(current_idx * 3 + 2));
+		mat3 positions = get_bsp_triangle_positions(current_idx);
 		pdf = projected_tri_area(positions, p, n, V);
 #else
 		pdf = light_masses[i];
@@ -199,10 +193,7 @@ sample_light_list(
 	// assert: current_idx >= 0?
 	if (current_idx >= 0) {
 		current_idx = int(get_light_list_lights(current_idx));
-		mat3 positions = mat3x3(
-				get_positions_bsp(current_idx * 3 + 0),
-				get_positions_bsp(current_idx * 3 + 1),
-				get_positions_bsp(current_idx * 3 + 2));
+		mat3 positions = get_bsp_triangle_positions(current_idx);
 #if SOLID_ANGLE_SAMPLING
 		position_light = sample_projected_triangle(p, positions, rng.yz, normal_light, pdf);
 #else
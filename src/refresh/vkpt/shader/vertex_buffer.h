@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #define MAX_VERT_MODEL          (1 << 21)
 #define MAX_IDX_MODEL           (1 << 21)
+#define MAX_FRAMES_MODEL        (1 << 16)
 
 #define MAX_VERT_INSTANCED      (1 << 21)
 #define MAX_IDX_INSTANCED       (MAX_VERT_INSTANCED / 3)
@@ -41,11 +42,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	VERTEX_BUFFER_LIST_DO(float,    2, tex_coords_bsp,        (MAX_VERT_BSP        )) \
 	VERTEX_BUFFER_LIST_DO(uint32_t, 1, materials_bsp,         (MAX_VERT_BSP / 3    )) \
 	VERTEX_BUFFER_LIST_DO(uint32_t, 1, clusters_bsp,          (MAX_VERT_BSP / 3    )) \
+	VERTEX_BUFFER_LIST_DO(uint32_t, 3, idx_bsp,               (MAX_VERT_BSP / 3    )) \
 	\
-	VERTEX_BUFFER_LIST_DO(float,    3, positions_model,       (MAX_VERT_MODEL      )) \
-	VERTEX_BUFFER_LIST_DO(float,    3, normals_model,         (MAX_VERT_MODEL      )) \
-	VERTEX_BUFFER_LIST_DO(float,    2, tex_coords_model,      (MAX_VERT_MODEL      )) \
+	VERTEX_BUFFER_LIST_DO(uint32_t, 2, verts_model,           (MAX_VERT_MODEL      )) \
+	VERTEX_BUFFER_LIST_DO(uint32_t, 1, tex_coords_model,      (MAX_VERT_MODEL      )) \
 	VERTEX_BUFFER_LIST_DO(uint32_t, 3, idx_model,             (MAX_IDX_MODEL       )) \
+	VERTEX_BUFFER_LIST_DO(uint32_t, 2, frame_offsets_model,   (MAX_FRAMES_MODEL    )) \
+	VERTEX_BUFFER_LIST_DO(float,    3, frame_transforms_model,(MAX_FRAMES_MODEL * 2)) \
 	\
 	VERTEX_BUFFER_LIST_DO(float,    3, positions_instanced,   (MAX_VERT_MODEL      )) \
 	VERTEX_BUFFER_LIST_DO(float,    3, normals_instanced,     (MAX_VERT_MODEL      )) \
@@ -99,6 +102,13 @@ get_##name(uint idx) \
 	return vbo.name[idx]; \
 }
 
+#define GET_uint32_t_2(name) \
+uvec2 \
+get_##name(uint idx) \
+{ \
+	return uvec2(vbo.name[idx * 2 + 0], vbo.name[idx * 2 + 1]); \
+}
+
 #define GET_uint32_t_3(name) \
 uvec3 \
 get_##name(uint idx) \
@@ -130,6 +140,14 @@ set_##name(uint idx, uint u) \
 	vbo.name[idx] = u; \
 }
 
+#define SET_uint32_t_2(name) \
+void \
+set_##name(uint idx, uvec2 v) \
+{ \
+	vbo.name[idx * 2 + 0] = v[0]; \
+	vbo.name[idx * 2 + 1] = v[1]; \
+}
+
 #define SET_uint32_t_3(name) \
 void \
 set_##name(uint idx, uvec3 v) \
@@ -163,13 +181,25 @@ struct InstancedTriangle
 	uint   material_id;
 };
 
+mat3
+get_bsp_triangle_positions(uint prim_id)
+{
+	uvec3 idx = get_idx_bsp(prim_id);
+	return mat3x3(
+			get_positions_bsp(idx[0]),
+			get_positions_bsp(idx[1]),
+			get_positions_bsp(idx[2]));
+}
+
 Triangle
 get_bsp_triangle(uint prim_id)
 {
+	uvec3 idx = get_idx_bsp(prim_id);
+
 	Triangle t;
-	t.positions[0] = get_positions_bsp(prim_id * 3 + 0);
-	t.positions[1] = get_positions_bsp(prim_id * 3 + 1);
-	t.positions[2] = get_positions_bsp(prim_id * 3 + 2);
+	t.positions[0] = get_positions_bsp(idx[0]);
+	t.positions[1] = get_positions_bsp(idx[1]);
+	t.positions[2] = get_positions_bsp(idx[2]);
 
 	vec3 normal = normalize(cross(
 				t.positions[1] - t.positions[0],
@@ -179,9 +209,9 @@ get_bsp_triangle(uint prim_id)
 	t.normals[1] = normal;
 	t.normals[2] = normal;
 
-	t.tex_coords[0] = get_tex_coords_bsp(prim_id * 3 + 0);
-	t.tex_coords[1] = get_tex_coords_bsp(prim_id * 3 + 1);
-	t.tex_coords[2] = get_tex_coords_bsp(prim_id * 3 + 2);
+	t.tex_coords[0] = get_tex_coords_bsp(idx[0]);
+	t.tex_coords[1] = get_tex_coords_bsp(idx[1]);
+	t.tex_coords[2] = get_tex_coords_bsp(idx[2]);
 
 	t.material_id = get_materials_bsp(prim_id);
 
@@ -190,28 +220,40 @@ get_bsp_triangle(uint prim_id)
 	return t;
 }
 
+/* model vertices are stored as two words: x | y << 16 and z | normal << 16,
+ * positions are signed 16 bit in the space of the frame's scale/translate,
+ * the normal is octahedral encoded, see vkpt_encode_normal() */
+vec3
+decode_model_normal(uint v)
+{
+	vec2 f = vec2(v & 0xff, v >> 8) * (2.0 / 255.0) - 1.0;
+	vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+	if(n.z < 0)
+		n.xy = (1.0 - abs(f.yx)) * mix(vec2(-1), vec2(1), greaterThanEqual(f, vec2(0)));
+	return normalize(n);
+}
+
 Triangle
-get_model_triangle(uint prim_id, uint idx_offset, uint vert_offset)
+get_model_triangle(uint prim_id, uint idx_offset, uint frame)
 {
 	uvec3 idx = get_idx_model(prim_id + idx_offset / 3);
-	idx += vert_offset;
-
-	Triangle t;
-	t.positions[0] = get_positions_model(idx[0]);
-	t.positions[1] = get_positions_model(idx[1]);
-	t.positions[2] = get_positions_model(idx[2]);
-
-	vec3 normal = normalize(cross(
-				t.positions[1] - t.positions[0],
-				t.positions[2] - t.positions[0]));
 
-	t.normals[0] = get_normals_model(idx[0]);
-	t.normals[1] = get_normals_model(idx[1]);
-	t.normals[2] = get_normals_model(idx[2]);
+	uvec2 offsets   = get_frame_offsets_model(frame);
+	vec3  scale     = get_frame_transforms_model(frame * 2 + 0);
+	vec3  translate = get_frame_transforms_model(frame * 2 + 1);
 
-	t.tex_coords[0] = get_tex_coords_model(idx[0]);
-	t.tex_coords[1] = get_tex_coords_model(idx[1]);
-	t.tex_coords[2] = get_tex_coords_model(idx[2]);
+	Triangle t;
+	for(int i = 0; i < 3; i++) {
+		uvec2 v = get_verts_model(offsets.x + idx[i]);
+		ivec3 p = ivec3(
+				bitfieldExtract(int(v.x),  0, 16),
+				bitfieldExtract(int(v.x), 16, 16),
+				bitfieldExtract(int(v.y),  0, 16));
+
+		t.positions[i]  = vec3(p) * scale + translate;
+		t.normals[i]    = decode_model_normal(v.y >> 16);
+		t.tex_coords[i] = unpackHalf2x16(get_tex_coords_model(offsets.y + idx[i]));
+	}
 
 	t.material_id = 0; // needs to come from uniform buffer
 	return t;
@@ -223,42 +223,179 @@ vkpt_textures_upload_envmap(int w, int h, byte *data)
 	return VK_SUCCESS;
 }
 
-static VkResult
-load_blue_noise()
+/*
+ * The blue noise textures ship as RGBA PNGs but are uploaded as a texture
+ * array with one channel per layer.  Decoding and de-interleaving them on
+ * every init is slow, so the de-interleaved layers are cached in a single
+ * blob next to the PNGs and read straight into the upload buffer.  The
+ * blob records the newest PNG modification time and is rebuilt when that
+ * no longer matches.
+ */
+
+#define BLUE_NOISE_BLOB_IDENT   MakeRawLong('B', 'N', 'O', 'I')
+#define BLUE_NOISE_BLOB_VERSION 1
+
+typedef struct {
+	uint32_t ident;
+	uint32_t version;
+	uint32_t res;
+	uint32_t num_layers;
+	int64_t  stamp;
+} blue_noise_header_t;
+
+/* newest modification time of the source PNGs, -1 if there are none */
+static int64_t
+blue_noise_stamp()
 {
-	const int num_images = NUM_BLUE_NOISE_TEX / 4;
-	const int res = BLUE_NOISE_RES;
-	size_t img_size = res * res;
-	size_t total_size = img_size * sizeof(uint16_t);
+	int64_t stamp = -1;
 
-	BufferResource_t buf_img_upload;
-	buffer_create(&buf_img_upload, total_size * NUM_BLUE_NOISE_TEX, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	for(int i = 0; i < NUM_BLUE_NOISE_TEX / 4; i++) {
+		char buf[1024];
+		Q_STATBUF st;
 
-	uint16_t *bn_tex = (uint16_t *) buffer_map(&buf_img_upload);
+		snprintf(buf, sizeof buf, "blue_noise_textures/%d_%d/HDR_RGBA_%04d.png", BLUE_NOISE_RES, BLUE_NOISE_RES, i);
+		if(os_stat(buf, &st) == -1)
+			continue;
+		stamp = max(stamp, (int64_t)st.st_mtime);
+	}
+
+	return stamp;
+}
+
+static void
+blue_noise_blob_name(char *buf, size_t size)
+{
+	snprintf(buf, size, "blue_noise_textures/%d_%d.bin", BLUE_NOISE_RES, BLUE_NOISE_RES);
+}
+
+static qboolean
+load_blue_noise_blob(uint16_t *bn_tex, size_t size, int64_t stamp)
+{
+	blue_noise_header_t header;
+	char name[MAX_OSPATH];
+	qboolean ok = qfalse;
+
+	blue_noise_blob_name(name, sizeof name);
+	FILE *f = fopen(name, "rb");
+	if(!f)
+		return qfalse;
+
+	if(fread(&header, sizeof(header), 1, f) != 1)
+		goto done;
+	if(header.ident != BLUE_NOISE_BLOB_IDENT || header.version != BLUE_NOISE_BLOB_VERSION)
+		goto done;
+	if(header.res != BLUE_NOISE_RES || header.num_layers != NUM_BLUE_NOISE_TEX)
+		goto done;
+	/* without the PNGs the blob is all there is */
+	if(stamp != -1 && header.stamp != stamp) {
+		Com_DPrintf("%s is stale\n", name);
+		goto done;
+	}
+
+	ok = fread(bn_tex, size, 1, f) == 1;
+
+done:
+	fclose(f);
+	return ok;
+}
+
+static void
+save_blue_noise_blob(const uint16_t *bn_tex, size_t size, int64_t stamp)
+{
+	blue_noise_header_t header = {
+		.ident      = BLUE_NOISE_BLOB_IDENT,
+		.version    = BLUE_NOISE_BLOB_VERSION,
+		.res        = BLUE_NOISE_RES,
+		.num_layers = NUM_BLUE_NOISE_TEX,
+		.stamp      = stamp,
+	};
+	char name[MAX_OSPATH], tmp[MAX_OSPATH];
+
+	/* write to a temporary name so a partial blob is never picked up */
+	blue_noise_blob_name(name, sizeof name);
+	Q_concat(tmp, sizeof tmp, name, ".tmp", NULL);
+	FILE *f = fopen(tmp, "wb");
+	if(!f) {
+		Com_WPrintf("couldn't write %s\n", tmp);
+		return;
+	}
+
+	qboolean ok = fwrite(&header, sizeof(header), 1, f) == 1
+		&& fwrite(bn_tex, size, 1, f) == 1;
+	ok = !fclose(f) && ok;
+
+#ifdef _WIN32
+	/* rename doesn't replace an existing file there */
+	remove(name);
+#endif
+	if(!ok || rename(tmp, name)) {
+		Com_WPrintf("couldn't write %s\n", name);
+		remove(tmp);
+	}
+}
+
+static qboolean
+load_blue_noise_png(uint16_t *bn_tex)
+{
+	const int res = BLUE_NOISE_RES;
+	size_t img_size = res * res;
 
-	for(int i = 0; i < num_images; i++) {
+	for(int i = 0; i < NUM_BLUE_NOISE_TEX / 4; i++) {
 		int w, h, n;
 		char buf[1024];
 
-
 		snprintf(buf, sizeof buf, "blue_noise_textures/%d_%d/HDR_RGBA_%04d.png", res, res, i);
 		uint16_t *data = stbi_load_16(buf, &w, &h, &n, 4);
 		if(!data) {
 			Com_EPrintf("error loading blue noise tex %s\n", buf);
-			buffer_unmap(&buf_img_upload);
-			buffer_destroy(&buf_img_upload);
-			return VK_ERROR_INITIALIZATION_FAILED;
+			return qfalse;
 		}
 
 		/* loaded images are RGBA, want to upload as texture array though */
-		for(int k = 0; k < 4; k++) {
-			for(int j = 0; j < img_size; j++)
-				bn_tex[(i * 4 + k) * img_size + j] = data[j * 4 + k];
+		uint16_t *dst = bn_tex + i * 4 * img_size;
+		for(int j = 0; j < img_size; j++) {
+			dst[0 * img_size + j] = data[j * 4 + 0];
+			dst[1 * img_size + j] = data[j * 4 + 1];
+			dst[2 * img_size + j] = data[j * 4 + 2];
+			dst[3 * img_size + j] = data[j * 4 + 3];
 		}
 
 		stbi_image_free(data);
 	}
+
+	return qtrue;
+}
+
+static VkResult
+load_blue_noise()
+{
+	const int res = BLUE_NOISE_RES;
+	size_t img_size = res * res;
+	size_t total_size = img_size * sizeof(uint16_t);
+	size_t blob_size = total_size * NUM_BLUE_NOISE_TEX;
+
+	BufferResource_t buf_img_upload;
+	buffer_create(&buf_img_upload, blob_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	uint16_t *bn_tex = (uint16_t *) buffer_map(&buf_img_upload);
+
+	int64_t stamp = blue_noise_stamp();
+	if(!load_blue_noise_blob(bn_tex, blob_size, stamp)) {
+		/* decode in system memory, reading back from the mapped upload
+		 * buffer is very slow when it is uncached or write-combined */
+		uint16_t *decoded = Z_Malloc(blob_size);
+		if(!load_blue_noise_png(decoded)) {
+			Z_Free(decoded);
+			buffer_unmap(&buf_img_upload);
+			buffer_destroy(&buf_img_upload);
+			return VK_ERROR_INITIALIZATION_FAILED;
+		}
+		save_blue_noise_blob(decoded, blob_size, stamp);
+		memcpy(bn_tex, decoded, blob_size);
+		Z_Free(decoded);
+	}
+
 	buffer_unmap(&buf_img_upload);
 	bn_tex = NULL;
 
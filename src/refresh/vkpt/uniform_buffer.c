@@ -23,6 +23,105 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 static BufferResource_t uniform_buffers[MAX_SWAPCHAIN_IMAGES];
 static VkDescriptorPool desc_pool_ubo;
 
+/*
+ * The uniform buffers of all swapchain images stay mapped for their whole
+ * lifetime and form a ring of upload slots.  The CPU side copy is split
+ * into fixed size blocks; every block carries the version at which its
+ * contents last changed and every slot remembers the versions it holds,
+ * so an update only writes the blocks that changed since that slot was
+ * last in use.  Most of the buffer (instance arrays past the live entity
+ * count, matrices of a static camera) is then never written again.
+ */
+
+#define UBO_BLOCK_SIZE 256
+
+typedef struct {
+	size_t   size;
+	int      num_blocks;
+	int      num_slots;
+	uint32_t version;
+	byte     *shadow;         /* contents as of the last write */
+	uint32_t *block_version;  /* version of the last change per block */
+	uint32_t *slot_version[MAX_SWAPCHAIN_IMAGES];
+	byte     *slot_mem[MAX_SWAPCHAIN_IMAGES];
+	size_t   bytes_uploaded;  /* by the last write */
+} ubo_ring_t;
+
+static ubo_ring_t ubo_ring;
+
+static void
+ubo_ring_init(ubo_ring_t *ring, size_t size, int num_slots)
+{
+	assert(num_slots > 0 && num_slots <= MAX_SWAPCHAIN_IMAGES);
+
+	memset(ring, 0, sizeof(*ring));
+	ring->size = size;
+	ring->num_blocks = (size + UBO_BLOCK_SIZE - 1) / UBO_BLOCK_SIZE;
+	ring->num_slots = num_slots;
+	ring->shadow = Z_Mallocz(size);
+	ring->block_version = Z_Malloc(ring->num_blocks * sizeof(uint32_t));
+
+	/* slots start at version 0, so the first write to each is complete */
+	ring->version = 1;
+	for(int b = 0; b < ring->num_blocks; b++)
+		ring->block_version[b] = ring->version;
+	for(int i = 0; i < num_slots; i++)
+		ring->slot_version[i] = Z_Mallocz(ring->num_blocks * sizeof(uint32_t));
+}
+
+static void
+ubo_ring_destroy(ubo_ring_t *ring)
+{
+	Z_Free(ring->shadow);
+	Z_Free(ring->block_version);
+	for(int i = 0; i < ring->num_slots; i++)
+		Z_Free(ring->slot_version[i]);
+	memset(ring, 0, sizeof(*ring));
+}
+
+/* brings slot up to date with src, returns the number of bytes written */
+static size_t
+ubo_ring_write(ubo_ring_t *ring, int slot, const void *src)
+{
+	const byte *in = src;
+	byte *out = ring->slot_mem[slot];
+	uint32_t *have = ring->slot_version[slot];
+	size_t written = 0;
+
+	assert(slot >= 0 && slot < ring->num_slots);
+	assert(out);
+
+	ring->version++;
+	for(int b = 0; b < ring->num_blocks; b++) {
+		size_t ofs = (size_t)b * UBO_BLOCK_SIZE;
+		size_t len = min(ring->size - ofs, UBO_BLOCK_SIZE);
+		if(memcmp(ring->shadow + ofs, in + ofs, len)) {
+			memcpy(ring->shadow + ofs, in + ofs, len);
+			ring->block_version[b] = ring->version;
+		}
+	}
+
+	/* copy runs of stale blocks with one memcpy each */
+	for(int b = 0; b < ring->num_blocks; ) {
+		if(have[b] == ring->block_version[b]) {
+			b++;
+			continue;
+		}
+
+		int first = b;
+		for(; b < ring->num_blocks && have[b] != ring->block_version[b]; b++)
+			have[b] = ring->block_version[b];
+
+		size_t ofs = (size_t)first * UBO_BLOCK_SIZE;
+		size_t len = min(ring->size, (size_t)b * UBO_BLOCK_SIZE) - ofs;
+		memcpy(out + ofs, in + ofs, len);
+		written += len;
+	}
+
+	ring->bytes_uploaded = written;
+	return written;
+}
+
 VkResult
 vkpt_uniform_buffer_create()
 {
@@ -41,10 +140,13 @@ vkpt_uniform_buffer_create()
 
 	_VK(vkCreateDescriptorSetLayout(qvk.device, &layout_info, NULL, &qvk.desc_set_layout_ubo));
 
+	ubo_ring_init(&ubo_ring, sizeof(QVKUniformBuffer_t), qvk.num_swap_chain_images);
+
 	for(int i = 0; i < qvk.num_swap_chain_images; i++) {
 		buffer_create(uniform_buffers + i, sizeof(QVKUniformBuffer_t),
 			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		ubo_ring.slot_mem[i] = buffer_map(uniform_buffers + i);
 	}
 
 	VkDescriptorPoolSize pool_size = {
@@ -103,9 +205,12 @@ vkpt_uniform_buffer_destroy()
 	qvk.desc_set_layout_ubo = VK_NULL_HANDLE;
 
 	for(int i = 0; i < qvk.num_swap_chain_images; i++) {
+		buffer_unmap(uniform_buffers + i);
 		buffer_destroy(uniform_buffers + i);
 	}
 
+	ubo_ring_destroy(&ubo_ring);
+
 	return VK_SUCCESS;
 }
 
@@ -118,14 +223,69 @@ vkpt_uniform_buffer_update()
 	assert(ubo->buffer != VK_NULL_HANDLE);
 	assert(qvk.current_image_index < qvk.num_swap_chain_images);
 
-	QVKUniformBuffer_t *mapped_ubo = buffer_map(ubo);
-	assert(mapped_ubo);
-	memcpy(mapped_ubo, &vkpt_refdef.uniform_buffer, sizeof(QVKUniformBuffer_t));
-	buffer_unmap(ubo);
-	mapped_ubo = NULL;
+	ubo_ring_write(&ubo_ring, qvk.current_image_index, &vkpt_refdef.uniform_buffer);
 
 	return VK_SUCCESS;
 }
 
+size_t
+vkpt_uniform_buffer_upload_size()
+{
+	return ubo_ring.bytes_uploaded;
+}
+
+#if USE_TESTS
+
+/* runs the ring against plain memory, no device needed */
+void
+vkpt_ubo_test_f(void)
+{
+	int num_slots = 3, frames = 64, errors = 0;
+	size_t total = 0, size = sizeof(QVKUniformBuffer_t);
+	QVKUniformBuffer_t *src = Z_Mallocz(size);
+	ubo_ring_t ring;
+
+	ubo_ring_init(&ring, size, num_slots);
+	for(int i = 0; i < num_slots; i++)
+		ring.slot_mem[i] = Z_Malloc(size);
+
+	for(int f = 0; f < frames; f++) {
+		int slot = f % num_slots;
+		size_t expected;
+
+		/* a moving camera and a few animated entities */
+		src->current_frame_idx = f;
+		src->VP[0] = (float)f;
+		for(int i = 0; i < 4; i++)
+			src->model_instances[i].backlerp = (float)(f + i);
+
+		size_t bytes = ubo_ring_write(&ring, slot, src);
+		total += bytes;
+
+		if(memcmp(ring.slot_mem[slot], src, size)) {
+			Com_Printf("frame %d: slot %d differs from source\n", f, slot);
+			errors++;
+		}
+
+		/* after every slot was filled once, only the touched blocks may
+		 * be rewritten: frame index, VP and up to two for the instances */
+		expected = f < num_slots ? size : 4 * UBO_BLOCK_SIZE;
+		if(bytes > expected) {
+			Com_Printf("frame %d: wrote %"PRIz" bytes, expected at most %"PRIz"\n",
+				f, bytes, expected);
+			errors++;
+		}
+	}
+
+	Com_Printf("%d frames, %"PRIz" bytes uploaded (%"PRIz" with full copies), %d errors\n",
+		frames, total, size * frames, errors);
+
+	for(int i = 0; i < num_slots; i++)
+		Z_Free(ring.slot_mem[i]);
+	ubo_ring_destroy(&ring);
+	Z_Free(src);
+}
+
+#endif
 
 // vim: shiftwidth=4 noexpandtab tabstop=4 cindent
@@ -74,11 +74,13 @@ vkpt_vertex_buffer_upload_bsp_mesh_to_staging(bsp_mesh_t *bsp_mesh)
 	assert(vbo);
 
 	assert(bsp_mesh->num_vertices < MAX_VERT_BSP);
+	assert(bsp_mesh->num_indices  < MAX_VERT_BSP);
 
 	memcpy(vbo->positions_bsp,  bsp_mesh->positions, bsp_mesh->num_vertices * sizeof(float) * 3   );
 	memcpy(vbo->tex_coords_bsp, bsp_mesh->tex_coords,bsp_mesh->num_vertices * sizeof(float) * 2   );
-	memcpy(vbo->materials_bsp,  bsp_mesh->materials, bsp_mesh->num_vertices * sizeof(uint32_t) / 3);
-	memcpy(vbo->clusters_bsp,   bsp_mesh->clusters,  bsp_mesh->num_vertices * sizeof(uint32_t) / 3);
+	memcpy(vbo->materials_bsp,  bsp_mesh->materials, bsp_mesh->num_indices  * sizeof(uint32_t) / 3);
+	memcpy(vbo->clusters_bsp,   bsp_mesh->clusters,  bsp_mesh->num_indices  * sizeof(uint32_t) / 3);
+	memcpy(vbo->idx_bsp,        bsp_mesh->indices,   bsp_mesh->num_indices  * sizeof(uint32_t)    );
 
 	assert(bsp_mesh->num_clusters + 1   < MAX_LIGHT_LISTS);
 	assert(bsp_mesh->num_cluster_lights < MAX_LIGHT_LIST_NODES);
@@ -100,6 +102,8 @@ vkpt_vertex_buffer_upload_models_to_staging()
 
 	int idx_offset = 0;
 	int vertex_offset = 0;
+	int tc_offset = 0;
+	int frame_offset = 0;
 	for(int i = 0; i < MAX_MODELS; i++) {
 		if(!r_models[i].meshes) {
 			continue;
@@ -108,17 +112,20 @@ vkpt_vertex_buffer_upload_models_to_staging()
 
 		m->idx_offset    = idx_offset;
 		m->vertex_offset = vertex_offset;
+		m->tc_offset     = tc_offset;
+		m->frame_offset  = frame_offset;
 
 		assert(r_models[i].numframes > 0);
+		assert(frame_offset + r_models[i].numframes <= MAX_FRAMES_MODEL);
 
 		int num_verts = r_models[i].numframes * m->numverts;
 		assert(num_verts > 0);
 #if 0
 		for(int j = 0; j < num_verts; j++)
 			Com_Printf("%f %f %f\n",
-				m->positions[j][0],
-				m->positions[j][1],
-				m->positions[j][2]);
+				m->verts[j].pos[0],
+				m->verts[j].pos[1],
+				m->verts[j].pos[2]);
 
 		for(int j = 0; j < m->numtris; j++)
 			Com_Printf("%d %d %d\n",
@@ -133,10 +140,10 @@ vkpt_vertex_buffer_upload_models_to_staging()
 		FILE *f = fopen(buf, "wb+");
 		assert(f);
 		for(int j = 0; j < m->numverts; j++) {
-			fprintf(f, "v %f %f %f\n",
-				m->positions[j][0],
-				m->positions[j][1],
-				m->positions[j][2]);
+			fprintf(f, "v %d %d %d\n",
+				m->verts[j].pos[0],
+				m->verts[j].pos[1],
+				m->verts[j].pos[2]);
 		}
 		for(int j = 0; j < m->numindices / 3; j++) {
 			fprintf(f, "f %d %d %d\n",
@@ -147,12 +154,24 @@ vkpt_vertex_buffer_upload_models_to_staging()
 		fclose(f);
 #endif
 
-		memcpy(vbo->positions_model  + vertex_offset * 3, m->positions,  sizeof(float)    * 3 * num_verts);
-		memcpy(vbo->normals_model    + vertex_offset * 3, m->normals,    sizeof(float)    * 3 * num_verts);
-		memcpy(vbo->tex_coords_model + vertex_offset * 2, m->tex_coords, sizeof(float)    * 2 * num_verts);
-		memcpy(vbo->idx_model        + idx_offset,        m->indices,    sizeof(uint32_t) * m->numindices);
+		memcpy(vbo->verts_model      + vertex_offset * 2, m->verts,      sizeof(maliasvert_t) * num_verts);
+		memcpy(vbo->tex_coords_model + tc_offset,         m->tex_coords, sizeof(uint32_t)     * m->numverts);
+		memcpy(vbo->idx_model        + idx_offset,        m->indices,    sizeof(uint32_t)     * m->numindices);
+
+		for(int j = 0; j < r_models[i].numframes; j++) {
+			maliasframe_t *frame = &r_models[i].frames[j];
+			uint32_t *offsets = vbo->frame_offsets_model + (frame_offset + j) * 2;
+			float *transform = vbo->frame_transforms_model + (frame_offset + j) * 6;
+
+			offsets[0] = vertex_offset + j * m->numverts;
+			offsets[1] = tc_offset;
+			VectorCopy(frame->scale,     transform + 0);
+			VectorCopy(frame->translate, transform + 3);
+		}
 
 		vertex_offset += num_verts;
+		tc_offset     += m->numverts;
+		frame_offset  += r_models[i].numframes;
 		idx_offset    += m->numtris * 3;
 
 		assert(vertex_offset < MAX_VERT_MODEL);
@@ -162,7 +181,14 @@ vkpt_vertex_buffer_upload_models_to_staging()
 	buffer_unmap(&qvk.buf_vertex_staging);
 	vbo = NULL;
 
-	Com_Printf("uploaded %d vert, %d idx\n", vertex_offset, idx_offset);
+	/* float path: position, normal and texcoord per vertex and frame */
+	size_t size_float = (size_t)vertex_offset * sizeof(float) * 8;
+	size_t size_quant = (size_t)vertex_offset * sizeof(maliasvert_t)
+		+ (size_t)tc_offset * sizeof(uint32_t)
+		+ (size_t)frame_offset * (sizeof(uint32_t) * 2 + sizeof(float) * 6);
+
+	Com_Printf("uploaded %d vert, %d idx, %d frames (%"PRIz" KiB, %"PRIz" KiB as floats)\n",
+		vertex_offset, idx_offset, frame_offset, size_quant >> 10, size_float >> 10);
 
 	return VK_SUCCESS;
 }
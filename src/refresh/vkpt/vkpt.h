@@ -237,6 +237,13 @@ typedef struct bsp_mesh_s {
 void bsp_mesh_create_from_bsp(bsp_mesh_t *wm, bsp_t *bsp);
 void bsp_mesh_destroy(bsp_mesh_t *wm);
 void bsp_mesh_register_textures(bsp_t *bsp);
+#if USE_TESTS
+void bsp_mesh_bench_f(void);
+#endif
+
+void cpu_trace_frame(const bsp_mesh_t *wm, const refdef_t *fd, int width, int height,
+                     int spp, int num_threads, float *rgb, uint64_t rays[2]);
+void vkpt_reference_f(void);
 
 typedef struct vkpt_refdef_s {
 	QVKUniformBuffer_t uniform_buffer;
@@ -317,6 +324,10 @@ VkResult vkpt_draw_clear_stretch_pics();
 VkResult vkpt_uniform_buffer_create();
 VkResult vkpt_uniform_buffer_destroy();
 VkResult vkpt_uniform_buffer_update();
+size_t vkpt_uniform_buffer_upload_size();
+#if USE_TESTS
+void vkpt_ubo_test_f(void);
+#endif
 
 VkResult vkpt_vertex_buffer_create();
 VkResult vkpt_vertex_buffer_destroy();
@@ -343,7 +354,8 @@ VkResult vkpt_pt_create_pipelines();
 VkResult vkpt_pt_destroy_pipelines();
 
 VkResult vkpt_pt_create_toplevel(int idx);
-VkResult vkpt_pt_create_static(VkBuffer vertex_buffer, size_t buffer_offset, int num_vertices);
+VkResult vkpt_pt_create_static(VkBuffer vertex_buffer, size_t vertex_offset, int num_vertices,
+                               size_t index_offset, int num_indices);
 VkResult vkpt_pt_destroy_static();
 VkResult vkpt_pt_record_cmd_buffer(VkCommandBuffer cmd_buf, uint32_t frame_num);
 VkResult vkpt_pt_update_descripter_set_bindings(int idx);
@@ -359,6 +371,10 @@ VkResult vkpt_asvgf_create_gradient_samples(VkCommandBuffer cmd_buf, uint32_t fr
 
 qerror_t load_img(const char *name, image_t *image);
 
+#if USE_TESTS
+void vkpt_model_test_f(void);
+#endif
+
 typedef struct maliasframe_s {
     vec3_t  scale;
     vec3_t  translate;
@@ -366,16 +382,24 @@ typedef struct maliasframe_s {
     vec_t   radius;
 } maliasframe_t;
 
+/* quantized alias vertex: positions are in the frame's scale/translate
+ * space, the normal is octahedral 8+8 bits (see vkpt_encode_normal) */
+typedef struct maliasvert_s {
+    uint16_t        pos[3];
+    uint16_t        norm;
+} maliasvert_t;
+
 typedef struct maliasmesh_s {
     int             numverts;
     int             numtris;
     int             numindices;
     int             idx_offset;    /* offset in vertex buffer on device */
     int             vertex_offset; /* offset in vertex buffer on device */
+    int             tc_offset;     /* offset in vertex buffer on device */
+    int             frame_offset;  /* first entry in the device frame table */
     int             *indices;
-    vec3_t          *positions;
-    vec3_t          *normals;
-    vec2_t          *tex_coords;
+    maliasvert_t    *verts;        /* numverts * numframes */
+    uint32_t        *tex_coords;   /* numverts, packed half2 */
     image_t         *skins[MAX_ALIAS_SKINS];
     int             numskins;
 } maliasmesh_t;
@@ -393,5 +417,6 @@ typedef struct {
 
 extern drawStatic_t draw;
 extern cvar_t *cvar_rtx;
+extern cvar_t *vkpt_weld_world;
 
 #endif  /*__VKPT_H__*/
@@ -91,7 +91,9 @@ static void SV_EmitPacketEntities(client_t         *client,
             if (Q2PRO_SHORTANGLES(client, newnum)) {
                 flags |= MSG_ES_SHORTANGLES;
             }
-            MSG_WriteDeltaEntity(oldent, newent, flags);
+            if (!MSG_EntityUnchanged(oldent, newent, flags)) {
+                MSG_WriteDeltaEntity(oldent, newent, flags);
+            }
             oldindex++;
             newindex++;
             continue;
@@ -1696,8 +1696,11 @@ SV_RunGameFrame
 */
 static void SV_RunGameFrame(void)
 {
+    uint64_t mark = Sys_Microseconds();
+
     // save the entire world state if recording a serverdemo
     SV_MvdBeginFrame();
+    mark = SV_PerfMark(SV_PERF_MVD, mark);
 
 #if USE_CLIENT
     if (host_speeds->integer)
@@ -1707,10 +1710,14 @@ static void SV_RunGameFrame(void)
     X86_PUSH_FPCW;
     X86_SINGLE_FPCW;
 
+    PROF_BEGIN("ge->RunFrame");
     ge->RunFrame();
+    PROF_END();
 
     X86_POP_FPCW;
 
+    mark = SV_PerfMark(SV_PERF_GAME, mark);
+
 #if USE_CLIENT
     if (host_speeds->integer)
         time_after_game = Sys_Milliseconds();
@@ -1725,6 +1732,7 @@ static void SV_RunGameFrame(void)
 
     // save the entire world state if recording a serverdemo
     SV_MvdEndFrame();
+    SV_PerfMark(SV_PERF_MVD, mark);
 }
 
 /*
@@ -1813,6 +1821,8 @@ Returns amount of extra frametime available for sleeping on IO.
 */
 unsigned SV_Frame(unsigned msec)
 {
+    uint64_t mark, tick;
+
 #if USE_CLIENT
     time_before_game = time_after_game = 0;
 #endif
@@ -1825,9 +1835,12 @@ unsigned SV_Frame(unsigned msec)
         Cbuf_Execute(&cmd_buffer);
     }
 
+    mark = Sys_Microseconds();
+
 #if USE_MVD_CLIENT
     // run connections to MVD/GTV servers
     MVD_Frame();
+    mark = SV_PerfMark(SV_PERF_MVD, mark);
 #endif
 
     // read packets from UDP clients
@@ -1836,21 +1849,28 @@ unsigned SV_Frame(unsigned msec)
     if (svs.initialized) {
         // run connection to the anticheat server
         AC_Run();
+        mark = SV_PerfMark(SV_PERF_PACKETS, mark);
 
         // run connections from MVD/GTV clients
         SV_MvdRunClients();
+        mark = SV_PerfMark(SV_PERF_MVD, mark);
 
         // deliver fragments and reliable messages for connecting clients
         SV_SendAsyncPackets();
     }
 
+    SV_PerfMark(SV_PERF_PACKETS, mark);
+
     // move autonomous things around if enough time has passed
     sv.frameresidual += msec;
     if (sv.frameresidual < SV_FRAMETIME) {
+        SV_PerfEndFrame();
         return SV_FRAMETIME - sv.frameresidual;
     }
 
     if (svs.initialized && !check_paused()) {
+        tick = Sys_Microseconds();
+
         // check timeouts
         SV_CheckTimeouts();
 
@@ -1864,7 +1884,9 @@ unsigned SV_Frame(unsigned msec)
         SV_RunGameFrame();
 
         // send messages back to the UDP clients
+        mark = Sys_Microseconds();
         SV_SendClientMessages();
+        SV_PerfMark(SV_PERF_SEND, mark);
 
         // send a heartbeat to the master if needed
         SV_MasterHeartbeat();
@@ -1874,8 +1896,13 @@ unsigned SV_Frame(unsigned msec)
 
         // advance for next frame
         sv.framenum++;
+
+        SV_PerfMark(SV_PERF_TICK, tick);
+        SV_PerfEndTick();
     }
 
+    SV_PerfEndFrame();
+
     if (COM_DEDICATED) {
         // run cmd buffer in dedicated mode
         if (cmd_buffer.waitCount > 0) {
@@ -2049,6 +2076,8 @@ void SV_Init(void)
 {
     SV_InitOperatorCommands();
 
+    SV_PerfInit();
+
     SV_MvdRegister();
 
 #if USE_MVD_CLIENT
@@ -36,6 +36,7 @@ typedef struct {
     netstream_t stream;
 #if USE_ZLIB
     z_stream    z;
+    qboolean    shared; // receives frames from shared deflate stream
 #endif
     unsigned    msglen;
     unsigned    lastmessage;
@@ -73,13 +74,46 @@ typedef struct {
     qhandle_t       recording;
     int             numlevels; // stop after that many levels
     int             numframes; // stop after that many frames
+    size_t          recsize;   // bytes written so far
 
     // TCP client pool
     gtv_client_t    *clients; // [sv_mvd_maxclients]
+
+#if USE_ZLIB
+    // frames are deflated once for all clients past their gamestate
+    z_stream        z;
+    qboolean        zreset;   // next frame must not reference history
+    byte            *zbuf;    // [ZBUF_SIZE]
+    size_t          zlen;     // compressed frame length
+    size_t          zsize;    // uncompressed frame length
+    uLong           zadler;   // checksum of uncompressed frame
+#endif
 } mvd_server_t;
 
+#define ZBUF_SIZE   (MAX_GTS_MSGLEN * 2)
+
 static mvd_server_t     mvd;
 
+// Local recorder writer thread. Frames are copied into a ring buffer by the
+// main thread and written out (and possibly gzip compressed) by the writer,
+// so that slow disks don't stall the server frame.
+#define REC_BUFFER_SIZE     (1 << 20)
+#define REC_BUFFER_MASK     (REC_BUFFER_SIZE - 1)
+
+typedef struct {
+    sys_thread_t    *thread;
+    sys_event_t     *wakeup;
+    byte            *data;      // [REC_BUFFER_SIZE]
+    unsigned        head;       // advanced by main thread
+    unsigned        tail;       // advanced by writer thread
+    unsigned        pending;    // head including uncommitted data
+    int             error;      // first write error
+    int             shutdown;
+    qboolean        overflowed;
+} rec_writer_t;
+
+static rec_writer_t     rec;
+
 // TCP client lists
 static LIST_DECL(gtv_client_list);
 static LIST_DECL(gtv_active_list);
@@ -105,6 +139,8 @@ static cvar_t   *sv_mvd_disconnect_time;
 static cvar_t   *sv_mvd_suspend_time;
 static cvar_t   *sv_mvd_allow_stufftext;
 static cvar_t   *sv_mvd_spawn_dummy;
+static cvar_t   *sv_mvd_async;
+static cvar_t   *sv_mvd_shared_deflate;
 
 static qboolean mvd_enable(void);
 static void     mvd_disable(void);
@@ -113,13 +149,16 @@ static void     mvd_error(const char *reason);
 static void     write_stream(gtv_client_t *client, void *data, size_t len);
 static void     write_message(gtv_client_t *client, gtv_serverop_t op);
 #if USE_ZLIB
-static void     flush_stream(gtv_client_t *client, int flush);
+static qboolean flush_stream(gtv_client_t *client, int flush);
+static void     write_shared(gtv_client_t *client);
 #endif
 
 static void     rec_stop(void);
 static qboolean rec_allowed(void);
 static void     rec_start(qhandle_t demofile);
 static void     rec_write(void);
+static void     rec_queue(const void *data, size_t len);
+static qboolean rec_commit(void);
 
 
 /*
@@ -806,7 +845,9 @@ static void emit_frame(void)
         // quantize
         MSG_PackEntity(&newes, &ent->s, qfalse);
 
-        MSG_WriteDeltaEntity(oldes, &newes, flags);
+        if (!MSG_EntityUnchanged(oldes, &newes, flags)) {
+            MSG_WriteDeltaEntity(oldes, &newes, flags);
+        }
 
         // shuffle current state to previous
         copy_entity_state(oldes, &newes, flags);
@@ -961,27 +1002,20 @@ static void mvd_disable(void)
 static void rec_frame(size_t total)
 {
     uint16_t msglen;
-    ssize_t ret;
 
     if (!total)
         return;
 
     msglen = LittleShort(total);
-    ret = FS_Write(&msglen, 2, mvd.recording);
-    if (ret != 2)
-        goto fail;
-    ret = FS_Write(mvd.message.data, mvd.message.cursize, mvd.recording);
-    if (ret != mvd.message.cursize)
-        goto fail;
-    ret = FS_Write(msg_write.data, msg_write.cursize, mvd.recording);
-    if (ret != msg_write.cursize)
-        goto fail;
-    ret = FS_Write(mvd.datagram.data, mvd.datagram.cursize, mvd.recording);
-    if (ret != mvd.datagram.cursize)
-        goto fail;
+    rec_queue(&msglen, 2);
+    rec_queue(mvd.message.data, mvd.message.cursize);
+    rec_queue(msg_write.data, msg_write.cursize);
+    rec_queue(mvd.datagram.data, mvd.datagram.cursize);
+    if (!rec_commit())
+        return;
 
     if (sv_mvd_maxsize->value > 0 &&
-        FS_Tell(mvd.recording) > sv_mvd_maxsize->value * 1000) {
+        mvd.recsize > sv_mvd_maxsize->value * 1000) {
         Com_Printf("Stopping MVD recording, maximum size reached.\n");
         rec_stop();
         return;
@@ -993,13 +1027,61 @@ static void rec_frame(size_t total)
         rec_stop();
         return;
     }
+}
 
-    return;
+#if USE_ZLIB
+static qboolean deflate_data(const void *data, size_t len, int flush)
+{
+    z_streamp z = &mvd.z;
 
-fail:
-    Com_EPrintf("Couldn't write local MVD: %s\n", Q_ErrorString(ret));
-    rec_stop();
+    z->next_in = (Bytef *)data;
+    z->avail_in = (uInt)len;
+    z->next_out = mvd.zbuf + mvd.zlen;
+    z->avail_out = (uInt)(ZBUF_SIZE - mvd.zlen);
+
+    if (deflate(z, flush) != Z_OK)
+        return qfalse;
+
+    mvd.zlen = ZBUF_SIZE - z->avail_out;
+
+    // output buffer is large enough to never run out of space
+    return !z->avail_in && z->avail_out;
+}
+
+static qboolean deflate_part(const void *data, size_t len)
+{
+    if (!len)
+        return qtrue;
+
+    mvd.zadler = adler32(mvd.zadler, data, len);
+    mvd.zsize += len;
+    return deflate_data(data, len, Z_NO_FLUSH);
+}
+
+/*
+Compresses the frame into shared buffer. Output is sync flushed so that it
+can be appended to streams of all clients sharing it.
+*/
+static qboolean deflate_frame(const byte *header, size_t total)
+{
+    mvd.zlen = mvd.zsize = 0;
+    mvd.zadler = adler32(0, NULL, 0);
+
+    // some client may have received private data since last frame,
+    // or joined the shared stream
+    if (mvd.zreset) {
+        if (!deflate_data(NULL, 0, Z_FULL_FLUSH))
+            return qfalse;
+        mvd.zreset = qfalse;
+    }
+
+    return deflate_part(header, 3) &&
+           deflate_part(mvd.message.data, mvd.message.cursize) &&
+           deflate_part(msg_write.data, msg_write.cursize) &&
+           deflate_part(mvd.datagram.data, mvd.datagram.cursize) &&
+           deflate_data(NULL, 0, Z_SYNC_FLUSH);
 }
+#endif
 
 /*
 ==================
@@ -1074,8 +1156,28 @@ void SV_MvdEndFrame(void)
     header[1] = (total >> 8) & 255;
     header[2] = GTS_STREAM_DATA;
 
+#if USE_ZLIB
+    // compress frame once for clients sharing the stream
+    FOR_EACH_ACTIVE_GTV(client) {
+        if (client->shared) {
+            if (!deflate_frame(header, total)) {
+                mvd_error("shared deflate failed");
+                return;
+            }
+            break;
+        }
+    }
+#endif
+
     // send frame to clients
     FOR_EACH_ACTIVE_GTV(client) {
+#if USE_ZLIB
+        if (client->shared) {
+            write_shared(client);
+            NET_UpdateStream(&client->stream);
+            continue;
+        }
+#endif
         write_stream(client, header, sizeof(header));
         write_stream(client, mvd.message.data, mvd.message.cursize);
         write_stream(client, msg_write.data, msg_write.cursize);
@@ -1311,7 +1413,7 @@ static void remove_client(gtv_client_t *client)
 }
 
 #if USE_ZLIB
-static void flush_stream(gtv_client_t *client, int flush)
+static qboolean flush_stream(gtv_client_t *client, int flush)
 {
     fifo_t *fifo = &client->stream.send;
     z_streamp z = &client->z;
@@ -1320,10 +1422,16 @@ static void flush_stream(gtv_client_t *client, int flush)
     int ret;
 
     if (client->state <= cs_zombie) {
-        return;
+        return qfalse;
     }
     if (!z->state) {
-        return;
+        return qtrue;
+    }
+
+    // private data and shared frames must not reference each other
+    if (client->shared && flush == Z_SYNC_FLUSH) {
+        flush = Z_FULL_FLUSH;
+        mvd.zreset = qtrue;
     }
 
     z->next_in = NULL;
@@ -1332,8 +1440,15 @@ static void flush_stream(gtv_client_t *client, int flush)
     do {
         data = FIFO_Reserve(fifo, &len);
         if (!len) {
-            // FIXME: this is not an error when flushing
-            return;
+            // rest of the output stays buffered inside zlib, which is fine
+            // for private stream, but shared frames can't be appended to
+            // partially flushed block
+            if (client->shared) {
+                Com_DPrintf("TCP client %s[%s] fell back to private stream\n",
+                            client->name, NET_AdrToString(&client->stream.address));
+                client->shared = qfalse;
+            }
+            return qfalse;
         }
 
         z->next_out = data;
@@ -1347,6 +1462,8 @@ static void flush_stream(gtv_client_t *client, int flush)
             client->bufcount = 0;
         }
     } while (ret == Z_OK);
+
+    return qtrue;
 }
 #endif
 
@@ -1375,6 +1492,67 @@ static void drop_client(gtv_client_t *client, const char *error)
     client->lastmessage = svs.realtime;
 }
 
+#if USE_ZLIB
+static void write_shared(gtv_client_t *client)
+{
+    if (client->state <= cs_zombie) {
+        return;
+    }
+
+    if (!FIFO_TryWrite(&client->stream.send, mvd.zbuf, mvd.zlen)) {
+        drop_client(client, "overflowed");
+        return;
+    }
+
+    // keep zlib trailer checksum valid
+    client->z.adler = adler32_combine(client->z.adler, mvd.zadler, mvd.zsize);
+}
+
+static void stop_shared_stream(void)
+{
+    gtv_client_t *client;
+
+    // move everyone back to private streams, full flush makes sure their
+    // history doesn't reference shared frames
+    FOR_EACH_ACTIVE_GTV(client) {
+        if (client->shared) {
+            flush_stream(client, Z_SYNC_FLUSH);
+            client->shared = qfalse;
+        }
+    }
+
+    if (mvd.z.state) {
+        deflateEnd(&mvd.z);
+    }
+    Z_Free(mvd.zbuf);
+    mvd.zbuf = NULL;
+}
+
+static qboolean init_shared_stream(void)
+{
+    if (!sv_mvd_shared_deflate->integer) {
+        stop_shared_stream();
+        return qfalse;
+    }
+
+    if (mvd.z.state) {
+        return qtrue;
+    }
+
+    // raw deflate, output is appended to existing zlib streams
+    mvd.z.zalloc = SV_zalloc;
+    mvd.z.zfree = SV_zfree;
+    if (deflateInit2(&mvd.z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        Com_EPrintf("Couldn't initialize shared MVD stream.\n");
+        Cvar_Set("sv_mvd_shared_deflate", "0");
+        return qfalse;
+    }
+
+    mvd.zbuf = SV_Malloc(ZBUF_SIZE);
+    return qtrue;
+}
+#endif
 
 static void write_stream(gtv_client_t *client, void *data, size_t len)
 {
@@ -1583,6 +1761,10 @@ static void parse_stream_start(gtv_client_t *client)
     }
 
 #if USE_ZLIB
+    // switch to shared stream once gamestate is flushed
+    if (client->z.state && init_shared_stream()) {
+        client->shared = qtrue;
+    }
     flush_stream(client, Z_SYNC_FLUSH);
 #endif
 }
@@ -1602,6 +1784,7 @@ static void parse_stream_stop(gtv_client_t *client)
     write_message(client, GTS_STREAM_STOP);
 #if USE_ZLIB
     flush_stream(client, Z_SYNC_FLUSH);
+    client->shared = qfalse;
 #endif
 }
 
@@ -2018,6 +2201,11 @@ void SV_MvdMapChanged(void)
         // send gamestate to all MVD clients
         FOR_EACH_ACTIVE_GTV(client) {
             write_message(client, GTS_STREAM_DATA);
+#if USE_ZLIB
+            if (client->shared) {
+                flush_stream(client, Z_SYNC_FLUSH);
+            }
+#endif
             NET_UpdateStream(&client->stream);
         }
     }
@@ -2135,6 +2323,13 @@ void SV_MvdShutdown(error_type_t type)
     Z_Free(mvd.message.data);
     Z_Free(mvd.clients);
 
+#if USE_ZLIB
+    if (mvd.z.state) {
+        deflateEnd(&mvd.z);
+    }
+    Z_Free(mvd.zbuf);
+#endif
+
     // close server TCP socket
     NET_Listen(qfalse);
 
@@ -2150,25 +2345,136 @@ LOCAL MVD RECORDER
 ==============================================================================
 */
 
+static void rec_thread(void *arg)
+{
+    unsigned head, tail, len;
+    ssize_t ret;
+    int shutdown;
+
+    do {
+        Sys_WaitEvent(rec.wakeup);
+
+        // data committed before shutdown request is guaranteed to be seen
+        shutdown = q_atomic_load(&rec.shutdown);
+
+        // drain everything committed so far
+        tail = rec.tail;
+        while ((head = q_atomic_load(&rec.head)) != tail) {
+            len = min(head - tail, REC_BUFFER_SIZE - (tail & REC_BUFFER_MASK));
+            if (!q_atomic_load(&rec.error)) {
+                ret = FS_Write(rec.data + (tail & REC_BUFFER_MASK), len, mvd.recording);
+                if (ret != len)
+                    q_atomic_store(&rec.error, ret < 0 ? ret : Q_ERR_FAILURE);
+            }
+            tail += len;
+            q_atomic_store(&rec.tail, tail);
+        }
+    } while (!shutdown);
+}
+
+static void rec_start_thread(void)
+{
+    if (!sv_mvd_async->integer)
+        return;
+
+    rec.data = SV_Malloc(REC_BUFFER_SIZE);
+    rec.wakeup = Sys_CreateEvent();
+    rec.thread = Sys_CreateThread(rec_thread, NULL);
+    if (!rec.thread) {
+        Sys_DestroyEvent(rec.wakeup);
+        Z_Free(rec.data);
+        memset(&rec, 0, sizeof(rec));
+    }
+}
+
+// blocks until all committed data is written out
+static void rec_stop_thread(void)
+{
+    if (!rec.thread)
+        return;
+
+    q_atomic_store(&rec.shutdown, 1);
+    Sys_SetEvent(rec.wakeup);
+    Sys_JoinThread(rec.thread);
+    Sys_DestroyEvent(rec.wakeup);
+    Z_Free(rec.data);
+    rec.thread = NULL;
+}
+
+static void rec_queue(const void *data, size_t len)
+{
+    unsigned head, n;
+    ssize_t ret;
+
+    if (!len)
+        return;
+
+    mvd.recsize += len;
+
+    if (!rec.thread) {
+        if (rec.error)
+            return;
+        ret = FS_Write(data, len, mvd.recording);
+        if (ret != len)
+            rec.error = ret < 0 ? ret : Q_ERR_FAILURE;
+        return;
+    }
+
+    if (rec.overflowed)
+        return;
+
+    if (REC_BUFFER_SIZE - (rec.pending - q_atomic_load(&rec.tail)) < len) {
+        rec.overflowed = qtrue;
+        return;
+    }
+
+    while (len) {
+        head = rec.pending & REC_BUFFER_MASK;
+        n = min(len, REC_BUFFER_SIZE - head);
+        memcpy(rec.data + head, data, n);
+        data = (const byte *)data + n;
+        rec.pending += n;
+        len -= n;
+    }
+}
+
+// makes queued data visible to writer thread, stops recording on error
+static qboolean rec_commit(void)
+{
+    qerror_t ret;
+
+    if (rec.thread && !rec.overflowed && rec.pending != rec.head) {
+        q_atomic_store(&rec.head, rec.pending);
+        Sys_SetEvent(rec.wakeup);
+    }
+
+    if (rec.overflowed) {
+        Com_EPrintf("Couldn't write local MVD: writer thread fell behind\n");
+        rec_stop();
+        return qfalse;
+    }
+
+    ret = q_atomic_load(&rec.error);
+    if (ret) {
+        Com_EPrintf("Couldn't write local MVD: %s\n", Q_ErrorString(ret));
+        rec_stop();
+        return qfalse;
+    }
+
+    return qtrue;
+}
+
 static void rec_write(void)
 {
     uint16_t msglen;
-    ssize_t ret;
 
     if (!msg_write.cursize)
         return;
 
     msglen = LittleShort(msg_write.cursize);
-    ret = FS_Write(&msglen, 2, mvd.recording);
-    if (ret != 2)
-        goto fail;
-    ret = FS_Write(msg_write.data, msg_write.cursize, mvd.recording);
-    if (ret == msg_write.cursize)
-        return;
-
-fail:
-    Com_EPrintf("Couldn't write local MVD: %s\n", Q_ErrorString(ret));
-    rec_stop();
+    rec_queue(&msglen, 2);
+    rec_queue(msg_write.data, msg_write.cursize);
+    rec_commit();
 }
 
 // Stops server local MVD recording.
@@ -2182,7 +2488,13 @@ static void rec_stop(void)
 
     // write demo EOF marker
     msglen = 0;
-    FS_Write(&msglen, 2, mvd.recording);
+    rec_queue(&msglen, 2);
+    if (rec.thread && !rec.overflowed) {
+        q_atomic_store(&rec.head, rec.pending);
+    }
+
+    rec_stop_thread();
+    memset(&rec, 0, sizeof(rec));
 
     FS_FCloseFile(mvd.recording);
     mvd.recording = 0;
@@ -2210,10 +2522,14 @@ static void rec_start(qhandle_t demofile)
     mvd.recording = demofile;
     mvd.numlevels = 0;
     mvd.numframes = 0;
+    mvd.recsize = 0;
     mvd.clients_active = svs.realtime;
 
+    rec_start_thread();
+
     magic = MVD_MAGIC;
-    FS_Write(&magic, 4, demofile);
+    rec_queue(&magic, 4);
+    rec_commit();
 
     if (mvd.active) {
         emit_gamestate();
@@ -2383,6 +2699,8 @@ void SV_MvdRegister(void)
     sv_mvd_suspend_time = Cvar_Get("sv_mvd_suspend_time", "5", 0);
     sv_mvd_allow_stufftext = Cvar_Get("sv_mvd_allow_stufftext", "0", CVAR_LATCH);
     sv_mvd_spawn_dummy = Cvar_Get("sv_mvd_spawn_dummy", "1", 0);
+    sv_mvd_async = Cvar_Get("sv_mvd_async", "1", 0);
+    sv_mvd_shared_deflate = Cvar_Get("sv_mvd_shared_deflate", "1", 0);
 
     Cmd_Register(c_svmvd);
 }
@@ -78,6 +78,13 @@ typedef struct gtv_s {
     string_entry_t  *demohead, *demoentry;
     size_t          demosize, demopos;
     qboolean        demowait;
+
+    // demo index
+    off_t           demogamestate;  // file position of current gamestate
+    struct mvd_segment_s    *demosegs;
+    int             numdemosegs;
+    qboolean        demoindexed;    // segments were loaded from index file
+    qboolean        demopartial;    // maps were skipped, don't save index
 } gtv_t;
 
 static const char *const gtv_states[GTV_NUM_STATES] = {
@@ -119,6 +126,7 @@ static cvar_t  *mvd_buffer_size;
 static cvar_t  *mvd_username;
 static cvar_t  *mvd_password;
 static cvar_t  *mvd_snaps;
+static cvar_t  *mvd_index;
 
 // ====================================================================
 
@@ -138,12 +146,9 @@ void MVD_StopRecord(mvd_t *mvd)
 
 static void MVD_Free(mvd_t *mvd)
 {
-    mvd_snap_t *snap, *next;
     int i;
 
-    LIST_FOR_EACH_SAFE(mvd_snap_t, snap, next, &mvd->snapshots, entry) {
-        Z_Free(snap);
-    }
+    MVD_ClearSnapshots(mvd);
 
     // stop demo recording
     if (mvd->demorecording) {
@@ -328,7 +333,6 @@ static mvd_t *create_channel(gtv_t *gtv)
     mvd->pool.max_edicts = MAX_EDICTS;
     mvd->pm_type = PM_SPECTATOR;
     mvd->min_packets = mvd_wait_delay->value * 10;
-    List_Init(&mvd->snapshots);
     List_Init(&mvd->clients);
     List_Init(&mvd->entry);
 
@@ -558,6 +562,340 @@ static ssize_t demo_read_first(qhandle_t f)
     return read ? read : Q_ERR_UNEXPECTED_EOF;
 }
 
+#define SNAPSHOT_CHUNK      64
+
+#define MVD_INDEX_MAGIC     MakeRawLong('M','I','D','X')
+#define MVD_INDEX_VERSION   1
+
+// snapshots of a single map, keyed by position of the gamestate message
+typedef struct mvd_segment_s {
+    off_t       gamestate;
+    off_t       offset;         // position of first snapshot in index file
+    int         numsnapshots;
+    mvd_snap_t  **snapshots;    // collected during playback
+} mvd_segment_t;
+
+static void add_snapshot(mvd_t *mvd, mvd_snap_t *snap)
+{
+    if (!(mvd->numsnapshots & (SNAPSHOT_CHUNK - 1))) {
+        mvd->snapshots = Z_Realloc(mvd->snapshots, sizeof(mvd->snapshots[0]) *
+                                   (mvd->numsnapshots + SNAPSHOT_CHUNK));
+    }
+    mvd->snapshots[mvd->numsnapshots++] = snap;
+}
+
+static void free_snapshots(mvd_snap_t **snapshots, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        Z_Free(snapshots[i]);
+    }
+
+    Z_Free(snapshots);
+}
+
+static qboolean demo_collecting(gtv_t *gtv)
+{
+    return gtv && gtv->demoplayback && !gtv->demoindexed &&
+        !gtv->demopartial && mvd_index->integer > 0;
+}
+
+/*
+Frees snapshots of the current map. When building demo index, snapshots are
+moved into the list of segments to be saved at the end of demo instead.
+*/
+void MVD_ClearSnapshots(mvd_t *mvd)
+{
+    gtv_t *gtv = mvd->gtv;
+    mvd_segment_t *seg;
+
+    if (!mvd->numsnapshots)
+        return;
+
+    if (demo_collecting(gtv) && (!gtv->numdemosegs ||
+        gtv->demosegs[gtv->numdemosegs - 1].gamestate < gtv->demogamestate)) {
+        gtv->demosegs = Z_Realloc(gtv->demosegs, sizeof(*seg) * (gtv->numdemosegs + 1));
+        seg = &gtv->demosegs[gtv->numdemosegs++];
+        seg->gamestate = gtv->demogamestate;
+        seg->offset = 0;
+        seg->numsnapshots = mvd->numsnapshots;
+        seg->snapshots = mvd->snapshots;
+    } else {
+        free_snapshots(mvd->snapshots, mvd->numsnapshots);
+    }
+
+    mvd->snapshots = NULL;
+    mvd->numsnapshots = 0;
+}
+
+static void demo_free_index(gtv_t *gtv)
+{
+    int i;
+
+    for (i = 0; i < gtv->numdemosegs; i++) {
+        free_snapshots(gtv->demosegs[i].snapshots, gtv->demosegs[i].numsnapshots);
+    }
+
+    Z_Free(gtv->demosegs);
+    gtv->demosegs = NULL;
+    gtv->numdemosegs = 0;
+    gtv->demoindexed = qfalse;
+    gtv->demopartial = qfalse;
+}
+
+static char *demo_index_name(gtv_t *gtv)
+{
+    return va("%s.idx", gtv->demoentry->string);
+}
+
+static ssize_t read_index(void *buf, size_t len, qhandle_t f)
+{
+    ssize_t ret = FS_Read(buf, len, f);
+
+    if (ret == len)
+        return Q_ERR_SUCCESS;
+
+    return ret < 0 ? ret : Q_ERR_UNEXPECTED_EOF;
+}
+
+// reads the table of segments from index file, snapshots themselves are
+// loaded when the corresponding gamestate is reached
+static void demo_load_index(gtv_t *gtv)
+{
+    uint32_t header[5], segment[3], entry[4];
+    char *name = demo_index_name(gtv);
+    mvd_segment_t *seg;
+    qhandle_t f;
+    ssize_t ret;
+    int i, j, count;
+    off_t pos;
+
+    if (mvd_index->integer <= 0 || !gtv->demosize)
+        return;
+
+    FS_FOpenFile(name, &f, FS_MODE_READ);
+    if (!f)
+        return;
+
+    if ((ret = read_index(header, sizeof(header), f)))
+        goto fail;
+
+    if (LittleLong(header[0]) != MVD_INDEX_MAGIC ||
+        LittleLong(header[1]) != MVD_INDEX_VERSION ||
+        LittleLong(header[2]) != (uint32_t)gtv->demosize ||
+        LittleLong(header[3]) != (uint32_t)((uint64_t)gtv->demosize >> 32)) {
+        Com_DPrintf("Ignoring stale MVD index %s\n", name);
+        FS_FCloseFile(f);
+        return;
+    }
+
+    count = LittleLong(header[4]);
+    if (count < 0 || count > MAX_LOADFILE) {
+        ret = Q_ERR_INVALID_FORMAT;
+        goto fail;
+    }
+
+    gtv->demosegs = MVD_Mallocz(sizeof(*seg) * count);
+    gtv->numdemosegs = count;
+
+    for (i = 0; i < count; i++) {
+        if ((ret = read_index(segment, sizeof(segment), f)))
+            goto fail;
+
+        seg = &gtv->demosegs[i];
+        seg->gamestate = LittleLong(segment[0]) | ((uint64_t)LittleLong(segment[1]) << 32);
+        seg->numsnapshots = LittleLong(segment[2]);
+        seg->offset = FS_Tell(f);
+
+        // skip over snapshot data
+        for (j = 0; j < seg->numsnapshots; j++) {
+            if ((ret = read_index(entry, sizeof(entry), f)))
+                goto fail;
+            if (LittleLong(entry[3]) > MAX_MSGLEN) {
+                ret = Q_ERR_INVALID_FORMAT;
+                goto fail;
+            }
+            pos = FS_Tell(f) + LittleLong(entry[3]);
+            if ((ret = FS_Seek(f, pos)))
+                goto fail;
+        }
+    }
+
+    FS_FCloseFile(f);
+
+    Com_DPrintf("Loaded %d segments from %s\n", count, name);
+
+    gtv->demoindexed = qtrue;
+    return;
+
+fail:
+    Com_WPrintf("[%s] Couldn't load MVD index %s: %s\n",
+                gtv->name, name, Q_ErrorString(ret));
+    FS_FCloseFile(f);
+    demo_free_index(gtv);
+}
+
+// loads indexed snapshots for the gamestate just parsed
+static void demo_load_segment(gtv_t *gtv)
+{
+    uint32_t entry[4];
+    mvd_t *mvd = gtv->mvd;
+    mvd_segment_t *seg;
+    mvd_snap_t *snap;
+    qhandle_t f;
+    ssize_t ret;
+    size_t msglen;
+    off_t filepos;
+    int i, framenum;
+
+    if (!gtv->demoindexed)
+        return;
+
+    for (i = 0, seg = gtv->demosegs; i < gtv->numdemosegs; i++, seg++) {
+        if (seg->gamestate == gtv->demogamestate)
+            break;
+    }
+    if (i == gtv->numdemosegs || !seg->numsnapshots)
+        return;
+
+    FS_FOpenFile(demo_index_name(gtv), &f, FS_MODE_READ);
+    if (!f)
+        return;
+
+    ret = FS_Seek(f, seg->offset);
+    if (ret)
+        goto fail;
+
+    free_snapshots(mvd->snapshots, mvd->numsnapshots);
+    mvd->snapshots = NULL;
+    mvd->numsnapshots = 0;
+
+    framenum = INT_MIN;
+    for (i = 0; i < seg->numsnapshots; i++) {
+        if ((ret = read_index(entry, sizeof(entry), f)))
+            goto fail;
+
+        filepos = LittleLong(entry[1]) | ((uint64_t)LittleLong(entry[2]) << 32);
+        msglen = LittleLong(entry[3]);
+        if ((int)LittleLong(entry[0]) <= framenum || msglen > MAX_MSGLEN ||
+            filepos <= gtv->demogamestate || filepos > gtv->demosize) {
+            ret = Q_ERR_INVALID_FORMAT;
+            goto fail;
+        }
+
+        snap = MVD_Malloc(sizeof(*snap) + msglen - 1);
+        snap->framenum = framenum = LittleLong(entry[0]);
+        snap->filepos = filepos;
+        snap->msglen = msglen;
+        add_snapshot(mvd, snap);
+
+        if ((ret = read_index(snap->data, msglen, f)))
+            goto fail;
+    }
+
+    FS_FCloseFile(f);
+
+    Com_DPrintf("[%s] loaded %d snaps from index\n", mvd->name, mvd->numsnapshots);
+
+    mvd->last_snapshot = framenum;
+    return;
+
+fail:
+    Com_WPrintf("[%s] Couldn't load MVD index segment: %s\n",
+                gtv->name, Q_ErrorString(ret));
+    FS_FCloseFile(f);
+    free_snapshots(mvd->snapshots, mvd->numsnapshots);
+    mvd->snapshots = NULL;
+    mvd->numsnapshots = 0;
+}
+
+// called when the end of demo is reached
+static void demo_save_index(gtv_t *gtv)
+{
+    uint32_t header[5], segment[3], entry[4];
+    char *name;
+    mvd_segment_t *seg;
+    mvd_snap_t *snap;
+    qhandle_t f;
+    ssize_t ret;
+    int i, j;
+
+    if (!demo_collecting(gtv) || !gtv->demosize)
+        return;
+
+    // move snapshots of the last map into index
+    if (gtv->mvd)
+        MVD_ClearSnapshots(gtv->mvd);
+
+    if (!gtv->numdemosegs)
+        return;
+
+    name = demo_index_name(gtv);
+    FS_FOpenFile(name, &f, FS_MODE_WRITE);
+    if (!f) {
+        Com_EPrintf("[%s] Couldn't open %s for writing\n", gtv->name, name);
+        return;
+    }
+
+    header[0] = LittleLong(MVD_INDEX_MAGIC);
+    header[1] = LittleLong(MVD_INDEX_VERSION);
+    header[2] = LittleLong((uint32_t)gtv->demosize);
+    header[3] = LittleLong((uint32_t)((uint64_t)gtv->demosize >> 32));
+    header[4] = LittleLong(gtv->numdemosegs);
+
+    ret = FS_Write(header, sizeof(header), f);
+    if (ret != sizeof(header))
+        goto fail;
+
+    for (i = 0, seg = gtv->demosegs; i < gtv->numdemosegs; i++, seg++) {
+        segment[0] = LittleLong((uint32_t)seg->gamestate);
+        segment[1] = LittleLong((uint32_t)((uint64_t)seg->gamestate >> 32));
+        segment[2] = LittleLong(seg->numsnapshots);
+
+        ret = FS_Write(segment, sizeof(segment), f);
+        if (ret != sizeof(segment))
+            goto fail;
+
+        for (j = 0; j < seg->numsnapshots; j++) {
+            snap = seg->snapshots[j];
+            entry[0] = LittleLong(snap->framenum);
+            entry[1] = LittleLong((uint32_t)snap->filepos);
+            entry[2] = LittleLong((uint32_t)((uint64_t)snap->filepos >> 32));
+            entry[3] = LittleLong(snap->msglen);
+
+            ret = FS_Write(entry, sizeof(entry), f);
+            if (ret != sizeof(entry))
+                goto fail;
+
+            ret = FS_Write(snap->data, snap->msglen, f);
+            if (ret != snap->msglen)
+                goto fail;
+        }
+    }
+
+    FS_FCloseFile(f);
+
+    Com_Printf("[%s] -=- Wrote MVD index %s (%d maps)\n",
+               gtv->name, name, gtv->numdemosegs);
+    return;
+
+fail:
+    FS_FCloseFile(f);
+    Com_EPrintf("[%s] Couldn't write %s: %s\n", gtv->name, name,
+                Q_ErrorString(ret < 0 ? ret : Q_ERR_FAILURE));
+}
+
+// remembers position of the gamestate just parsed from message of given
+// length and picks up indexed snapshots for it
+static void demo_new_gamestate(gtv_t *gtv, ssize_t msglen)
+{
+    off_t pos = FS_Tell(gtv->demoplayback);
+
+    gtv->demogamestate = pos < 0 ? -1 : pos - msglen - 2;
+    demo_load_segment(gtv);
+}
+
 // periodically builds a fake demo packet used to reconstruct delta compression
 // state, configstrings and layouts at the given server frame.
 static void demo_emit_snapshot(mvd_t *mvd)
@@ -615,7 +953,7 @@ static void demo_emit_snapshot(mvd_t *mvd)
     snap->filepos = pos;
     snap->msglen = msg_write.cursize;
     memcpy(snap->data, msg_write.data, msg_write.cursize);
-    List_Append(&mvd->snapshots, &snap->entry);
+    add_snapshot(mvd, snap);
 
     Com_DPrintf("[%d] snaplen %"PRIz"\n", mvd->framenum, msg_write.cursize);
 
@@ -626,20 +964,23 @@ static void demo_emit_snapshot(mvd_t *mvd)
 
 static mvd_snap_t *demo_find_snapshot(mvd_t *mvd, int framenum)
 {
-    mvd_snap_t *snap, *prev;
+    int lo, hi, mid;
 
-    if (LIST_EMPTY(&mvd->snapshots))
+    if (!mvd->numsnapshots)
         return NULL;
 
-    prev = LIST_FIRST(mvd_snap_t, &mvd->snapshots, entry);
-
-    LIST_FOR_EACH(mvd_snap_t, snap, &mvd->snapshots, entry) {
-        if (snap->framenum > framenum)
-            break;
-        prev = snap;
+    // find the last snapshot not past framenum
+    lo = 0;
+    hi = mvd->numsnapshots - 1;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (mvd->snapshots[mid]->framenum > framenum)
+            hi = mid - 1;
+        else
+            lo = mid;
     }
 
-    return prev;
+    return mvd->snapshots[lo];
 }
 
 static void demo_update(gtv_t *gtv)
@@ -655,6 +996,7 @@ static void demo_finish(gtv_t *gtv, ssize_t ret)
         gtv_destroyf(gtv, "Couldn't read %s: %s", gtv->demoentry->string, Q_ErrorString(ret));
     }
 
+    demo_save_index(gtv);
     demo_play_next(gtv, gtv->demoentry->next);
 }
 
@@ -682,6 +1024,7 @@ static qboolean demo_read_frame(mvd_t *mvd)
 
     if (count) {
         Com_Printf("[%s] -=- Skipping map%s...\n", gtv->name, count == 1 ? "" : "s");
+        gtv->demopartial = qtrue;
         do {
             ret = demo_skip_map(gtv->demoplayback);
             if (ret <= 0) {
@@ -697,7 +1040,8 @@ static qboolean demo_read_frame(mvd_t *mvd)
 
     demo_update(gtv);
 
-    MVD_ParseMessage(mvd);
+    if (MVD_ParseMessage(mvd))
+        demo_new_gamestate(gtv, ret);
     demo_emit_snapshot(mvd);
     return qtrue;
 
@@ -745,6 +1089,12 @@ static void demo_play_next(gtv_t *gtv, string_entry_t *entry)
         gtv->mvd->demoseeking = qfalse;
     }
 
+    // snapshots of previous file are useless now
+    demo_free_index(gtv);
+    free_snapshots(gtv->mvd->snapshots, gtv->mvd->numsnapshots);
+    gtv->mvd->snapshots = NULL;
+    gtv->mvd->numsnapshots = 0;
+
     Com_Printf("[%s] -=- Reading from %s\n", gtv->name, entry->string);
 
     // parse gamestate
@@ -770,6 +1120,11 @@ static void demo_play_next(gtv_t *gtv, string_entry_t *entry)
         gtv->demosize = gtv->demopos = 0;
     }
 
+    // the first message is right after magic
+    demo_load_index(gtv);
+    gtv->demogamestate = 4;
+    demo_load_segment(gtv);
+
     demo_emit_snapshot(gtv->mvd);
 }
 
@@ -795,6 +1150,8 @@ static void demo_destroy(gtv_t *gtv)
         MVD_Destroy(mvd);
     }
 
+    demo_free_index(gtv);
+
     if (gtv->demoplayback) {
         FS_FCloseFile(gtv->demoplayback);
         gtv->demoplayback = 0;
@@ -2226,6 +2583,10 @@ static void MVD_Seek_f(void)
     if (frames < 0 || mvd->last_snapshot > mvd->framenum) {
         snap = demo_find_snapshot(mvd, dest);
 
+        // don't go back when skipping forward is shorter
+        if (snap && frames > 0 && snap->framenum <= mvd->framenum)
+            snap = NULL;
+
         if (snap) {
             Com_DPrintf("found snap at %d\n", snap->framenum);
             ret = FS_Seek(gtv->demoplayback, snap->filepos);
@@ -2272,6 +2633,8 @@ static void MVD_Seek_f(void)
         }
 
         gamestate = MVD_ParseMessage(mvd);
+        if (gamestate)
+            demo_new_gamestate(gtv, ret);
 
         demo_emit_snapshot(mvd);
 
@@ -2592,6 +2955,7 @@ void MVD_Register(void)
     mvd_username = Cvar_Get("mvd_username", "unnamed", 0);
     mvd_password = Cvar_Get("mvd_password", "", CVAR_PRIVATE);
     mvd_snaps = Cvar_Get("mvd_snaps", "10", 0);
+    mvd_index = Cvar_Get("mvd_index", "0", 0);
 
     Cmd_Register(c_mvd);
 }
@@ -113,7 +113,6 @@ typedef enum {
 } mvd_state_t;
 
 typedef struct {
-    list_t entry;
     int framenum;
     off_t filepos;
     size_t msglen;
@@ -139,7 +138,8 @@ typedef struct mvd_s {
     char        *demoname;
     qboolean    demoseeking;
     int         last_snapshot;
-    list_t      snapshots;
+    mvd_snap_t  **snapshots;    // sorted by framenum
+    int         numsnapshots;
 
     // delay buffer
     fifo_t      delay;
@@ -204,6 +204,7 @@ void MVD_File_g(genctx_t *ctx);
 void MVD_Spawn(void);
 
 void MVD_StopRecord(mvd_t *mvd);
+void MVD_ClearSnapshots(mvd_t *mvd);
 
 void MVD_StreamedStop_f(void);
 void MVD_StreamedRecord_f(void);
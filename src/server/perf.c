@@ -0,0 +1,298 @@
+/*
+Copyright (C) 2003-2008 Andrey Nazarov
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "server.h"
+
+/*
+==============================================================================
+
+SERVER TICK TELEMETRY
+
+Time spent in each phase is summed and recorded as one sample into
+log-linear histograms. Game tick phases take one sample per tick; packets
+and mvd also run between ticks, while paused and before the server is
+initialized, so they take one sample per server frame instead. Values
+below 16 usec are exact, above that every power of two is split into 16
+buckets, so percentiles are
+within 1/16 of the true value. Histograms are kept for the running
+window, the last completed window and everything since the last reset.
+
+Each completed window can be appended to a file in the game directory
+(sv_perf_log) and/or sent as one UDP datagram (sv_perf_udp), one line
+per phase:
+
+sv_perf <unix time> <phase> n=<samples> p50=<usec> p99=<usec> max=<usec>
+
+==============================================================================
+*/
+
+#define PERF_SUB_BITS   4
+#define PERF_SUB_COUNT  (1 << PERF_SUB_BITS)
+#define PERF_MAX_BITS   24      // ~16 seconds, longer samples are clamped
+#define PERF_BUCKETS    ((PERF_MAX_BITS - PERF_SUB_BITS + 1) << PERF_SUB_BITS)
+
+typedef struct {
+    unsigned    count;
+    unsigned    max;
+    unsigned    buckets[PERF_BUCKETS];
+} perf_hist_t;
+
+typedef enum {
+    WINDOW_CURRENT,
+    WINDOW_LAST,
+    WINDOW_TOTAL,
+
+    WINDOW_NUM
+} perf_window_t;
+
+static const char *const perf_names[SV_PERF_NUM] = {
+    "packets", "mvd", "game", "entities", "send", "tick"
+};
+
+static perf_hist_t  perf_hist[SV_PERF_NUM][WINDOW_NUM];
+static uint64_t     perf_accum[SV_PERF_NUM];
+static unsigned     perf_overruns[WINDOW_NUM];
+static unsigned     perf_window_start;
+
+static cvar_t   *sv_perf_window;
+static cvar_t   *sv_perf_log;
+static cvar_t   *sv_perf_udp;
+
+// resolved once when sv_perf_udp is set, lookups may block
+static netadr_t perf_udp_adr;
+
+static int perf_bucket(unsigned v)
+{
+    int msb;
+
+    if (v < PERF_SUB_COUNT)
+        return v;
+
+    v = min(v, (1u << PERF_MAX_BITS) - 1);
+    for (msb = PERF_SUB_BITS; v >> (msb + 1); msb++)
+        ;
+
+    return ((msb - PERF_SUB_BITS + 1) << PERF_SUB_BITS) +
+           ((v >> (msb - PERF_SUB_BITS)) & (PERF_SUB_COUNT - 1));
+}
+
+// highest value that falls into the bucket
+static unsigned perf_bucket_value(int i)
+{
+    int shift;
+
+    if (i < PERF_SUB_COUNT)
+        return i;
+
+    shift = (i >> PERF_SUB_BITS) - 1;
+    return ((PERF_SUB_COUNT + (i & (PERF_SUB_COUNT - 1)) + 1) << shift) - 1;
+}
+
+static unsigned perf_percentile(const perf_hist_t *h, float p)
+{
+    unsigned target, seen = 0;
+    int i;
+
+    if (!h->count)
+        return 0;
+
+    target = max(1, (unsigned)(h->count * p + 0.5f));
+    for (i = 0; i < PERF_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= target)
+            return min(perf_bucket_value(i), h->max);
+    }
+
+    return h->max;
+}
+
+static void perf_record(perf_hist_t *h, unsigned v)
+{
+    h->count++;
+    h->max = max(h->max, v);
+    h->buckets[perf_bucket(v)]++;
+}
+
+static void perf_flush(sv_perf_phase_t phase)
+{
+    unsigned v = min(perf_accum[phase], UINT_MAX);
+
+    perf_record(&perf_hist[phase][WINDOW_CURRENT], v);
+    perf_record(&perf_hist[phase][WINDOW_TOTAL], v);
+    perf_accum[phase] = 0;
+}
+
+/*
+=================
+SV_PerfMark
+
+Adds the time since `start' to the phase for the current tick and
+returns the current time, so consecutive phases can be chained.
+=================
+*/
+uint64_t SV_PerfMark(sv_perf_phase_t phase, uint64_t start)
+{
+    uint64_t now = Sys_Microseconds();
+
+    perf_accum[phase] += now - start;
+    return now;
+}
+
+static void perf_export(void)
+{
+    char        buffer[MAX_PACKETLEN_DEFAULT];
+    size_t      len = 0;
+    time_t      now = time(NULL);
+    qhandle_t   f;
+    int         i;
+
+    if (!sv_perf_log->string[0] && perf_udp_adr.type == NA_UNSPECIFIED)
+        return;
+
+    for (i = 0; i < SV_PERF_NUM; i++) {
+        const perf_hist_t *h = &perf_hist[i][WINDOW_LAST];
+
+        len += Q_scnprintf(buffer + len, sizeof(buffer) - len,
+                           "sv_perf %ld %s n=%u p50=%u p99=%u max=%u\n",
+                           (long)now, perf_names[i], h->count,
+                           perf_percentile(h, 0.5f),
+                           perf_percentile(h, 0.99f), h->max);
+    }
+
+    if (sv_perf_log->string[0]) {
+        FS_FOpenFile(sv_perf_log->string, &f, FS_MODE_APPEND | FS_FLAG_TEXT);
+        if (f) {
+            FS_Write(buffer, len, f);
+            FS_FCloseFile(f);
+        } else {
+            Com_WPrintf("Couldn't open %s for appending\n", sv_perf_log->string);
+            Cvar_Set("sv_perf_log", "");
+        }
+    }
+
+    if (perf_udp_adr.type != NA_UNSPECIFIED)
+        NET_SendPacket(NS_SERVER, buffer, len, &perf_udp_adr);
+}
+
+static void sv_perf_udp_changed(cvar_t *self)
+{
+    memset(&perf_udp_adr, 0, sizeof(perf_udp_adr));
+
+    if (!self->string[0])
+        return;
+
+    if (!NET_StringToAdr(self->string, &perf_udp_adr, PORT_SERVER)) {
+        Com_WPrintf("Couldn't resolve %s, not sending tick statistics\n", self->string);
+        memset(&perf_udp_adr, 0, sizeof(perf_udp_adr));
+    }
+}
+
+/*
+=================
+SV_PerfEndTick
+
+Records the game tick phases summed over this tick.
+=================
+*/
+void SV_PerfEndTick(void)
+{
+    int i;
+
+    if (perf_accum[SV_PERF_TICK] > SV_FRAMETIME * 1000) {
+        perf_overruns[WINDOW_CURRENT]++;
+        perf_overruns[WINDOW_TOTAL]++;
+    }
+
+    // packets and mvd are recorded by SV_PerfEndFrame
+    for (i = SV_PERF_GAME; i < SV_PERF_NUM; i++)
+        perf_flush(i);
+}
+
+/*
+=================
+SV_PerfEndFrame
+
+Records the per-frame phases and rotates the window. Called once at the
+end of every SV_Frame, whether a tick was run or not.
+=================
+*/
+void SV_PerfEndFrame(void)
+{
+    int i;
+
+    perf_flush(SV_PERF_PACKETS);
+    perf_flush(SV_PERF_MVD);
+
+    Cvar_ClampValue(sv_perf_window, 1, 3600);
+    if (svs.realtime - perf_window_start < sv_perf_window->value * 1000)
+        return;
+
+    perf_window_start = svs.realtime;
+    for (i = 0; i < SV_PERF_NUM; i++) {
+        perf_hist[i][WINDOW_LAST] = perf_hist[i][WINDOW_CURRENT];
+        memset(&perf_hist[i][WINDOW_CURRENT], 0, sizeof(perf_hist_t));
+    }
+    perf_overruns[WINDOW_LAST] = perf_overruns[WINDOW_CURRENT];
+    perf_overruns[WINDOW_CURRENT] = 0;
+
+    perf_export();
+}
+
+static void perf_print(perf_window_t w)
+{
+    int i;
+
+    Com_Printf("phase       samples      p50      p99      max\n"
+               "--------- --------- -------- -------- --------\n");
+    for (i = 0; i < SV_PERF_NUM; i++) {
+        const perf_hist_t *h = &perf_hist[i][w];
+
+        Com_Printf("%-9s %9u %8u %8u %8u\n", perf_names[i], h->count,
+                   perf_percentile(h, 0.5f), perf_percentile(h, 0.99f), h->max);
+    }
+    Com_Printf("%u ticks over %d ms\n", perf_overruns[w], SV_FRAMETIME);
+}
+
+static void SV_Perf_f(void)
+{
+    if (Cmd_Argc() > 1 && !strcmp(Cmd_Argv(1), "reset")) {
+        memset(perf_hist, 0, sizeof(perf_hist));
+        memset(perf_overruns, 0, sizeof(perf_overruns));
+        perf_window_start = svs.realtime;
+        Com_Printf("Server tick statistics reset.\n");
+        return;
+    }
+
+    Com_Printf("Server tick times in usec, last %g second window:\n",
+               sv_perf_window->value);
+    perf_print(WINDOW_LAST);
+
+    Com_Printf("\nSince start or last reset:\n");
+    perf_print(WINDOW_TOTAL);
+}
+
+void SV_PerfInit(void)
+{
+    sv_perf_window = Cvar_Get("sv_perf_window", "10", 0);
+    sv_perf_log = Cvar_Get("sv_perf_log", "", 0);
+    sv_perf_udp = Cvar_Get("sv_perf_udp", "", 0);
+    sv_perf_udp->changed = sv_perf_udp_changed;
+    sv_perf_udp_changed(sv_perf_udp);
+
+    Cmd_AddCommand("sv_perf", SV_Perf_f);
+}
@@ -881,6 +881,7 @@ void SV_SendClientMessages(void)
 {
     client_t    *client;
     size_t      cursize;
+    uint64_t    mark;
 
     // send a message to each connected client
     FOR_EACH_CLIENT(client) {
@@ -916,7 +917,9 @@ void SV_SendClientMessages(void)
         }
 
         // build the new frame and write it
+        mark = Sys_Microseconds();
         SV_BuildClientFrame(client);
+        SV_PerfMark(SV_PERF_ENTITIES, mark);
         client->WriteDatagram(client);
 
 advance:
@@ -32,6 +32,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "common/net/net.h"
 #include "common/net/chan.h"
 #include "common/pmove.h"
+#include "common/profile.h"
 #include "common/prompt.h"
 #include "common/protocol.h"
 #include "common/x86/fpu.h"
@@ -746,6 +747,25 @@ void SV_RegisterSavegames(void);
 #define SV_RegisterSavegames()      (void)0
 #endif
 
+//
+// perf.c
+//
+typedef enum {
+    SV_PERF_PACKETS,    // reading client packets, async sends
+    SV_PERF_MVD,        // MVD/GTV connections and server demo frames
+    SV_PERF_GAME,       // ge->RunFrame
+    SV_PERF_ENTITIES,   // building client frames
+    SV_PERF_SEND,       // writing client frames, includes entities
+    SV_PERF_TICK,       // whole game tick
+
+    SV_PERF_NUM
+} sv_perf_phase_t;
+
+void SV_PerfInit(void);
+uint64_t SV_PerfMark(sv_perf_phase_t phase, uint64_t start);
+void SV_PerfEndTick(void);
+void SV_PerfEndFrame(void);
+
 //============================================================
 
 //
@@ -37,6 +37,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <dirent.h>
 #include <dlfcn.h>
 #include <errno.h>
+#include <pthread.h>
 
 #if USE_SDL
 #include <SDL_main.h>
@@ -72,6 +73,14 @@ unsigned Sys_Milliseconds(void)
     return time;
 }
 
+uint64_t Sys_Microseconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 /*
 =================
 Sys_Quit
@@ -127,6 +136,119 @@ void Sys_Sleep(int msec)
     nanosleep(&req, NULL);
 }
 
+/*
+===============================================================================
+
+THREADS
+
+===============================================================================
+*/
+
+struct sys_thread_s {
+    pthread_t   thread;
+    void        (*func)(void *);
+    void        *arg;
+};
+
+struct sys_mutex_s {
+    pthread_mutex_t mutex;
+};
+
+struct sys_event_s {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    qboolean        signaled;
+};
+
+static void *thread_func(void *arg)
+{
+    sys_thread_t *t = arg;
+
+    t->func(t->arg);
+    return NULL;
+}
+
+sys_thread_t *Sys_CreateThread(void (*func)(void *), void *arg)
+{
+    sys_thread_t *t = Z_Malloc(sizeof(*t));
+    int ret;
+
+    t->func = func;
+    t->arg = arg;
+    ret = pthread_create(&t->thread, NULL, thread_func, t);
+    if (ret) {
+        Com_EPrintf("Couldn't create thread: %s\n", strerror(ret));
+        Z_Free(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+void Sys_JoinThread(sys_thread_t *t)
+{
+    pthread_join(t->thread, NULL);
+    Z_Free(t);
+}
+
+sys_mutex_t *Sys_CreateMutex(void)
+{
+    sys_mutex_t *m = Z_Malloc(sizeof(*m));
+
+    pthread_mutex_init(&m->mutex, NULL);
+    return m;
+}
+
+void Sys_DestroyMutex(sys_mutex_t *m)
+{
+    pthread_mutex_destroy(&m->mutex);
+    Z_Free(m);
+}
+
+void Sys_LockMutex(sys_mutex_t *m)
+{
+    pthread_mutex_lock(&m->mutex);
+}
+
+void Sys_UnlockMutex(sys_mutex_t *m)
+{
+    pthread_mutex_unlock(&m->mutex);
+}
+
+sys_event_t *Sys_CreateEvent(void)
+{
+    sys_event_t *e = Z_Malloc(sizeof(*e));
+
+    pthread_mutex_init(&e->mutex, NULL);
+    pthread_cond_init(&e->cond, NULL);
+    e->signaled = qfalse;
+    return e;
+}
+
+void Sys_DestroyEvent(sys_event_t *e)
+{
+    pthread_cond_destroy(&e->cond);
+    pthread_mutex_destroy(&e->mutex);
+    Z_Free(e);
+}
+
+void Sys_SetEvent(sys_event_t *e)
+{
+    pthread_mutex_lock(&e->mutex);
+    e->signaled = qtrue;
+    pthread_cond_signal(&e->cond);
+    pthread_mutex_unlock(&e->mutex);
+}
+
+void Sys_WaitEvent(sys_event_t *e)
+{
+    pthread_mutex_lock(&e->mutex);
+    while (!e->signaled)
+        pthread_cond_wait(&e->cond, &e->mutex);
+    e->signaled = qfalse;
+    pthread_mutex_unlock(&e->mutex);
+}
+
 #if USE_AC_CLIENT
 qboolean Sys_GetAntiCheatAPI(void)
 {
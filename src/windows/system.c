@@ -641,6 +641,19 @@ unsigned Sys_Milliseconds(void)
     return timeGetTime();
 }
 
+uint64_t Sys_Microseconds(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+
+    QueryPerformanceCounter(&count);
+    return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000 +
+           (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+}
+
 void Sys_AddDefaultConfig(void)
 {
 }
@@ -650,6 +663,110 @@ void Sys_Sleep(int msec)
     Sleep(msec);
 }
 
+/*
+===============================================================================
+
+THREADS
+
+===============================================================================
+*/
+
+struct sys_thread_s {
+    HANDLE  handle;
+    void    (*func)(void *);
+    void    *arg;
+};
+
+struct sys_mutex_s {
+    CRITICAL_SECTION    cs;
+};
+
+struct sys_event_s {
+    HANDLE  handle;
+};
+
+static DWORD WINAPI thread_func(LPVOID arg)
+{
+    sys_thread_t *t = arg;
+
+    t->func(t->arg);
+    return 0;
+}
+
+sys_thread_t *Sys_CreateThread(void (*func)(void *), void *arg)
+{
+    sys_thread_t *t = Z_Malloc(sizeof(*t));
+
+    t->func = func;
+    t->arg = arg;
+    t->handle = CreateThread(NULL, 0, thread_func, t, 0, NULL);
+    if (!t->handle) {
+        Com_EPrintf("Couldn't create thread: %#lx\n", GetLastError());
+        Z_Free(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+void Sys_JoinThread(sys_thread_t *t)
+{
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+    Z_Free(t);
+}
+
+sys_mutex_t *Sys_CreateMutex(void)
+{
+    sys_mutex_t *m = Z_Malloc(sizeof(*m));
+
+    InitializeCriticalSection(&m->cs);
+    return m;
+}
+
+void Sys_DestroyMutex(sys_mutex_t *m)
+{
+    DeleteCriticalSection(&m->cs);
+    Z_Free(m);
+}
+
+void Sys_LockMutex(sys_mutex_t *m)
+{
+    EnterCriticalSection(&m->cs);
+}
+
+void Sys_UnlockMutex(sys_mutex_t *m)
+{
+    LeaveCriticalSection(&m->cs);
+}
+
+sys_event_t *Sys_CreateEvent(void)
+{
+    sys_event_t *e = Z_Malloc(sizeof(*e));
+
+    e->handle = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (!e->handle)
+        Com_Error(ERR_FATAL, "Couldn't create event: %#lx", GetLastError());
+
+    return e;
+}
+
+void Sys_DestroyEvent(sys_event_t *e)
+{
+    CloseHandle(e->handle);
+    Z_Free(e);
+}
+
+void Sys_SetEvent(sys_event_t *e)
+{
+    SetEvent(e->handle);
+}
+
+void Sys_WaitEvent(sys_event_t *e)
+{
+    WaitForSingleObject(e->handle, INFINITE);
+}
+
 /*
 ================
 Sys_Init